@@ -22,9 +22,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
 #include "align454.h"
 
@@ -35,6 +37,40 @@
 
 #define IS_MATCH(a,b) ((a) == (b) || (b) == AMBIGUOUS_BASE)
 
+/*
+ * Sizes of the buffers owned by Alignment_ASW. Both the allocation code and
+ * asw_estimate_bytes are written in terms of these.
+ */
+/* one matrix row or row-state vector spanning (x_len + 1) columns */
+#define ROW_BYTES(type, x_len)   (sizeof(type) * ((x_len) + 1u))
+/* array of row pointers of a matrix with (y_len + 1) rows */
+#define INDEX_BYTES(type, y_len) (sizeof(type*) * ((y_len) + 1u))
+/* whole matrix: row pointers plus rows */
+#define MATRIX_BYTES(type, x_len, y_len) \
+        (INDEX_BYTES(type, y_len) + ((y_len) + 1u) * ROW_BYTES(type, x_len))
+/* elements in the CIGAR buffer: the trace plus padding for clipping on both ends */
+#define CIGAR_LEN(y_len)         ((y_len) + 4u)
+/* one quality-indexed penalty look-up table */
+#define PENALTY_TABLE_BYTES      (sizeof(int) * PHRED_RANGE)
+
+/*
+ * Scoring model: quality-indexed penalty look-up tables and the gap penalties
+ * for deletions (which do not depend on quality). Never modified after
+ * asw_model_new, so one instance can be used by any number of workspaces on
+ * any number of threads.
+ */
+struct ASW_Model {
+        int match_penalty[PHRED_RANGE],
+            mismatch_penalty[PHRED_RANGE],
+            gopen_penalty[PHRED_RANGE],
+            gext_penalty[PHRED_RANGE];
+
+        int GAP_OPEN_EXTEND,
+            GAP_EXTEND;
+
+        atomic_uint refcount;
+};
+
 /**
  * Describing how CIGAR operation/length is packed in a 32-bit integer.
  */
@@ -89,6 +125,9 @@ int ndigits(int i) {
     return n;
 }
 
+/* allocator of ASW_Fixed workspaces, see asw_fixed_init */
+static void *fixed_realloc(void *ptr, size_t size);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_new
@@ -98,12 +137,148 @@ int ndigits(int i) {
 Alignment_ASW* asw_new(int MATCH_PEN, int MISMATCH_PEN, int GAP_OPEN_EXTEND, int GAP_EXTEND)
 {
         /* use stdlib functions */
-        return asw_init(
-                asw_alloc(malloc, realloc, free),
-                MATCH_PEN,
-                MISMATCH_PEN,
-                GAP_OPEN_EXTEND,
-                GAP_EXTEND);
+        Alignment_ASW *al = asw_alloc(malloc, realloc, free);
+        if (al == NULL) return NULL;
+        if (asw_init(al, MATCH_PEN, MISMATCH_PEN, GAP_OPEN_EXTEND, GAP_EXTEND) == NULL) {
+                asw_free(al);
+                return NULL;
+        }
+        return al;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_workspace_new
+ *  Description:  Allocate a workspace using a shared scoring model
+ * =====================================================================================
+ */
+Alignment_ASW* asw_workspace_new(ASW_Model *model)
+{
+        Alignment_ASW *al = asw_alloc(malloc, realloc, free);
+        if (al == NULL) return NULL;
+        asw_set_model(al, model);
+        return al;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  fill_penalties
+ *  Description:  Compute quality-indexed penalty look-up tables
+ * =====================================================================================
+ */
+static void fill_penalties(int *match_penalty,
+                           int *mismatch_penalty,
+                           int *gopen_penalty,
+                           int *gext_penalty,
+                           int MATCH_PEN,
+                           int MISMATCH_PEN,
+                           int GAP_OPEN_EXTEND,
+                           int GAP_EXTEND)
+{
+        /* Initialize penalty look-up vectors */
+        const double qN = -10.0 * log10(0.75); /* P(error | N) = 0.75 */
+
+        unsigned int i;
+        for (i = 0u; i < PHRED_RANGE; ++i) {
+                double weight = 1.0 - pow(10.0, -((double)i + qN)/10.0);
+                match_penalty[i] = 10 + round(weight * (double)MATCH_PEN);
+                mismatch_penalty[i] = 10 + round(weight * (double)MISMATCH_PEN);
+                gopen_penalty[i] = 10 + round(weight * (double)GAP_OPEN_EXTEND);
+                gext_penalty[i] = 10 + round(weight * (double)GAP_EXTEND);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_model_new
+ *  Description:  Allocate a scoring model holding one reference
+ * =====================================================================================
+ */
+ASW_Model* asw_model_new(int MATCH_PEN, int MISMATCH_PEN, int GAP_OPEN_EXTEND, int GAP_EXTEND)
+{
+        ASW_Model *model = (ASW_Model*)malloc(sizeof(ASW_Model));
+        if (model == NULL) return NULL;
+
+        fill_penalties(model->match_penalty,
+                       model->mismatch_penalty,
+                       model->gopen_penalty,
+                       model->gext_penalty,
+                       MATCH_PEN,
+                       MISMATCH_PEN,
+                       GAP_OPEN_EXTEND,
+                       GAP_EXTEND);
+        model->GAP_OPEN_EXTEND = GAP_OPEN_EXTEND;
+        model->GAP_EXTEND = GAP_EXTEND;
+        atomic_init(&model->refcount, 1u);
+        return model;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_model_retain
+ *  Description:  Take a reference to a scoring model
+ * =====================================================================================
+ */
+ASW_Model* asw_model_retain(ASW_Model *model)
+{
+        /* the caller already holds a reference, so no ordering is needed */
+        atomic_fetch_add_explicit(&model->refcount, 1u, memory_order_relaxed);
+        return model;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_model_release
+ *  Description:  Drop a reference to a scoring model, freeing it with the last one
+ * =====================================================================================
+ */
+void asw_model_release(ASW_Model *model)
+{
+        if (model == NULL) return;
+        if (atomic_fetch_sub_explicit(&model->refcount, 1u, memory_order_acq_rel) == 1u) {
+                free(model);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_set_model
+ *  Description:  Make a workspace score with given model. A heap workspace takes a
+ *                reference to the model; an ASW_Fixed workspace copies its tables
+ *                (so that it never has to be released).
+ * =====================================================================================
+ */
+void asw_set_model(Alignment_ASW *al, ASW_Model *model)
+{
+        al->GAP_OPEN_EXTEND = model->GAP_OPEN_EXTEND;
+        al->GAP_EXTEND = model->GAP_EXTEND;
+
+        if (al->p_realloc == fixed_realloc) {
+                ASW_Fixed *fx = (ASW_Fixed*)al;
+                memcpy(fx->match_penalty, model->match_penalty, PENALTY_TABLE_BYTES);
+                memcpy(fx->mismatch_penalty, model->mismatch_penalty, PENALTY_TABLE_BYTES);
+                memcpy(fx->gopen_penalty, model->gopen_penalty, PENALTY_TABLE_BYTES);
+                memcpy(fx->gext_penalty, model->gext_penalty, PENALTY_TABLE_BYTES);
+                return;
+        }
+        asw_model_retain(model);
+        asw_model_release(al->model);
+        al->model = model;
+        al->match_penalty = model->match_penalty;
+        al->mismatch_penalty = model->mismatch_penalty;
+        al->gopen_penalty = model->gopen_penalty;
+        al->gext_penalty = model->gext_penalty;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_get_model
+ *  Description:  Scoring model of a heap workspace (NULL for ASW_Fixed)
+ * =====================================================================================
+ */
+ASW_Model* asw_get_model(const Alignment_ASW *al)
+{
+        return al->model;
 }
 
 /*
@@ -127,14 +302,14 @@ Alignment_ASW* asw_alloc(
         al->p_realloc = p_realloc;
         al->p_free = p_free;
 
-        if ((al->match_penalty = (int*)p_malloc(sizeof(int)*PHRED_RANGE)) == NULL)
-                goto cleanup;
-        if ((al->mismatch_penalty = (int*)p_malloc(sizeof(int)*PHRED_RANGE)) == NULL)
-                goto cleanup;
-        if ((al->gopen_penalty = (int*)p_malloc(sizeof(int)*PHRED_RANGE)) == NULL)
-                goto cleanup;
-        if ((al->gext_penalty = (int*)p_malloc(sizeof(int)*PHRED_RANGE)) == NULL)
-                goto cleanup;
+        /* look-up tables are set by asw_init or asw_set_model */
+        al->model = NULL;
+        al->match_penalty = NULL;
+        al->mismatch_penalty = NULL;
+        al->gopen_penalty = NULL;
+        al->gext_penalty = NULL;
+        al->GAP_OPEN_EXTEND = 0;
+        al->GAP_EXTEND = 0;
 
         if ((al->matTra = (cigar_t**)p_malloc(sizeof(cigar_t*) * 1u)) == NULL)
                 goto cleanup;
@@ -165,6 +340,9 @@ Alignment_ASW* asw_alloc(
         al->vecIns_m_act = NULL;
         al->I_ext_m_act = NULL;
         al->I_ext_m1_act = NULL;
+        al->vecCol_act = NULL;
+        al->lastRow_half = 0u;
+        al->layout = ASW_LAYOUT_SPLIT;
 
         al->db_len = 0u;
         al->subdb_len = 0u;
@@ -175,6 +353,10 @@ Alignment_ASW* asw_alloc(
         al->matTra[0] = NULL;
         al->rcigar = NULL;
 
+        al->n_match = al->n_mismatch = al->n_ins = al->n_del = al->nm = 0u;
+        al->md = al->md_begin = NULL;
+        al->md_len = 0u;
+
 #ifdef DEBUG
         al->matPen[0] = NULL;
         al->matIns[0] = NULL;
@@ -187,6 +369,59 @@ cleanup:
 }
 
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_estimate_bytes
+ *  Description:  Return the number of bytes an Alignment_ASW struct holds after
+ *                asw_alloc followed by asw_prepare and asw_align (and asw_trace if
+ *                ASW_FOOTPRINT_TRACE is set) on inputs with the given lengths.
+ *                Lengths are those of the aligned (unclipped) parts of the sequences.
+ *                Allocator overhead is not included.
+ * =====================================================================================
+ */
+size_t asw_estimate_bytes(size_t db_len, size_t query_len, unsigned int mode)
+{
+#ifdef DEBUG
+        /* DEBUG builds always keep the score matrices */
+        mode |= ASW_FOOTPRINT_DEBUG;
+#endif
+        if (mode & ASW_FOOTPRINT_FIXED) {
+                /* everything is inline */
+                if (db_len > ASW_FIXED_DB_MAX || query_len > ASW_FIXED_QUERY_MAX)
+                        return 0u;
+                return sizeof(ASW_Fixed);
+        }
+        /* asw_new: the struct itself and a private scoring model (workspaces
+         * sharing a model hold only the struct) */
+        size_t bytes = sizeof(Alignment_ASW) + sizeof(ASW_Model);
+
+        /* asw_prepare: trace matrix and row state */
+        bytes += MATRIX_BYTES(cigar_t, db_len, query_len);
+        if (mode & ASW_FOOTPRINT_DEBUG) {
+                /* matPen, matIns, matDel */
+                bytes += 3u * MATRIX_BYTES(int, db_len, query_len);
+        }
+        if (db_len > 0u) {
+                if (mode & ASW_FOOTPRINT_PACKED) {
+                        bytes += ROW_BYTES(ASW_Column, db_len);
+                } else {
+                        /* vecPen_m, vecPen_m1, vecIns_m, vecIns_m1 */
+                        bytes += 4u * ROW_BYTES(int, db_len);
+                        /* I_ext_m, I_ext_m1 */
+                        bytes += 2u * ROW_BYTES(uint32_t, db_len);
+                }
+        }
+
+        /* asw_trace: CIGAR buffer */
+        if (mode & ASW_FOOTPRINT_TRACE) {
+                bytes += sizeof(cigar_t) * CIGAR_LEN(query_len);
+                if (mode & ASW_FOOTPRINT_MD) {
+                        bytes += ASW_MD_LEN(db_len, query_len);
+                }
+        }
+        return bytes;
+}
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_set_phoffset
@@ -203,25 +438,32 @@ void asw_set_phoffset(Alignment_ASW* al, int phred_offset)
  *         Name:  asw_init
  *  Description:  Initialize an Alignment struct using provided penalty scores. The
  *                function is written in such a way as to allow multiple calls on a
- *                single object instance.
+ *                single object instance. A heap workspace gets a new scoring model
+ *                of its own (use asw_set_model to share one); returns NULL if that
+ *                cannot be allocated.
  * =====================================================================================
  */
 Alignment_ASW* asw_init(Alignment_ASW* al, int MATCH_PEN, int MISMATCH_PEN, int GAP_OPEN_EXTEND, int GAP_EXTEND) {
 
-        al->GAP_OPEN_EXTEND = GAP_OPEN_EXTEND;
-        al->GAP_EXTEND = GAP_EXTEND;
-
-        /* Initialize penalty look-up vectors */
-        const double qN = -10.0 * log10(0.75); /* P(error | N) = 0.75 */
-
-        unsigned int i;
-        for (i = 0u; i < PHRED_RANGE; ++i) {
-                double weight = 1.0 - pow(10.0, -((double)i + qN)/10.0);
-                al->match_penalty[i] = 10 + round(weight * (double)MATCH_PEN);
-                al->mismatch_penalty[i] = 10 + round(weight * (double)MISMATCH_PEN);
-                al->gopen_penalty[i] = 10 + round(weight * (double)GAP_OPEN_EXTEND);
-                al->gext_penalty[i] = 10 + round(weight * (double)GAP_EXTEND);
+        if (al->p_realloc == fixed_realloc) {
+                /* tables are inline */
+                ASW_Fixed *fx = (ASW_Fixed*)al;
+                al->GAP_OPEN_EXTEND = GAP_OPEN_EXTEND;
+                al->GAP_EXTEND = GAP_EXTEND;
+                fill_penalties(fx->match_penalty,
+                               fx->mismatch_penalty,
+                               fx->gopen_penalty,
+                               fx->gext_penalty,
+                               MATCH_PEN,
+                               MISMATCH_PEN,
+                               GAP_OPEN_EXTEND,
+                               GAP_EXTEND);
+                return al;
         }
+        ASW_Model *model = asw_model_new(MATCH_PEN, MISMATCH_PEN, GAP_OPEN_EXTEND, GAP_EXTEND);
+        if (model == NULL) return NULL;
+        asw_set_model(al, model);
+        asw_model_release(model);
         return al;
 }
 
@@ -234,10 +476,7 @@ Alignment_ASW* asw_init(Alignment_ASW* al, int MATCH_PEN, int MISMATCH_PEN, int
 void asw_free(Alignment_ASW *al) {
         if (al == NULL) return;
 
-        if (al->match_penalty != NULL) al->p_free(al->match_penalty);
-        if (al->mismatch_penalty != NULL) al->p_free(al->mismatch_penalty);
-        if (al->gopen_penalty != NULL) al->p_free(al->gopen_penalty);
-        if (al->gext_penalty != NULL) al->p_free(al->gext_penalty);
+        asw_model_release(al->model);
 
         if (al->vecPen_m_act != NULL) al->p_free(al->vecPen_m_act);
         if (al->vecPen_m1_act != NULL) al->p_free(al->vecPen_m1_act);
@@ -247,7 +486,10 @@ void asw_free(Alignment_ASW *al) {
         if (al->I_ext_m_act != NULL) al->p_free(al->I_ext_m_act);
         if (al->I_ext_m1_act != NULL) al->p_free(al->I_ext_m1_act);
 
+        if (al->vecCol_act != NULL) al->p_free(al->vecCol_act);
+
         if (al->rcigar != NULL) al->p_free(al->rcigar);
+        if (al->md != NULL) al->p_free(al->md);
 
         if (al->matTra != NULL) {
                 cigar_t ** matTra_p = al->matTra;
@@ -290,14 +532,13 @@ void asw_free(Alignment_ASW *al) {
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  asw_print_cigar
- *  Description:  Print CIGAR traceback to specified file or stream
+ *         Name:  asw_print_cigar_range
+ *  Description:  Print CIGAR operations in [cigar_p, cigar_end) to specified file
+ *                or stream
  * =====================================================================================
  */
-void asw_print_cigar(const Alignment_ASW* al, FILE *fp)
+void asw_print_cigar_range(const cigar_t* cigar_p, const cigar_t* cigar_end, FILE *fp)
 {
-        const cigar_t * cigar_p = al->cigar_begin;
-        const cigar_t * cigar_end = al->cigar_end;
         for (; cigar_p < cigar_end; ++cigar_p) {
                 cigar_t cigar = *cigar_p;
                 fprintf(fp, "%d%c ",
@@ -308,6 +549,146 @@ void asw_print_cigar(const Alignment_ASW* al, FILE *fp)
         fflush(fp);
 }
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_print_cigar
+ *  Description:  Print CIGAR traceback to specified file or stream
+ * =====================================================================================
+ */
+void asw_print_cigar(const Alignment_ASW* al, FILE *fp)
+{
+        asw_print_cigar_range(al->cigar_begin, al->cigar_end, fp);
+}
+
+/*
+ * Two decimal digits per entry, so that numbers are formatted two digits at a
+ * time without divisions by ten per digit
+ */
+static const char digit_pairs[201] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+/* longest formatted operation: 28-bit length, operation and separator */
+#define CIGAR_OP_MAX_CHARS 11u
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  format_cigar_op
+ *  Description:  Write length and operation character of a CIGAR operation to
+ *                buffer p; return number of characters written
+ * =====================================================================================
+ */
+static size_t format_cigar_op(char *p, cigar_t cigar)
+{
+        char tmp[10];
+        char *t = tmp + sizeof(tmp);
+        uint32_t num = cigar >> BAM_CIGAR_SHIFT;
+        while (num >= 100u) {
+                const char *d = digit_pairs + 2u * (num % 100u);
+                num /= 100u;
+                *--t = d[1];
+                *--t = d[0];
+        }
+        if (num >= 10u) {
+                const char *d = digit_pairs + 2u * num;
+                *--t = d[1];
+                *--t = d[0];
+        } else {
+                *--t = (char)('0' + num);
+        }
+        size_t n = (tmp + sizeof(tmp)) - t;
+        memcpy(p, t, n);
+        p[n] = cigar_chars[cigar & BAM_CIGAR_MASK];
+        return n + 1u;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_format_cigar_range
+ *  Description:  Write CIGAR operations in [cigar_begin, cigar_end) to a buffer of
+ *                cap bytes in the given style (ASW_CIGAR_SAM or ASW_CIGAR_SPACED)
+ *
+ *       Return:  Length of the complete string, not counting the terminating NUL.
+ *                As with snprintf, the output was truncated if this is not less
+ *                than cap; buf may be NULL if cap is zero.
+ * =====================================================================================
+ */
+size_t asw_format_cigar_range(const cigar_t* cigar_begin,
+                              const cigar_t* cigar_end,
+                              char *buf,
+                              size_t cap,
+                              int style)
+{
+        const cigar_t *cigar_p = cigar_begin;
+        size_t len = 0u;
+        char tmp[CIGAR_OP_MAX_CHARS + 1u];
+        for (; cigar_p < cigar_end; ++cigar_p) {
+                if (len + CIGAR_OP_MAX_CHARS < cap) {
+                        /* enough room for any operation: write in place */
+                        char *p = buf + len;
+                        if (style == ASW_CIGAR_SPACED && cigar_p != cigar_begin) {
+                                *p++ = ' ';
+                        }
+                        len = (p - buf) + format_cigar_op(p, *cigar_p);
+                } else {
+                        size_t n = 0u;
+                        if (style == ASW_CIGAR_SPACED && cigar_p != cigar_begin) {
+                                tmp[n++] = ' ';
+                        }
+                        n += format_cigar_op(tmp + n, *cigar_p);
+                        if (len < cap) {
+                                size_t room = cap - 1u - len;
+                                memcpy(buf + len, tmp, n < room ? n : room);
+                        }
+                        len += n;
+                }
+        }
+        if (cap > 0u) {
+                buf[len < cap ? len : cap - 1u] = '\0';
+        }
+        return len;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_format_cigar
+ *  Description:  Write CIGAR traceback to a buffer of cap bytes in the given style;
+ *                see asw_format_cigar_range
+ * =====================================================================================
+ */
+size_t asw_format_cigar(const Alignment_ASW* al, char *buf, size_t cap, int style)
+{
+        return asw_format_cigar_range(al->cigar_begin, al->cigar_end, buf, cap, style);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_show_cigar_range
+ *  Description:  Print CIGAR operations in [cigar_begin, cigar_end) to a (string)
+ *                buffer
+ * =====================================================================================
+ */
+
+const char* asw_show_cigar_range(const cigar_t* cigar_begin, const cigar_t* cigar_end)
+{
+        size_t len = asw_format_cigar_range(cigar_begin, cigar_end, NULL, 0u,
+                                            ASW_CIGAR_SPACED);
+        char *buf = (char*)malloc(len + 1u);
+        if (buf != NULL) {
+                asw_format_cigar_range(cigar_begin, cigar_end, buf, len + 1u,
+                                       ASW_CIGAR_SPACED);
+        }
+        return buf;
+}
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_show_cigar
@@ -317,25 +698,7 @@ void asw_print_cigar(const Alignment_ASW* al, FILE *fp)
 
 const char* asw_show_cigar(const Alignment_ASW* al)
 {
-        size_t len = 1;
-        const cigar_t * cigar_p = al->cigar_begin;
-        const cigar_t * cigar_end = al->cigar_end;
-        for (; cigar_p < cigar_end; ++cigar_p) {
-            cigar_t cigar = *cigar_p;
-            len += ndigits(cigar >> BAM_CIGAR_SHIFT) + 2;
-        }
-        if (len > 1) { len -= 1; }  // subtract last separator
-        char *buf = (char*)calloc(len, sizeof(char));
-        cigar_p = al->cigar_begin;
-        cigar_end = al->cigar_end;
-        for (char *p = buf; cigar_p < cigar_end; ++cigar_p) {
-            cigar_t cigar = *cigar_p;
-            int num = cigar >> BAM_CIGAR_SHIFT;
-            sprintf(p, "%d%c ", num, cigar_chars[cigar & BAM_CIGAR_MASK]);
-            p += sizeof(char) * ndigits(num) + 2;
-        }
-        buf[len - 1] = '\0';
-        return buf;
+        return asw_show_cigar_range(al->cigar_begin, al->cigar_end);
 }
 
 #ifdef DEBUG
@@ -424,7 +787,7 @@ cigar_t ** resize_matrix1(Alignment_ASW* al,
         size_t old_x_len = al->subdb_len,
                old_y_len = al->subquery_len;
 
-        size_t cigar_hor = sizeof(cigar_t) * (new_x_len + 1u);
+        size_t cigar_hor = ROW_BYTES(cigar_t, new_x_len);
         if (old_y_len != new_y_len) {
 
                 /* first free the bottom half */
@@ -434,7 +797,7 @@ cigar_t ** resize_matrix1(Alignment_ASW* al,
                         al->p_free(*matTra_p);
                 }
                 cigar_t ** tmp_matTra
-                      = (cigar_t**)al->p_realloc(matTra, sizeof(cigar_t*) * (new_y_len + 1u));
+                      = (cigar_t**)al->p_realloc(matTra, INDEX_BYTES(cigar_t, new_y_len));
                 if (tmp_matTra != NULL) matTra = tmp_matTra; else goto error;
 
                 /* fill the bottom half */
@@ -476,7 +839,7 @@ int ** resize_matrix2(Alignment_ASW* al,
         size_t old_x_len = al->subdb_len,
                old_y_len = al->subquery_len;
 
-        size_t cigar_hor = sizeof(int) * (new_x_len + 1u);
+        size_t cigar_hor = ROW_BYTES(int, new_x_len);
         if (old_y_len != new_y_len) {
 
                 /* first free the bottom half */
@@ -486,7 +849,7 @@ int ** resize_matrix2(Alignment_ASW* al,
                         al->p_free(*matTra_p);
                 }
                 int ** tmp_matTra
-                        = (int**)al->p_realloc(matTra, sizeof(int*) * (new_y_len + 1u));
+                        = (int**)al->p_realloc(matTra, INDEX_BYTES(int, new_y_len));
                 if (tmp_matTra != NULL) matTra = tmp_matTra; else goto error;
 
                 /* fill the bottom half */
@@ -513,6 +876,94 @@ error:
 }
 #endif
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  resize_rowstate
+ *  Description:  Reallocates the vectors holding row state of the alignment kernel
+ *                according to the selected layout
+ * =====================================================================================
+ */
+int resize_rowstate(Alignment_ASW* al, size_t new_x_len)
+{
+        if (al->layout == ASW_LAYOUT_PACKED) {
+                ASW_Column *ctmp = (ASW_Column*)al->p_realloc(al->vecCol_act,
+                                    ROW_BYTES(ASW_Column, new_x_len));
+                if (ctmp != NULL) al->vecCol_act = ctmp; else goto error;
+                return 0;
+        }
+        int *tmp;
+
+        tmp = (int*)al->p_realloc(al->vecPen_m1_act,
+                            ROW_BYTES(int, new_x_len));
+        if (tmp != NULL) al->vecPen_m1_act = tmp; else goto error;
+
+        tmp = (int*)al->p_realloc(al->vecPen_m_act,
+                            ROW_BYTES(int, new_x_len));
+        if (tmp != NULL) al->vecPen_m_act = tmp; else goto error;
+
+        tmp = (int*)al->p_realloc(al->vecIns_m1_act,
+                            ROW_BYTES(int, new_x_len));
+        if (tmp != NULL) al->vecIns_m1_act = tmp; else goto error;
+
+        tmp = (int*)al->p_realloc(al->vecIns_m_act,
+                            ROW_BYTES(int, new_x_len));
+        if (tmp != NULL) al->vecIns_m_act = tmp; else goto error;
+
+        uint32_t *utmp;
+
+        utmp = (uint32_t*)al->p_realloc(al->I_ext_m_act,
+                                  ROW_BYTES(uint32_t, new_x_len));
+        if (utmp != NULL) al->I_ext_m_act = utmp; else goto error;
+
+        utmp = (uint32_t*)al->p_realloc(al->I_ext_m1_act,
+                                  ROW_BYTES(uint32_t, new_x_len));
+        if (utmp != NULL) al->I_ext_m1_act = utmp; else goto error;
+
+        return 0;
+error:
+        return -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_set_layout
+ *  Description:  Select the memory layout of the row state used by the alignment
+ *                kernel. Vectors of the previous layout are released. Fixed
+ *                workspaces stay with ASW_LAYOUT_SPLIT.
+ * =====================================================================================
+ */
+int asw_set_layout(Alignment_ASW* al, int layout)
+{
+        if (layout != ASW_LAYOUT_SPLIT && layout != ASW_LAYOUT_PACKED)
+                return -1;
+        if (layout == al->layout)
+                return 0;
+        /* the row state of a fixed workspace is inline and cannot be reallocated */
+        if (al->p_realloc == fixed_realloc)
+                return -1;
+
+        if (al->layout == ASW_LAYOUT_PACKED) {
+                if (al->vecCol_act != NULL) al->p_free(al->vecCol_act);
+                al->vecCol_act = NULL;
+        } else {
+                if (al->vecPen_m_act != NULL) al->p_free(al->vecPen_m_act);
+                if (al->vecPen_m1_act != NULL) al->p_free(al->vecPen_m1_act);
+                if (al->vecIns_m_act != NULL) al->p_free(al->vecIns_m_act);
+                if (al->vecIns_m1_act != NULL) al->p_free(al->vecIns_m1_act);
+                if (al->I_ext_m_act != NULL) al->p_free(al->I_ext_m_act);
+                if (al->I_ext_m1_act != NULL) al->p_free(al->I_ext_m1_act);
+                al->vecPen_m_act = al->vecPen_m1_act = NULL;
+                al->vecIns_m_act = al->vecIns_m1_act = NULL;
+                al->I_ext_m_act = al->I_ext_m1_act = NULL;
+        }
+        al->layout = layout;
+
+        /* buffers only exist once a reference sequence has been assigned */
+        if (al->subdb_len > 0u)
+                return resize_rowstate(al, al->subdb_len);
+        return 0;
+}
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_prepare_query
@@ -613,34 +1064,7 @@ int asw_prepare_db(Alignment_ASW *al,
         if (tmp2 != NULL) al->matDel = tmp2; else goto error;
 #endif
         if (al->subdb_len != m_subdb_len) {
-                int *tmp;
-
-                tmp = (int*)al->p_realloc(al->vecPen_m1_act,
-                                    sizeof(int) * (m_subdb_len + 1u));
-                if (tmp != NULL) al->vecPen_m1_act = tmp; else goto error;
-
-                tmp = (int*)al->p_realloc(al->vecPen_m_act,
-                                    sizeof(int) * (m_subdb_len + 1u));
-                if (tmp != NULL) al->vecPen_m_act = tmp; else goto error;
-
-                tmp = (int*)al->p_realloc(al->vecIns_m1_act,
-                                    sizeof(int) * (m_subdb_len + 1u));
-                if (tmp != NULL) al->vecIns_m1_act = tmp; else goto error;
-
-                tmp = (int*)al->p_realloc(al->vecIns_m_act,
-                                    sizeof(int) * (m_subdb_len + 1u));
-                if (tmp != NULL) al->vecIns_m_act = tmp; else goto error;
-
-                uint32_t *utmp;
-
-                utmp = (uint32_t*)al->p_realloc(al->I_ext_m_act,
-                                          sizeof(uint32_t) * (m_subdb_len + 1u));
-                if (utmp != NULL) al->I_ext_m_act = utmp; else goto error;
-
-                utmp = (uint32_t*)al->p_realloc(al->I_ext_m1_act,
-                                          sizeof(uint32_t) * (m_subdb_len + 1u));
-                if (utmp != NULL) al->I_ext_m1_act = utmp; else goto error;
-
+                if (resize_rowstate(al, m_subdb_len) != 0) goto error;
                 al->subdb_len = m_subdb_len;
         }
         return 0;
@@ -704,43 +1128,83 @@ int asw_prepare(Alignment_ASW *al,
 #endif
         al->subquery_len = m_subquery_len;
         if (al->subdb_len != m_subdb_len) {
-                int *tmp;
+                if (resize_rowstate(al, m_subdb_len) != 0) goto error;
+                al->subdb_len = m_subdb_len;
+        }
+        return 0;
+error:
+        //asw_free(al);
+        return -1;
+}
 
-                tmp = (int*)al->p_realloc(al->vecPen_m1_act,
-                                    sizeof(int) * (m_subdb_len + 1u));
-                if (tmp != NULL) al->vecPen_m1_act = tmp; else goto error;
 
-                tmp = (int*)al->p_realloc(al->vecPen_m_act,
-                                    sizeof(int) * (m_subdb_len + 1u));
-                if (tmp != NULL) al->vecPen_m_act = tmp; else goto error;
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  align_init_packed
+ *  Description:  Fill out top row in the alignment matrix for ASW_LAYOUT_PACKED
+ *                (global or semiglobal)
+ * =====================================================================================
+ */
+void align_init_packed(Alignment_ASW *al, int semi)
+{
+        const uint8_t* m_subqual = al->subqual;
 
-                tmp = (int*)al->p_realloc(al->vecIns_m1_act,
-                                    sizeof(int) * (m_subdb_len + 1u));
-                if (tmp != NULL) al->vecIns_m1_act = tmp; else goto error;
+        size_t m_subdb_len = al->subdb_len;
 
-                tmp = (int*)al->p_realloc(al->vecIns_m_act,
-                                    sizeof(int) * (m_subdb_len + 1u));
-                if (tmp != NULL) al->vecIns_m_act = tmp; else goto error;
+        const int *gopen_penalty = al->gopen_penalty - al->phred_offset,
+            *gext_penalty = al->gext_penalty - al->phred_offset;
 
-                uint32_t *utmp;
+        int GAP_OPEN_EXTEND = al->GAP_OPEN_EXTEND,
+            GAP_EXTEND = al->GAP_EXTEND;
 
-                utmp = (uint32_t*)al->p_realloc(al->I_ext_m_act,
-                                          sizeof(uint32_t) * (m_subdb_len + 1u));
-                if (utmp != NULL) al->I_ext_m_act = utmp; else goto error;
+        ASW_Column *col = al->vecCol_act;
 
-                utmp = (uint32_t*)al->p_realloc(al->I_ext_m1_act,
-                                          sizeof(uint32_t) * (m_subdb_len + 1u));
-                if (utmp != NULL) al->I_ext_m1_act = utmp; else goto error;
+        cigar_t ** matTra = al->matTra;
+#ifdef DEBUG
+        int ** matPen = al->matPen;
+        int ** matIns = al->matIns;
+        int ** matDel = al->matDel;
+#endif
+        /* qq - quality in the query at position m */
+        unsigned int qq = (unsigned int)m_subqual[0];
+        int gopen_true_pen = gopen_penalty[qq] - gext_penalty[qq];
 
-                al->subdb_len = m_subdb_len;
+        /* Top-left cell: the top row always lives in the first half */
+        ASW_RowState *top = &col[0].half[0];
+        top->pen = 0;
+        top->ins = gopen_true_pen;
+        top->ins_ext = 0;
+        int storedDel_score = GAP_OPEN_EXTEND - GAP_EXTEND;
+
+#ifdef DEBUG
+        matPen[0][0] = top->pen;
+        matDel[0][0] = storedDel_score;
+        matIns[0][0] = top->ins;
+#endif
+        cigar_t *rowTra = matTra[0];
+        rowTra[0] = (0 << BAM_CIGAR_SHIFT) | BAM_CSEQ_MATCH;
+
+        size_t n, n1;
+        for (n = 0u, n1 = 1u; n < m_subdb_len; ++n, ++n1) {
+                top = &col[n1].half[0];
+                if (semi) {
+                        top->pen = 0;
+                } else {
+                        storedDel_score += GAP_EXTEND;
+                        top->pen = storedDel_score;
+                }
+                top->ins = top->pen + gopen_true_pen;
+                /* topmost row consists of only horizontal moves (deletions) */
+                rowTra[n1] = (n1 << BAM_CIGAR_SHIFT) | BAM_CDEL;
+                top->ins_ext = 0;
+#ifdef DEBUG
+                matPen[0][n1] = top->pen;
+                matDel[0][n1] = storedDel_score;
+                matIns[0][n1] = top->ins;
+#endif
         }
-        return 0;
-error:
-        //asw_free(al);
-        return -1;
 }
 
-
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_align_init_semi
@@ -749,11 +1213,15 @@ error:
  */
 void asw_align_init_semi(Alignment_ASW *al)
 {
+        if (al->layout == ASW_LAYOUT_PACKED) {
+                align_init_packed(al, 1);
+                return;
+        }
         const uint8_t* m_subqual = al->subqual;
 
         size_t m_subdb_len = al->subdb_len;
 
-        int *gopen_penalty = al->gopen_penalty - al->phred_offset,
+        const int *gopen_penalty = al->gopen_penalty - al->phred_offset,
             *gext_penalty = al->gext_penalty - al->phred_offset;
 
         int *vecPen_m = al->vecPen_m_act,
@@ -810,11 +1278,15 @@ void asw_align_init_semi(Alignment_ASW *al)
  */
 void asw_align_init(Alignment_ASW *al)
 {
+        if (al->layout == ASW_LAYOUT_PACKED) {
+                align_init_packed(al, 0);
+                return;
+        }
         const uint8_t* m_subqual = al->subqual;
 
         size_t m_subdb_len = al->subdb_len;
 
-        int *gopen_penalty = al->gopen_penalty - al->phred_offset,
+        const int *gopen_penalty = al->gopen_penalty - al->phred_offset,
             *gext_penalty = al->gext_penalty - al->phred_offset;
 
         int GAP_OPEN_EXTEND = al->GAP_OPEN_EXTEND,
@@ -866,12 +1338,13 @@ void asw_align_init(Alignment_ASW *al)
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  asw_align
- *  Description:  Performs global affine-gap alignment according to Gotoh algorithm
- *                using asymmetric quality-weighted scoring
+ *         Name:  align_packed
+ *  Description:  Same as asw_align but operating on the interleaved row state of
+ *                ASW_LAYOUT_PACKED. All reads and writes of row state in the inner
+ *                loop go to a single stream instead of six.
  * =====================================================================================
  */
-void asw_align(Alignment_ASW *al)
+void align_packed(Alignment_ASW *al)
 {
         const char *m_subdb = al->subdb,
                    *m_subquery = al->subquery;
@@ -882,10 +1355,10 @@ void asw_align(Alignment_ASW *al)
         int GAP_OPEN_EXTEND = al->GAP_OPEN_EXTEND,
             GAP_EXTEND = al->GAP_EXTEND;
 
-        int *match_penalty = al->match_penalty - al->phred_offset,
+        const int *match_penalty = al->match_penalty - al->phred_offset,
             *mismatch_penalty = al->mismatch_penalty - al->phred_offset;
 
-        int *gopen_penalty = al->gopen_penalty - al->phred_offset,
+        const int *gopen_penalty = al->gopen_penalty - al->phred_offset,
             *gext_penalty = al->gext_penalty - al->phred_offset;
 
         cigar_t ** matTra = al->matTra;
@@ -894,12 +1367,168 @@ void asw_align(Alignment_ASW *al)
         int ** matIns = al->matIns;
         int ** matDel = al->matDel;
 #endif
+        ASW_Column *col = al->vecCol_act;
 
-        int *vecPen_m = al->vecPen_m_act,
-            *vecIns_m = al->vecIns_m_act;
-        uint32_t *I_ext_m = al->I_ext_m_act;
-
-        int *vecIns_m1 = al->vecIns_m1_act,
+        size_t m, m1;
+        for (m = 0u, m1 = 1u; m < m_subquery_len; ++m, ++m1) {
+                /* p - half holding the previous row, c - half receiving the current */
+                const unsigned int p = (unsigned int)(m & 1u),
+                                   c = p ^ 1u;
+                /* cq - character in the query at position m */
+                char cq = m_subquery[m];
+                /* qq - quality in the query at position m */
+                unsigned int qq = (unsigned int)m_subqual[m];
+                int match_pen = match_penalty[qq],
+                    mismatch_pen = mismatch_penalty[qq],
+                    gopen_pen = gopen_penalty[qq],
+                    gext_pen = gext_penalty[qq];
+                cigar_t *rowTra = matTra[m1];
+                uint32_t cD = 0u;
+
+                /* leftmost column consists of only vertical moves (insertions) */
+                const ASW_RowState *prev = &col[0].half[p];
+                ASW_RowState *cur = &col[0].half[c];
+                uint32_t cI;
+                int wI_extend = prev->ins + gext_pen;
+                cur->ins = wI_extend;
+                cur->ins_ext = cI = prev->ins_ext + 1u;
+                rowTra[0] = (cI << BAM_CIGAR_SHIFT) | BAM_CINS;
+
+                cur->pen = wI_extend;
+                int storedDel_score = wI_extend + (GAP_OPEN_EXTEND - GAP_EXTEND);
+
+#ifdef DEBUG
+                int * rowPen = matPen[m1];
+                int * rowDel = matDel[m1];
+                int * rowIns = matIns[m1];
+                rowPen[0] = cur->pen;
+                rowDel[0] = storedDel_score;
+                rowIns[0] = wI_extend;
+#endif
+                /* the left and the diagonal neighbours are carried in registers */
+                int pen_left = cur->pen,
+                    pen_diag = prev->pen;
+
+                size_t n, n1;
+
+                for (n = 0u, n1 = 1u; n < m_subdb_len; ++n, ++n1) {
+                        int wD, wI, wM;
+                        uint32_t cI;
+                        int is_seq_match = IS_MATCH(m_subdb[n], cq);
+
+                        prev = &col[n1].half[p];
+                        cur = &col[n1].half[c];
+
+                        /* deletion: horizontal move */
+                        int wD_open = pen_left + GAP_OPEN_EXTEND;
+                        int wD_extend = storedDel_score + GAP_EXTEND;
+
+                        /* insertion: vertical move */
+                        int pen_up = prev->pen;
+                        int wI_open = pen_up + gopen_pen;
+                        int wI_extend = prev->ins + gext_pen;
+
+                        /* given equal scores, prefer extending
+                         * existing gaps to opening new ones */
+                        if (wD_open < wD_extend) {
+                                storedDel_score = wD = wD_open;
+                                cD = 1u;
+                        } else {
+                                storedDel_score = wD = wD_extend;
+                                ++cD;
+                        }
+                        if (wI_open < wI_extend) {
+                                cur->ins = wI = wI_open;
+                                cur->ins_ext = cI = 1u;
+                        } else {
+                                cur->ins = wI = wI_extend;
+                                cur->ins_ext = cI = prev->ins_ext + 1u;
+                        }
+
+                        int mstate;
+                        if (is_seq_match) {
+                                wM = pen_diag + match_pen;
+                                mstate = BAM_CSEQ_MATCH;
+                        } else {
+                                wM = pen_diag + mismatch_pen;
+                                mstate = BAM_CSEQ_MISMATCH;
+                        }
+
+                        /* Order of preference: M, I, D */
+                        if (wI < wM) {
+                                /* either insertion or deletion */
+                                if (wD < wI) {
+                                        /* deletion */
+                                        rowTra[n1] = (cD << BAM_CIGAR_SHIFT) | BAM_CDEL;
+                                        pen_left = wD;
+                                } else {
+                                        /* insertion */
+                                        rowTra[n1] = (cI << BAM_CIGAR_SHIFT) | BAM_CINS;
+                                        pen_left = wI;
+                                }
+                        } else if (wD < wM) {
+                                /* deletion */
+                                rowTra[n1] = (cD << BAM_CIGAR_SHIFT) | BAM_CDEL;
+                                pen_left = wD;
+                        } else {
+                                /* either match or mismatch */
+                                rowTra[n1] = (1u << BAM_CIGAR_SHIFT) | mstate;
+                                pen_left = wM;
+                        }
+                        cur->pen = pen_left;
+                        pen_diag = pen_up;
+#ifdef DEBUG
+                        rowDel[n1] = wD;
+                        rowIns[n1] = wI;
+                        rowPen[n1] = pen_left;
+#endif
+                }
+        }
+        /* the last row was written to the half that follows the penultimate one */
+        al->lastRow_half = (unsigned int)(m_subquery_len & 1u);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_align
+ *  Description:  Performs global affine-gap alignment according to Gotoh algorithm
+ *                using asymmetric quality-weighted scoring
+ * =====================================================================================
+ */
+void asw_align(Alignment_ASW *al)
+{
+        if (al->layout == ASW_LAYOUT_PACKED) {
+                align_packed(al);
+                return;
+        }
+
+        const char *m_subdb = al->subdb,
+                   *m_subquery = al->subquery;
+        const uint8_t* m_subqual = al->subqual;
+        size_t m_subdb_len = al->subdb_len,
+               m_subquery_len = al->subquery_len;
+
+        int GAP_OPEN_EXTEND = al->GAP_OPEN_EXTEND,
+            GAP_EXTEND = al->GAP_EXTEND;
+
+        const int *match_penalty = al->match_penalty - al->phred_offset,
+            *mismatch_penalty = al->mismatch_penalty - al->phred_offset;
+
+        const int *gopen_penalty = al->gopen_penalty - al->phred_offset,
+            *gext_penalty = al->gext_penalty - al->phred_offset;
+
+        cigar_t ** matTra = al->matTra;
+#ifdef DEBUG
+        int ** matPen = al->matPen;
+        int ** matIns = al->matIns;
+        int ** matDel = al->matDel;
+#endif
+
+        int *vecPen_m = al->vecPen_m_act,
+            *vecIns_m = al->vecIns_m_act;
+        uint32_t *I_ext_m = al->I_ext_m_act;
+
+        int *vecIns_m1 = al->vecIns_m1_act,
             *vecPen_m1 = al->vecPen_m1_act;
         uint32_t *I_ext_m1 = al->I_ext_m1_act;
 
@@ -1032,16 +1661,29 @@ void asw_align(Alignment_ASW *al)
 
 int asw_locate_minscore(Alignment_ASW* al)
 {
-        int * vecPen_m = al->vecPen_lastRow;
-        int opt_score = vecPen_m[0];
+        int opt_score;
         size_t opt_score_col = 0u;
 
         size_t n1;
         size_t m_subdb_len = al->subdb_len;
-        for (n1 = 1u; n1 <= m_subdb_len; ++n1) {
-                if (vecPen_m[n1] < opt_score) {
-                        opt_score = vecPen_m[n1];
-                        opt_score_col = n1;
+        if (al->layout == ASW_LAYOUT_PACKED) {
+                const ASW_Column *col = al->vecCol_act;
+                unsigned int h = al->lastRow_half;
+                opt_score = col[0].half[h].pen;
+                for (n1 = 1u; n1 <= m_subdb_len; ++n1) {
+                        if (col[n1].half[h].pen < opt_score) {
+                                opt_score = col[n1].half[h].pen;
+                                opt_score_col = n1;
+                        }
+                }
+        } else {
+                int * vecPen_m = al->vecPen_lastRow;
+                opt_score = vecPen_m[0];
+                for (n1 = 1u; n1 <= m_subdb_len; ++n1) {
+                        if (vecPen_m[n1] < opt_score) {
+                                opt_score = vecPen_m[n1];
+                                opt_score_col = n1;
+                        }
                 }
         }
         al->opt_score = opt_score;
@@ -1065,7 +1707,8 @@ int asw_trace(Alignment_ASW* al)
         assert(al->query_len >= al->subquery_len);
 
         /* resize cigar string to query length */
-        cigar_t *rcigar = (cigar_t*)al->p_realloc(al->rcigar, sizeof(cigar_t) * (al->subquery_len + 4u));
+        cigar_t *rcigar = (cigar_t*)al->p_realloc(al->rcigar,
+                                                  sizeof(cigar_t) * CIGAR_LEN(al->subquery_len));
         if (rcigar != NULL) al->rcigar = rcigar; else goto error;
 
         /* fill out cigar string */
@@ -1144,115 +1787,530 @@ error:
         return -1;
 }
 
+/* Traceback state of one alignment in asw_trace_many */
+typedef struct {
+        Alignment_ASW *al;
+        size_t index;           /* position in the caller's array */
+        int m1, n1;             /* current cell */
+        const cigar_t *cell;    /* its address, prefetched a round ago */
+        uint32_t run_state,     /* match or mismatch run being accumulated, if */
+                 run_len;       /* run_len > 0 */
+        cigar_t *rc;            /* as in asw_trace */
+} TraceLane;
+
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  asw_append_softclip
- *  Description:  extend CIGAR trace outer boundaries to previous clipping
- *
- *     Modifies:  al->rcigar
- *                al->cigar_begin
- *                al->cigar_end
- *                al->offset
+ *         Name:  trace_lane_start
+ *  Description:  Set up the traceback of an aligned workspace; returns -1 if the
+ *                CIGAR buffer cannot be grown
  * =====================================================================================
  */
-void asw_append_softclip(Alignment_ASW* al)
+static int trace_lane_start(TraceLane *lane, Alignment_ASW *al, size_t index)
 {
-        assert(al->subquery >= al->query);
-        assert(al->subdb >= al->db);
-        uint32_t clip_head = al->subquery - al->query;
-        if (clip_head > 0u) {
-                /* clipped beginnning */
-                cigar_t cigar = *al->cigar_begin;
-                uint32_t state = cigar & BAM_CIGAR_MASK,
-                         z = cigar >> BAM_CIGAR_SHIFT;
-                if (state == BAM_CSOFT_CLIP) {
-                        /* extend clipping */
-                        *al->cigar_begin = ((clip_head + z) << BAM_CIGAR_SHIFT)
-                                       | BAM_CSOFT_CLIP;
-                } else if (state == BAM_CSEQ_MATCH || state == BAM_CMATCH) {
-                        /* try to contract clipping */
-                        uint32_t match_add = 0u;
-                        const char *subquery = al->subquery,
-                                   *subdb = al->subdb + al->offset;
-                        while (clip_head > 0u && *--subquery == *--subdb) {
-                                ++match_add;
-                                --clip_head;
-                        }
-                        if (match_add > 0u) {
-                                *al->cigar_begin = ((z + match_add) << BAM_CIGAR_SHIFT)
-                                               | state;
-                                al->offset -= match_add;
-                        }
-                        if (clip_head > 0u) {
-                                *(--al->cigar_begin) = (clip_head << BAM_CIGAR_SHIFT)
-                                                   | BAM_CSOFT_CLIP;
-                        }
-                } else {
-                        /* add clipping */
-                        *(--al->cigar_begin) = (clip_head << BAM_CIGAR_SHIFT)
-                                               | BAM_CSOFT_CLIP;
-                }
-        }
-        uint32_t clip_tail = (al->query + al->query_len) - (al->subquery + al->subquery_len);
+        cigar_t *rcigar = (cigar_t*)al->p_realloc(al->rcigar,
+                                                  sizeof(cigar_t) * CIGAR_LEN(al->subquery_len));
+        if (rcigar == NULL) return -1;
+        al->rcigar = rcigar;
+        lane->al = al;
+        lane->index = index;
+        lane->m1 = (int)al->subquery_len;
+        lane->n1 = (int)al->opt_score_col;
+        lane->cell = &al->matTra[lane->m1][lane->n1];
+        ASW_PREFETCH(lane->cell);
+        lane->run_state = 0u;
+        lane->run_len = 0u;
+        lane->rc = rcigar + al->subquery_len + 1u;
+        return 0;
+}
 
-        if (clip_tail > 0u) {
-                /* clipped end */
-                cigar_t cigar = *(al->cigar_end - 1u);
-                uint32_t state = cigar & BAM_CIGAR_MASK,
-                         z = cigar >> BAM_CIGAR_SHIFT;
-                if (state == BAM_CSOFT_CLIP) {
-                        /* extend clipping */
-                        *(al->cigar_end - 1u) = ((clip_tail + z) << BAM_CIGAR_SHIFT)
-                                    | BAM_CSOFT_CLIP;
-                } else if (state == BAM_CSEQ_MATCH || state == BAM_CMATCH) {
-                        /* try to contract clipping */
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  trace_lane_finish
+ *  Description:  Store the outcome of a completed traceback in its workspace
+ * =====================================================================================
+ */
+static void trace_lane_finish(TraceLane *lane)
+{
+        Alignment_ASW *al = lane->al;
+        if (lane->run_len > 0u) {
+                *lane->rc-- = (lane->run_len << BAM_CIGAR_SHIFT) | lane->run_state;
+        }
+        al->offset = lane->n1;
+        al->cigar_begin = lane->rc + 1u;
+        al->cigar_end = al->rcigar + al->subquery_len + 2u;
+}
 
-                        uint32_t match_add = 0u;
-                        const char *subquery = al->subquery + al->subquery_len - 1u,
-                                   *subdb = al->subdb + al->offset + al->subdb_len - 1u;
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  trace_lane_step
+ *  Description:  Follow one cell of a traceback and prefetch the next one. Returns
+ *                1 while the traceback goes on, 0 once it is complete and -1 on an
+ *                invalid trace matrix.
+ * =====================================================================================
+ */
+static int trace_lane_step(TraceLane *lane)
+{
+        if (lane->m1 <= 0) return 0;
+        cigar_t cigar = *lane->cell;
+        uint32_t z = cigar >> BAM_CIGAR_SHIFT,
+                 state = cigar & BAM_CIGAR_MASK;
+        switch (state) {
+        case BAM_CSEQ_MATCH:
+        case BAM_CSEQ_MISMATCH:
+                /* consecutive cells of the same kind make one operation */
+                if (lane->run_len > 0u && lane->run_state != state) {
+                        *lane->rc-- = (lane->run_len << BAM_CIGAR_SHIFT) | lane->run_state;
+                        lane->run_len = 0u;
+                }
+                lane->run_state = state;
+                lane->run_len += z;
+                lane->m1 -= z, lane->n1 -= z;
+                break;
+        case BAM_CDEL:
+        case BAM_CINS:
+                if (lane->run_len > 0u) {
+                        *lane->rc-- = (lane->run_len << BAM_CIGAR_SHIFT) | lane->run_state;
+                        lane->run_len = 0u;
+                }
+                *lane->rc-- = cigar;
+                if (state == BAM_CDEL) lane->n1 -= z; else lane->m1 -= z;
+                break;
+        default:
+                fprintf(stderr, "ERROR: unknown CIGAR operation %u\n", state);
+                return -1;
+        }
+        if (lane->m1 <= 0) return 0;
+        lane->cell = &lane->al->matTra[lane->m1][lane->n1];
+        ASW_PREFETCH(lane->cell);
+        return 1;
+}
 
-                        while (clip_tail > 0u && *++subquery == *++subdb) {
-                                ++match_add;
-                                --clip_tail;
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_trace_many
+ *  Description:  asw_trace on n aligned workspaces, stepping up to
+ *                ASW_TRACE_MANY_LANES tracebacks in turn so that their cache misses
+ *                overlap
+ * =====================================================================================
+ */
+int asw_trace_many(Alignment_ASW **als, size_t n, int *status)
+{
+        TraceLane lanes[ASW_TRACE_MANY_LANES];
+        size_t next = 0u, n_lanes = 0u;
+        int failed = 0;
+
+        for (;;) {
+                /* fill free lanes with the next workspaces */
+                while (n_lanes < ASW_TRACE_MANY_LANES && next < n) {
+                        if (trace_lane_start(&lanes[n_lanes], als[next], next) == 0) {
+                                ++n_lanes;
+                        } else {
+                                if (status != NULL) status[next] = -1;
+                                failed = 1;
                         }
-                        if (match_add > 0u) {
-                                *(al->cigar_end - 1u)
-                                        = ((z + match_add) << BAM_CIGAR_SHIFT) | state;
+                        ++next;
+                }
+                if (n_lanes == 0u) break;
+
+                /* one step of every lane; retire finished ones by moving the last
+                 * lane into their place */
+                size_t k = 0u;
+                while (k < n_lanes) {
+                        int r = trace_lane_step(&lanes[k]);
+                        if (r > 0) {
+                                ++k;
+                                continue;
                         }
-                        if (clip_tail > 0u) {
-                                *al->cigar_end = (clip_tail << BAM_CIGAR_SHIFT)
-                                                   | BAM_CSOFT_CLIP;
-                                ++al->cigar_end;
+                        if (r == 0) {
+                                trace_lane_finish(&lanes[k]);
+                        } else {
+                                failed = 1;
                         }
-                } else {
-                        /* add clipping */
-                        *al->cigar_end = (clip_tail << BAM_CIGAR_SHIFT)
-                                               | BAM_CSOFT_CLIP;
-                        ++al->cigar_end;
+                        if (status != NULL) status[lanes[k].index] = r;
+                        lanes[k] = lanes[--n_lanes];
                 }
         }
+        return failed ? -1 : 0;
 }
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  asw_append_hardclip
- *  Description:  extend CIGAR trace outer boundaries to previous clipping
+ *         Name:  md_put_number
+ *  Description:  Write decimal number to a buffer filled from right to left, ending
+ *                at p; return pointer to the next free position
+ * =====================================================================================
+ */
+static char* md_put_number(char *p, uint32_t n)
+{
+        do {
+                *p-- = '0' + (char)(n % 10u);
+                n /= 10u;
+        } while (n > 0u);
+        return p;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_trace_ex
+ *  Description:  Produce a traceback post-processed according to ASW_TRACE_* flags
+ *                in a single pass over the trace matrix
  *
- *     Modifies:  al->rcigar
+ *     Modifies:  al->offset
+ *                al->rcigar
  *                al->cigar_begin
  *                al->cigar_end
+ *                al->n_match, al->n_mismatch, al->n_ins, al->n_del, al->nm
+ *                al->md
+ *                al->md_begin
  * =====================================================================================
  */
-void asw_append_hardclip(Alignment_ASW* al, uint32_t clip_head, uint32_t clip_tail)
+int asw_trace_ex(Alignment_ASW* al,
+                 unsigned int flags,
+                 uint32_t clip_head,
+                 uint32_t clip_tail)
 {
-        if (clip_head > 0u) {
-                /* clipped beginnning */
-                cigar_t cigar = *al->cigar_begin;
-                uint32_t state = cigar & BAM_CIGAR_MASK,
-                         z = cigar >> BAM_CIGAR_SHIFT;
-                if (state == BAM_CHARD_CLIP) {
-                        /* extend clipping */
-                        *al->cigar_begin = ((clip_head + z) << BAM_CIGAR_SHIFT)
+        assert(al->query_len >= al->subquery_len);
+
+        /* resize cigar string to query length */
+        cigar_t *rcigar = (cigar_t*)al->p_realloc(al->rcigar,
+                                                  sizeof(cigar_t) * CIGAR_LEN(al->subquery_len));
+        if (rcigar != NULL) al->rcigar = rcigar; else goto error;
+
+        const int softclip = (flags & ASW_TRACE_SOFTCLIP) != 0u,
+                  compact = (flags & ASW_TRACE_COMPACT) != 0u,
+                  md = (flags & ASW_TRACE_MD) != 0u;
+
+        /* The MD tag is written from right to left like the CIGAR, except for
+         * the number at the 3' end (md_tail), which is only known once
+         * asw_append_softclip has run and goes to the right of md_mid */
+        char *md_p = NULL, *md_mid = NULL;
+        uint32_t md_run = 0u, md_tail = 0u;
+        int md_tail_set = 0;
+        if (md) {
+                size_t md_len = ASW_MD_LEN(al->subdb_len, al->subquery_len);
+                if (al->md_len < md_len) {
+                        char *tmp = (char*)al->p_realloc(al->md, md_len);
+                        if (tmp != NULL) al->md = tmp; else goto error;
+                        al->md_len = md_len;
+                }
+                md_mid = al->md + al->md_len - 12u;
+                md_p = md_mid - 1u;
+        }
+        const char *subdb = al->subdb;
+
+        int m1 = (int)al->subquery_len,
+            n1 = (int)al->opt_score_col;
+
+        cigar_t ** matTra = al->matTra;
+
+        /* Operations are emitted from the 3' end backwards as in asw_trace. With
+         * compact, runs of BAM_CSEQ_MATCH and BAM_CSEQ_MISMATCH accumulate in
+         * num_mm until another operation is emitted. With softclip, operations
+         * preceding the first exact match at the 3' end are only counted, and
+         * the state after each exact match is remembered so that operations
+         * following the last one can be rolled back and clipped at the 5' end. */
+        cigar_t * rc = rcigar + al->subquery_len + 1u;
+        uint32_t num_mm = 0u;
+        uint32_t soft_clip = 0u;        /* X and I lengths since last exact match */
+        int seen_match = 0;
+        uint32_t n_match = 0u, n_mismatch = 0u, n_ins = 0u, n_del = 0u;
+
+        cigar_t * rc_match = rc;
+        uint32_t num_mm_match = 0u;
+        int n1_match = n1;
+        uint32_t n_mismatch_match = 0u, n_ins_match = 0u, n_del_match = 0u;
+        char *md_p_match = md_p;
+        uint32_t md_run_match = 0u;
+        int md_tail_set_match = 0;
+
+        while (m1 > 0) {
+                cigar_t cigar = matTra[m1][n1];
+                uint32_t z = cigar >> BAM_CIGAR_SHIFT;
+                uint32_t state = cigar & BAM_CIGAR_MASK;
+                uint32_t op_len = 0u;
+                int n1_op = n1;         /* last reference column of the operation */
+                switch (state) {
+                case BAM_CSEQ_MATCH:
+                case BAM_CSEQ_MISMATCH:
+                        /* accumulate consecutive cells of the same kind */
+                        do {
+                                op_len += z;
+                                m1 -= z, n1 -= z;
+                                cigar = matTra[m1][n1];
+                                z = cigar >> BAM_CIGAR_SHIFT;
+                        } while ((cigar & BAM_CIGAR_MASK) == state && m1 > 0);
+                        break;
+                case BAM_CDEL:
+                        op_len = z;
+                        n1 -= z;
+                        break;
+                case BAM_CINS:
+                        op_len = z;
+                        m1 -= z;
+                        break;
+                default:
+                        fprintf(stderr, "ERROR: unknown CIGAR operation %u\n", state);
+                        goto error;
+                }
+                if (softclip) {
+                        if (state == BAM_CSEQ_MATCH) {
+                                if (!seen_match) {
+                                        seen_match = 1;
+                                        if (soft_clip > 0u) {
+                                                *rc-- = (soft_clip << BAM_CIGAR_SHIFT)
+                                                        | BAM_CSOFT_CLIP;
+                                        }
+                                }
+                                soft_clip = 0u;
+                        } else {
+                                if (state != BAM_CDEL) {
+                                        soft_clip += op_len;
+                                }
+                                if (!seen_match) {
+                                        /* 3' end: nothing to emit yet */
+                                        continue;
+                                }
+                        }
+                }
+                switch (state) {
+                case BAM_CSEQ_MATCH:
+                        n_match += op_len;
+                        md_run += op_len;
+                        break;
+                case BAM_CSEQ_MISMATCH:
+                case BAM_CDEL:
+                        if (state == BAM_CSEQ_MISMATCH) n_mismatch += op_len;
+                        else n_del += op_len;
+                        if (md) {
+                                /* X: one number per base; D: number, bases, '^' */
+                                const char *ref = subdb + n1_op - 1, *ref_end = ref - op_len;
+                                for (; ref != ref_end; --ref) {
+                                        if (state == BAM_CSEQ_MISMATCH || ref == subdb + n1_op - 1) {
+                                                if (md_tail_set) {
+                                                        md_p = md_put_number(md_p, md_run);
+                                                } else {
+                                                        md_tail = md_run;
+                                                        md_tail_set = 1;
+                                                }
+                                                md_run = 0u;
+                                        }
+                                        *md_p-- = *ref;
+                                }
+                                if (state == BAM_CDEL) *md_p-- = '^';
+                        }
+                        break;
+                case BAM_CINS:
+                        n_ins += op_len;
+                        break;
+                }
+                if (compact && (state == BAM_CSEQ_MATCH || state == BAM_CSEQ_MISMATCH)) {
+                        num_mm += op_len;
+                } else {
+                        if (num_mm > 0u) {
+                                *rc-- = (num_mm << BAM_CIGAR_SHIFT) | BAM_CMATCH;
+                                num_mm = 0u;
+                        }
+                        *rc-- = (op_len << BAM_CIGAR_SHIFT) | state;
+                }
+                if (state == BAM_CSEQ_MATCH) {
+                        rc_match = rc;
+                        num_mm_match = num_mm;
+                        n1_match = n1;
+                        n_mismatch_match = n_mismatch;
+                        n_ins_match = n_ins;
+                        n_del_match = n_del;
+                        md_p_match = md_p;
+                        md_run_match = md_run;
+                        md_tail_set_match = md_tail_set;
+                }
+        }
+        if (softclip) {
+                if (!seen_match) {
+                        /* without any exact match asw_softclip_trace does not clip
+                         * symmetrically; reproduce its result by chaining. All
+                         * bases end up soft-clipped. */
+                        if (asw_trace(al) != 0) goto error;
+                        asw_softclip_trace(al);
+                        if (compact) asw_compact_trace(al);
+                        if (md) md_p = md_mid - 1u;
+                        md_run = 0u;
+                        md_tail_set = 0;
+                        goto append;
+                }
+                /* roll back to the last exact match at the 5' end (n_match does
+                 * not change after it) */
+                rc = rc_match;
+                num_mm = num_mm_match;
+                n1 = n1_match;
+                n_mismatch = n_mismatch_match;
+                n_ins = n_ins_match;
+                n_del = n_del_match;
+                md_p = md_p_match;
+                md_run = md_run_match;
+                md_tail_set = md_tail_set_match;
+        }
+        if (num_mm > 0u) {
+                *rc-- = (num_mm << BAM_CIGAR_SHIFT) | BAM_CMATCH;
+        }
+        if (softclip && soft_clip > 0u) {
+                *rc-- = (soft_clip << BAM_CIGAR_SHIFT) | BAM_CSOFT_CLIP;
+        }
+
+        al->offset = n1;
+        al->cigar_begin = rc + 1u;
+        al->cigar_end = rcigar + al->subquery_len + 2u;
+append:
+        if (flags & ASW_TRACE_APPEND_SOFTCLIP) {
+                /* matches added at either end extend the first or last operation */
+                cigar_t *first = al->cigar_begin, *last = al->cigar_end - 1u;
+                uint32_t last_len = *last >> BAM_CIGAR_SHIFT;
+                size_t offset = al->offset;
+                asw_append_softclip(al);
+                uint32_t head_add = (uint32_t)(offset - al->offset), tail_add = 0u;
+                uint32_t state = *last & BAM_CIGAR_MASK;
+                if (state == BAM_CSEQ_MATCH || state == BAM_CMATCH) {
+                        tail_add = (*last >> BAM_CIGAR_SHIFT) - last_len;
+                        if (first == last) tail_add -= head_add;
+                }
+                n_match += head_add + tail_add;
+                md_run += head_add;
+                if (md_tail_set) md_tail += tail_add; else md_run += tail_add;
+        }
+        if (flags & ASW_TRACE_APPEND_HARDCLIP) {
+                asw_append_hardclip(al, clip_head, clip_tail);
+        }
+        if (softclip && !seen_match) {
+                n_match = n_mismatch = n_ins = n_del = 0u;
+        }
+        al->n_match = n_match;
+        al->n_mismatch = n_mismatch;
+        al->n_ins = n_ins;
+        al->n_del = n_del;
+        al->nm = n_mismatch + n_ins + n_del;
+        if (md) {
+                /* leading number, then trailing number to the right of md_mid */
+                al->md_begin = md_put_number(md_p, md_run) + 1u;
+                char *tail_end = md_mid;
+                if (md_tail_set) {
+                        tail_end += ndigits((int)md_tail);
+                        md_put_number(tail_end - 1u, md_tail);
+                }
+                *tail_end = '\0';
+        }
+        return 0;
+error:
+        return -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_append_softclip
+ *  Description:  extend CIGAR trace outer boundaries to previous clipping
+ *
+ *     Modifies:  al->rcigar
+ *                al->cigar_begin
+ *                al->cigar_end
+ *                al->offset
+ * =====================================================================================
+ */
+void asw_append_softclip(Alignment_ASW* al)
+{
+        assert(al->subquery >= al->query);
+        assert(al->subdb >= al->db);
+        uint32_t clip_head = al->subquery - al->query;
+        if (clip_head > 0u) {
+                /* clipped beginnning */
+                cigar_t cigar = *al->cigar_begin;
+                uint32_t state = cigar & BAM_CIGAR_MASK,
+                         z = cigar >> BAM_CIGAR_SHIFT;
+                if (state == BAM_CSOFT_CLIP) {
+                        /* extend clipping */
+                        *al->cigar_begin = ((clip_head + z) << BAM_CIGAR_SHIFT)
+                                       | BAM_CSOFT_CLIP;
+                } else if (state == BAM_CSEQ_MATCH || state == BAM_CMATCH) {
+                        /* try to contract clipping */
+                        uint32_t match_add = 0u;
+                        const char *subquery = al->subquery,
+                                   *subdb = al->subdb + al->offset;
+                        while (clip_head > 0u && *--subquery == *--subdb) {
+                                ++match_add;
+                                --clip_head;
+                        }
+                        if (match_add > 0u) {
+                                *al->cigar_begin = ((z + match_add) << BAM_CIGAR_SHIFT)
+                                               | state;
+                                al->offset -= match_add;
+                        }
+                        if (clip_head > 0u) {
+                                *(--al->cigar_begin) = (clip_head << BAM_CIGAR_SHIFT)
+                                                   | BAM_CSOFT_CLIP;
+                        }
+                } else {
+                        /* add clipping */
+                        *(--al->cigar_begin) = (clip_head << BAM_CIGAR_SHIFT)
+                                               | BAM_CSOFT_CLIP;
+                }
+        }
+        uint32_t clip_tail = (al->query + al->query_len) - (al->subquery + al->subquery_len);
+
+        if (clip_tail > 0u) {
+                /* clipped end */
+                cigar_t cigar = *(al->cigar_end - 1u);
+                uint32_t state = cigar & BAM_CIGAR_MASK,
+                         z = cigar >> BAM_CIGAR_SHIFT;
+                if (state == BAM_CSOFT_CLIP) {
+                        /* extend clipping */
+                        *(al->cigar_end - 1u) = ((clip_tail + z) << BAM_CIGAR_SHIFT)
+                                    | BAM_CSOFT_CLIP;
+                } else if (state == BAM_CSEQ_MATCH || state == BAM_CMATCH) {
+                        /* try to contract clipping */
+
+                        uint32_t match_add = 0u;
+                        const char *subquery = al->subquery + al->subquery_len - 1u,
+                                   *subdb = al->subdb + al->opt_score_col - 1u;
+
+                        while (clip_tail > 0u && *++subquery == *++subdb) {
+                                ++match_add;
+                                --clip_tail;
+                        }
+                        if (match_add > 0u) {
+                                *(al->cigar_end - 1u)
+                                        = ((z + match_add) << BAM_CIGAR_SHIFT) | state;
+                        }
+                        if (clip_tail > 0u) {
+                                *al->cigar_end = (clip_tail << BAM_CIGAR_SHIFT)
+                                                   | BAM_CSOFT_CLIP;
+                                ++al->cigar_end;
+                        }
+                } else {
+                        /* add clipping */
+                        *al->cigar_end = (clip_tail << BAM_CIGAR_SHIFT)
+                                               | BAM_CSOFT_CLIP;
+                        ++al->cigar_end;
+                }
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_append_hardclip
+ *  Description:  extend CIGAR trace outer boundaries to previous clipping
+ *
+ *     Modifies:  al->rcigar
+ *                al->cigar_begin
+ *                al->cigar_end
+ * =====================================================================================
+ */
+void asw_append_hardclip(Alignment_ASW* al, uint32_t clip_head, uint32_t clip_tail)
+{
+        if (clip_head > 0u) {
+                /* clipped beginnning */
+                cigar_t cigar = *al->cigar_begin;
+                uint32_t state = cigar & BAM_CIGAR_MASK,
+                         z = cigar >> BAM_CIGAR_SHIFT;
+                if (state == BAM_CHARD_CLIP) {
+                        /* extend clipping */
+                        *al->cigar_begin = ((clip_head + z) << BAM_CIGAR_SHIFT)
                                        | BAM_CHARD_CLIP;
                 } else {
                         /* add clipping */
@@ -1415,86 +2473,158 @@ int32_t asw_getAlignmentStart(const Alignment_ASW* al, int alstart) {
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  asw_getBasicAlignPair
- *  Description:  Allocates and initializes a BASICALIGNPAIR struct for use in
- *                composition alignment from Alignment_ASW struct
+ *         Name:  asw_cigar_ref_len
+ *  Description:  Number of reference bases covered by CIGAR operations in
+ *                [cigar_begin, cigar_end)
  * =====================================================================================
  */
-BASICALIGNPAIR* asw_getBasicAlignPair(const Alignment_ASW* al) {
+size_t asw_cigar_ref_len(const cigar_t* cigar_begin, const cigar_t* cigar_end)
+{
+        size_t len = 0u;
+        for (; cigar_begin < cigar_end; ++cigar_begin) {
+                uint32_t op = *cigar_begin & BAM_CIGAR_MASK;
+                if (op == BAM_CMATCH || op == BAM_CDEL || op == BAM_CREF_SKIP ||
+                    op == BAM_CSEQ_MATCH || op == BAM_CSEQ_MISMATCH)
+                {
+                        len += *cigar_begin >> BAM_CIGAR_SHIFT;
+                }
+        }
+        return len;
+}
 
-        /* In BASICALIGNPAIR, the length of the alignment is the total number of
-         * traversal instructions in traceback */
-        size_t len;
-        cigar_t *cigar_p = al->cigar_begin;
-        cigar_t *cigar_end = al->cigar_end;
-        for (len = 0u; cigar_p < cigar_end; ++cigar_p) {
-                len += (*cigar_p >> BAM_CIGAR_SHIFT);
-        }
-        char * seq1 = (char*)al->p_malloc(len + 1u);
-        char * seq2 = (char*)al->p_malloc(len + 1u);
-        char * seq1_p = seq1;
-        char * seq2_p = seq2;
-        const char * seq1source_p = al->subdb + al->offset;
-        const char * seq2source_p = al->subquery;
-        for (cigar_p = al->cigar_begin; cigar_p < cigar_end; ++cigar_p) {
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_render_pair_range
+ *  Description:  Write the gapped reference and query rows of the alignment given
+ *                by CIGAR operations in [cigar_begin, cigar_end) to two caller
+ *                buffers of cap bytes each. ref points to the reference base
+ *                aligned by the first operation, query to the query base consumed
+ *                by the first operation (soft-clipped bases included). Soft and
+ *                hard clips produce no columns.
+ *
+ *       Return:  Number of columns (not counting the terminating NUL). Nothing
+ *                meaningful is written unless this is less than cap, so a call
+ *                with cap 0 sizes the rows. (size_t)-1 on unknown operations.
+ * =====================================================================================
+ */
+size_t asw_render_pair_range(const cigar_t* cigar_begin,
+                             const cigar_t* cigar_end,
+                             const char *ref,
+                             const char *query,
+                             char *ref_row,
+                             char *query_row,
+                             size_t cap)
+{
+        const cigar_t *cigar_p = cigar_begin;
+        size_t col = 0u;
+        int fits = cap > 0u;
+        for (; cigar_p < cigar_end; ++cigar_p) {
                 cigar_t cigar = *cigar_p;
-                uint32_t i = 0u;
                 uint32_t op = cigar & BAM_CIGAR_MASK;
-                uint32_t op_len = cigar >> BAM_CIGAR_SHIFT;
+                size_t op_len = cigar >> BAM_CIGAR_SHIFT;
+                if (fits && op != BAM_CSOFT_CLIP && op != BAM_CHARD_CLIP
+                         && col + op_len >= cap) {
+                        fits = 0;
+                }
                 switch (op) {
                 case BAM_CHARD_CLIP:
                         /* do nothing */
                         break;
                 case BAM_CSOFT_CLIP:
-                        /* diagonal move: either match or mismatch */
-                        for (; i < op_len; ++i) {
-                                ++seq1_p, ++seq1source_p;
-                                ++seq2_p, ++seq2source_p;
-                        }
+                        query += op_len;
                         break;
                 case BAM_CMATCH:
                 case BAM_CSEQ_MATCH:
                 case BAM_CSEQ_MISMATCH:
                         /* diagonal move: either match or mismatch */
-                        for (; i < op_len; ++i) {
-                                *seq1_p = *seq1source_p;
-                                ++seq1_p, ++seq1source_p;
-                                *seq2_p = *seq2source_p;
-                                ++seq2_p, ++seq2source_p;
+                        if (fits) {
+                                memcpy(ref_row + col, ref, op_len);
+                                memcpy(query_row + col, query, op_len);
                         }
+                        ref += op_len, query += op_len;
+                        col += op_len;
                         break;
                 case BAM_CINS:
                         /* vertical move: letters in query but not in the reference */
-                        for (; i < op_len; ++i) {
-                                *seq1_p = '-';
-                                ++seq1_p;
-                                *seq2_p = *seq2source_p;
-                                ++seq2_p, ++seq2source_p;
+                        if (fits) {
+                                memset(ref_row + col, '-', op_len);
+                                memcpy(query_row + col, query, op_len);
                         }
+                        query += op_len;
+                        col += op_len;
                         break;
                 case BAM_CDEL:
                         /* horizontal move: letters in reference but not in the query */
-                        for (; i < op_len; ++i) {
-                                *seq1_p = *seq1source_p;
-                                ++seq1_p, ++seq1source_p;
-                                *seq2_p = '-';
-                                ++seq2_p;
+                        if (fits) {
+                                memcpy(ref_row + col, ref, op_len);
+                                memset(query_row + col, '-', op_len);
                         }
+                        ref += op_len;
+                        col += op_len;
                         break;
                 default:
-                        fprintf(stderr, "ERROR (getBasicAlignPair): unknown CIGAR operation %u\n", op);
-                        return NULL;
+                        fprintf(stderr, "ERROR (asw_render_pair): unknown CIGAR operation %u\n", op);
+                        return (size_t)-1;
                 }
         }
-        assert(seq1_p - seq1 == seq2_p - seq2);
-        *seq1_p = '\0';
-        *seq2_p = '\0';
+        if (fits) {
+                ref_row[col] = '\0';
+                query_row[col] = '\0';
+        }
+        return col;
+}
 
-        /* fprintf(stdout, "1: %s\n", seq1);
-         * fprintf(stdout, "2: %s\n", seq2);
-         */
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_render_pair
+ *  Description:  Write the gapped reference and query rows of the traceback to two
+ *                caller buffers of cap bytes each; see asw_render_pair_range
+ * =====================================================================================
+ */
+size_t asw_render_pair(const Alignment_ASW* al, char *ref_row, char *query_row, size_t cap)
+{
+        /* after asw_append_softclip the CIGAR spans the whole query */
+        const cigar_t *cigar_p = al->cigar_begin;
+        size_t query_span = 0u;
+        for (; cigar_p < al->cigar_end; ++cigar_p) {
+                uint32_t op = *cigar_p & BAM_CIGAR_MASK;
+                if (op != BAM_CDEL && op != BAM_CHARD_CLIP) {
+                        query_span += *cigar_p >> BAM_CIGAR_SHIFT;
+                }
+        }
+        const char *query = (query_span == al->query_len) ? al->query : al->subquery;
+        return asw_render_pair_range(al->cigar_begin, al->cigar_end,
+                                     al->subdb + al->offset, query,
+                                     ref_row, query_row, cap);
+}
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_getBasicAlignPair
+ *  Description:  Allocates and initializes a BASICALIGNPAIR struct for use in
+ *                composition alignment from Alignment_ASW struct; NULL on
+ *                failure
+ * =====================================================================================
+ */
+BASICALIGNPAIR* asw_getBasicAlignPair(const Alignment_ASW* al) {
+
+        /* In BASICALIGNPAIR, the length of the alignment is the total number of
+         * traversal instructions in traceback (clipping excluded) */
+        size_t len = asw_render_pair(al, NULL, NULL, 0u);
+        if (len == (size_t)-1) return NULL;
+
+        /* rows outlive the workspace: plain malloc, whatever its allocator */
+        char *seq1 = (char*)malloc(len + 1u),
+             *seq2 = (char*)malloc(len + 1u);
         BASICALIGNPAIR* bap = (BASICALIGNPAIR*)malloc(sizeof(BASICALIGNPAIR));
+        if (seq1 == NULL || seq2 == NULL || bap == NULL) {
+                free(seq1);
+                free(seq2);
+                free(bap);
+                return NULL;
+        }
+        asw_render_pair(al, seq1, seq2, len + 1u);
+
         bap->sequence1side = seq1;
         bap->sequence2side = seq2;
         bap->sequence1start = al->offset;
@@ -1519,3 +2649,362 @@ void freeBasicAlignPair(BASICALIGNPAIR* ap)
         free(ap);
         return;
 }
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  fixed_malloc, fixed_realloc, fixed_free
+ *  Description:  "Virtual table" of ASW_Fixed: storage is inline and already large
+ *                enough, so nothing is ever allocated, moved or released
+ * =====================================================================================
+ */
+static void *fixed_malloc(size_t size)
+{
+        (void)size;
+        return NULL;
+}
+
+static void *fixed_realloc(void *ptr, size_t size)
+{
+        (void)size;
+        return ptr;
+}
+
+static void fixed_free(void *ptr)
+{
+        (void)ptr;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_fixed_init
+ *  Description:  Initialize an ASW_Fixed workspace using provided penalty scores
+ * =====================================================================================
+ */
+ASW_Fixed* asw_fixed_init(ASW_Fixed *fx, int MATCH_PEN, int MISMATCH_PEN, int GAP_OPEN_EXTEND, int GAP_EXTEND)
+{
+        Alignment_ASW *al = &fx->al;
+
+        al->p_malloc = fixed_malloc;
+        al->p_realloc = fixed_realloc;
+        al->p_free = fixed_free;
+
+        al->match_penalty = fx->match_penalty;
+        al->mismatch_penalty = fx->mismatch_penalty;
+        al->gopen_penalty = fx->gopen_penalty;
+        al->gext_penalty = fx->gext_penalty;
+        al->model = NULL;
+
+        al->phred_offset = 0;
+
+        al->db = NULL;
+        al->subdb = NULL;
+        al->query = NULL;
+        al->subquery = NULL;
+        al->qual = NULL;
+        al->subqual = NULL;
+
+        al->vecPen_m_act = fx->vecPen[0];
+        al->vecPen_m1_act = fx->vecPen[1];
+        al->vecIns_m_act = fx->vecIns[0];
+        al->vecIns_m1_act = fx->vecIns[1];
+        al->I_ext_m_act = fx->I_ext[0];
+        al->I_ext_m1_act = fx->I_ext[1];
+        al->vecPen_lastRow = al->vecPen_m_act;
+        al->vecCol_act = NULL;
+        al->lastRow_half = 0u;
+        al->layout = ASW_LAYOUT_SPLIT;
+
+        al->db_len = 0u;
+        al->subdb_len = 0u;
+        al->query_len = 0u;
+        al->subquery_len = 0u;
+        al->offset = 0u;
+
+        size_t m1;
+        for (m1 = 0u; m1 <= ASW_FIXED_QUERY_MAX; ++m1) {
+                fx->rowTra[m1] = fx->matTra[m1];
+        }
+        al->matTra = fx->rowTra;
+        al->rcigar = fx->rcigar;
+        al->cigar_begin = al->cigar_end = fx->rcigar;
+
+        al->n_match = al->n_mismatch = al->n_ins = al->n_del = al->nm = 0u;
+        al->md = al->md_begin = fx->md;
+        al->md_len = sizeof(fx->md);
+        fx->md[0] = '\0';
+
+#ifdef DEBUG
+        /* asw_fixed_align does not record the score matrices */
+        al->matPen = NULL;
+        al->matIns = NULL;
+        al->matDel = NULL;
+#endif
+        asw_init(al, MATCH_PEN, MISMATCH_PEN, GAP_OPEN_EXTEND, GAP_EXTEND);
+        return fx;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_fixed_prepare
+ *  Description:  Assign data fields of an ASW_Fixed workspace
+ * =====================================================================================
+ */
+int asw_fixed_prepare(ASW_Fixed *fx,
+                      const char* m_db,
+                      size_t m_db_len,
+                      const char* m_query,
+                      const uint8_t* m_qual,
+                      size_t m_query_len,
+                      uint32_t clip_head,
+                      uint32_t clip_tail)
+{
+        size_t m_subdb_len = m_db_len - clip_head - clip_tail,
+               m_subquery_len = m_query_len - clip_head - clip_tail;
+
+        if (m_subdb_len > ASW_FIXED_DB_MAX || m_subquery_len > ASW_FIXED_QUERY_MAX)
+                return -1;
+
+        Alignment_ASW *al = &fx->al;
+        al->db = m_db;
+        al->db_len = m_db_len;
+        al->query_len = m_query_len;
+        al->subdb = m_db + clip_head;
+        al->query = m_query;
+        al->subquery = m_query + clip_head;
+        al->qual = m_qual;
+        al->subqual = m_qual + clip_head;
+        al->subdb_len = m_subdb_len;
+        al->subquery_len = m_subquery_len;
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_fixed_align
+ *  Description:  Same as asw_align_init(_semi) followed by asw_align, specialized on
+ *                the inline storage of ASW_Fixed: rows of the trace matrix are a
+ *                compile-time stride apart and the row state vectors never move
+ * =====================================================================================
+ */
+void asw_fixed_align(ASW_Fixed *fx, int semi)
+{
+        Alignment_ASW *al = &fx->al;
+
+        const char *m_subdb = al->subdb,
+                   *m_subquery = al->subquery;
+        const uint8_t* m_subqual = al->subqual;
+        size_t m_subdb_len = al->subdb_len,
+               m_subquery_len = al->subquery_len;
+
+        int GAP_OPEN_EXTEND = al->GAP_OPEN_EXTEND,
+            GAP_EXTEND = al->GAP_EXTEND;
+
+        const int *match_penalty = al->match_penalty - al->phred_offset,
+            *mismatch_penalty = al->mismatch_penalty - al->phred_offset;
+
+        const int *gopen_penalty = al->gopen_penalty - al->phred_offset,
+            *gext_penalty = al->gext_penalty - al->phred_offset;
+
+        cigar_t (*matTra)[ASW_FIXED_DB_MAX + 1] = fx->matTra;
+
+        int *vecPen_m = fx->vecPen[0],
+            *vecIns_m = fx->vecIns[0];
+        uint32_t *I_ext_m = fx->I_ext[0];
+
+        int *vecPen_m1 = fx->vecPen[1],
+            *vecIns_m1 = fx->vecIns[1];
+        uint32_t *I_ext_m1 = fx->I_ext[1];
+
+        /* Initialize first row */
+
+        size_t n, n1;
+        {
+                /* qq - quality in the query at position m */
+                unsigned int qq = (unsigned int)m_subqual[0];
+                int gopen_true_pen = gopen_penalty[qq] - gext_penalty[qq];
+                int storedDel_score = GAP_OPEN_EXTEND - GAP_EXTEND;
+
+                vecPen_m[0] = 0;
+                vecIns_m[0] = gopen_true_pen;
+                I_ext_m[0] = 0;
+                matTra[0][0] = (0 << BAM_CIGAR_SHIFT) | BAM_CSEQ_MATCH;
+                for (n = 0u, n1 = 1u; n < m_subdb_len; ++n, ++n1) {
+                        if (semi) {
+                                vecPen_m[n1] = 0;
+                        } else {
+                                storedDel_score += GAP_EXTEND;
+                                vecPen_m[n1] = storedDel_score;
+                        }
+                        vecIns_m[n1] = vecPen_m[n1] + gopen_true_pen;
+                        /* topmost row consists of only horizontal moves (deletions) */
+                        matTra[0][n1] = (n1 << BAM_CIGAR_SHIFT) | BAM_CDEL;
+                        I_ext_m[n1] = 0;
+                }
+        }
+
+        /* Fill out the rest of the matrix */
+
+        size_t m, m1;
+        for (m = 0u, m1 = 1u; m < m_subquery_len; ++m, ++m1) {
+                /* cq - character in the query at position m */
+                char cq = m_subquery[m];
+                /* qq - quality in the query at position m */
+                unsigned int qq = (unsigned int)m_subqual[m];
+                int match_pen = match_penalty[qq],
+                    mismatch_pen = mismatch_penalty[qq],
+                    gopen_pen = gopen_penalty[qq],
+                    gext_pen = gext_penalty[qq];
+                cigar_t *rowTra = matTra[m1];
+                uint32_t cD = 0u;
+
+                /* leftmost column consists of only vertical moves (insertions) */
+                uint32_t cI;
+                int wI_extend = vecIns_m[0] + gext_pen;
+                vecIns_m1[0] = wI_extend;
+                I_ext_m1[0] = cI = I_ext_m[0] + 1u;
+                rowTra[0] = (cI << BAM_CIGAR_SHIFT) | BAM_CINS;
+
+                vecPen_m1[0] = wI_extend;
+                int storedDel_score = vecPen_m1[0] + (GAP_OPEN_EXTEND - GAP_EXTEND);
+
+                for (n = 0u, n1 = 1u; n < m_subdb_len; ++n, ++n1) {
+                        int wD, wI, wM;
+                        uint32_t cI;
+                        int is_seq_match = IS_MATCH(m_subdb[n], cq);
+
+                        /* deletion: horizontal move */
+                        int wD_open = vecPen_m1[n] + GAP_OPEN_EXTEND;
+                        int wD_extend = storedDel_score + GAP_EXTEND;
+
+                        /* insertion: vertical move */
+                        int wI_open = vecPen_m[n1] + gopen_pen;
+                        int wI_extend = vecIns_m[n1] + gext_pen;
+
+                        /* given equal scores, prefer extending
+                         * existing gaps to opening new ones */
+                        if (wD_open < wD_extend) {
+                                storedDel_score = wD = wD_open;
+                                cD = 1u;
+                        } else {
+                                storedDel_score = wD = wD_extend;
+                                ++cD;
+                        }
+                        if (wI_open < wI_extend) {
+                                vecIns_m1[n1] = wI = wI_open;
+                                I_ext_m1[n1] = cI = 1u;
+                        } else {
+                                vecIns_m1[n1] = wI = wI_extend;
+                                I_ext_m1[n1] = cI = I_ext_m[n1] + 1u;
+                        }
+
+                        int mstate;
+                        if (is_seq_match) {
+                                wM = vecPen_m[n] + match_pen;
+                                mstate = BAM_CSEQ_MATCH;
+                        } else {
+                                wM = vecPen_m[n] + mismatch_pen;
+                                mstate = BAM_CSEQ_MISMATCH;
+                        }
+
+                        /* Order of preference: M, I, D */
+                        if (wI < wM) {
+                                /* either insertion or deletion */
+                                if (wD < wI) {
+                                        /* deletion */
+                                        rowTra[n1] = (cD << BAM_CIGAR_SHIFT) | BAM_CDEL;
+                                        vecPen_m1[n1] = wD;
+                                } else {
+                                        /* insertion */
+                                        rowTra[n1] = (cI << BAM_CIGAR_SHIFT) | BAM_CINS;
+                                        vecPen_m1[n1] = wI;
+                                }
+                        } else if (wD < wM) {
+                                /* deletion */
+                                rowTra[n1] = (cD << BAM_CIGAR_SHIFT) | BAM_CDEL;
+                                vecPen_m1[n1] = wD;
+                        } else {
+                                /* either match or mismatch */
+                                rowTra[n1] = (1u << BAM_CIGAR_SHIFT) | mstate;
+                                vecPen_m1[n1] = wM;
+                        }
+                }
+                int* tmp;
+                /* Swap vecIns_m1 and vecIns_m */
+                tmp = vecIns_m1, vecIns_m1 = vecIns_m, vecIns_m = tmp;
+                /* Swap vecPen_m1 and vecPen_m */
+                tmp = vecPen_m1, vecPen_m1 = vecPen_m, vecPen_m = tmp;
+
+                unsigned int* utmp;
+                /* Swap I_ext_m1 and I_ext_m */
+                utmp = I_ext_m1, I_ext_m1 = I_ext_m, I_ext_m = utmp;
+        }
+        al->vecPen_lastRow = vecPen_m;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_align_score
+ *  Description:  Prepare, align and locate the minimum score (asw_align_full
+ *                without the traceback)
+ * =====================================================================================
+ */
+int asw_align_score(Alignment_ASW *al,
+                    const char* m_db,
+                    size_t m_db_len,
+                    const char* m_query,
+                    const uint8_t* m_qual,
+                    size_t m_query_len,
+                    uint32_t clip_head,
+                    uint32_t clip_tail,
+                    unsigned int flags)
+{
+        int semi = (flags & ASW_ALIGN_SEMI) != 0u;
+        if (al->p_realloc == fixed_realloc) {
+                /* al is the first member of ASW_Fixed */
+                ASW_Fixed *fx = (ASW_Fixed*)al;
+                if (asw_fixed_prepare(fx, m_db, m_db_len, m_query, m_qual, m_query_len,
+                                      clip_head, clip_tail) != 0)
+                        goto error;
+                asw_fixed_align(fx, semi);
+        } else {
+                if (asw_prepare(al, m_db, m_db_len, m_query, m_qual, m_query_len,
+                                clip_head, clip_tail) != 0)
+                        goto error;
+                if (semi) {
+                        asw_align_init_semi(al);
+                } else {
+                        asw_align_init(al);
+                }
+                asw_align(al);
+        }
+        asw_locate_minscore(al);
+        return 0;
+error:
+        return -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_align_full
+ *  Description:  Prepare, align, locate the minimum score and trace in one call.
+ *                Works with both heap workspaces and &fx->al of an ASW_Fixed.
+ *
+ *       Return:  0 on success, -1 if the workspace cannot be resized (or the
+ *                sequences exceed the capacity of ASW_Fixed) or traceback fails
+ * =====================================================================================
+ */
+int asw_align_full(Alignment_ASW *al,
+                   const char* m_db,
+                   size_t m_db_len,
+                   const char* m_query,
+                   const uint8_t* m_qual,
+                   size_t m_query_len,
+                   uint32_t clip_head,
+                   uint32_t clip_tail,
+                   unsigned int flags)
+{
+        if (asw_align_score(al, m_db, m_db_len, m_query, m_qual, m_query_len,
+                            clip_head, clip_tail, flags) != 0)
+                return -1;
+        return asw_trace_ex(al, flags & ~ASW_ALIGN_SEMI, clip_head, clip_tail);
+}
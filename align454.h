@@ -19,6 +19,9 @@
  * =====================================================================================
  */
 
+#ifndef ALIGN454_H
+#define ALIGN454_H
+
 #ifndef NDEBUG
 #define DEBUG
 #endif
@@ -26,22 +29,83 @@
 // Sanger PHRED scores range from 0 to 93
 #define PHRED_RANGE 94
 
+/* Hint to fetch the cache line at p for reading (no-op without GCC builtins) */
+#if defined(__GNUC__)
+#define ASW_PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#else
+#define ASW_PREFETCH(p) ((void)(p))
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef uint32_t cigar_t;
 
+/* Layouts of the per-column row state used by asw_align */
+#define ASW_LAYOUT_SPLIT   0    /* separate vector per quantity (default) */
+#define ASW_LAYOUT_PACKED  1    /* one interleaved array of ASW_Column */
+
+/* Options of asw_trace_ex (may be combined) */
+#define ASW_TRACE_SOFTCLIP        0x1u  /* as asw_softclip_trace */
+#define ASW_TRACE_COMPACT         0x2u  /* as asw_compact_trace */
+#define ASW_TRACE_APPEND_SOFTCLIP 0x4u  /* as asw_append_softclip */
+#define ASW_TRACE_APPEND_HARDCLIP 0x8u  /* as asw_append_hardclip */
+#define ASW_TRACE_MD              0x10u /* also build the SAM MD tag */
+
+/* Option of asw_align_full, combined with ASW_TRACE_* flags */
+#define ASW_ALIGN_SEMI            0x100u /* semiglobal instead of global alignment */
+
+/* Tracebacks asw_trace_many keeps in flight at a time */
+#define ASW_TRACE_MANY_LANES 16
+
+/* Styles of asw_format_cigar */
+#define ASW_CIGAR_SAM     0     /* "10M2I5M" */
+#define ASW_CIGAR_SPACED  1     /* "10M 2I 5M", as asw_show_cigar */
+
+/* Modes of asw_estimate_bytes (may be combined) */
+#define ASW_FOOTPRINT_SCORE   0x0u  /* asw_prepare and asw_align only */
+#define ASW_FOOTPRINT_TRACE   0x1u  /* ... followed by asw_trace */
+#define ASW_FOOTPRINT_PACKED  0x2u  /* row state in ASW_LAYOUT_PACKED layout */
+#define ASW_FOOTPRINT_DEBUG   0x4u  /* score matrices of DEBUG builds (implied in those) */
+#define ASW_FOOTPRINT_FIXED   0x8u  /* ASW_Fixed workspace (zero if lengths exceed it) */
+#define ASW_FOOTPRINT_MD      0x10u /* ... traced with ASW_TRACE_MD */
+
+/* Length of the MD buffer for given lengths of the aligned parts of the
+ * sequences: room for the tag built right to left plus both end numbers */
+#define ASW_MD_LEN(x_len, y_len) (3u * (x_len) + 2u * (y_len) + 24u)
+
+/* Row state of a single column in matPen/matIns */
+typedef struct {
+        int pen;                /* cell in matPen */
+        int ins;                /* cell in matIns */
+        uint32_t ins_ext;       /* insertion length */
+} ASW_RowState;
+
+/* Interleaved per-column state: the two halves alternate between being the
+ * "previous" and the "current" row, so that one column of both rows shares
+ * a cache line */
+typedef struct {
+        ASW_RowState half[2];
+} ASW_Column;
+
+/* Scoring model: penalty look-up tables computed from the penalty scores.
+ * Immutable and reference-counted, so that any number of workspaces on any
+ * number of threads can share one (see asw_model_new, asw_set_model). */
+typedef struct ASW_Model ASW_Model;
+
 struct Alignment_ASW {
 
         /* PHRED offset in the ASCII encoding: 33 for Sanger format */
         int phred_offset;
 
-        /* look-up tables for quality-based scoring */
-        int *match_penalty,
-            *mismatch_penalty,
-            *gopen_penalty,
-            *gext_penalty;
+        ASW_Model *model;       /* scoring model (reference held; NULL for ASW_Fixed) */
+
+        /* look-up tables for quality-based scoring, pointing into the model */
+        const int *match_penalty,
+                  *mismatch_penalty,
+                  *gopen_penalty,
+                  *gext_penalty;
 
         int GAP_OPEN_EXTEND,
             GAP_EXTEND;
@@ -81,6 +145,11 @@ struct Alignment_ASW {
         int *vecPen_lastRow;    /* vector corresponding to last row in matPen, always
                                  * equal to either vecPen_m_act or vecPen_m1_act */
 
+        ASW_Column *vecCol_act; /* row state in ASW_LAYOUT_PACKED layout */
+        unsigned int lastRow_half;  /* half of vecCol_act holding last row in matPen */
+
+        int layout;             /* ASW_LAYOUT_SPLIT or ASW_LAYOUT_PACKED */
+
         cigar_t **matTra;       /* trace matrix */
 
 #ifdef DEBUG
@@ -99,6 +168,18 @@ struct Alignment_ASW {
 
         size_t offset;          /* position in reference where to start the alignment */
 
+        /* edit statistics of the CIGAR produced by asw_trace_ex (soft-clipped
+         * bases excluded) */
+        uint32_t n_match,       /* bases in BAM_CSEQ_MATCH */
+                 n_mismatch,    /* bases in BAM_CSEQ_MISMATCH */
+                 n_ins,         /* bases in BAM_CINS */
+                 n_del,         /* bases in BAM_CDEL */
+                 nm;            /* edit distance (SAM NM tag) */
+
+        char *md,               /* buffer containing the MD tag (ASW_TRACE_MD) */
+             *md_begin;         /* pointer to the NUL-terminated MD tag */
+        size_t md_len;          /* size of md */
+
         /* "virtual table" */
 
         void *(*p_malloc)(size_t size);
@@ -109,6 +190,45 @@ struct Alignment_ASW {
 
 typedef struct Alignment_ASW Alignment_ASW;
 
+/* Mutable per-alignment state; a workspace must not be used by two threads at
+ * a time, while its model may be */
+typedef struct Alignment_ASW ASW_Workspace;
+
+/*
+ * Capacity of ASW_Fixed. The library and its users must be compiled with the
+ * same values. The defaults keep the struct at about 400 KB so that it fits on
+ * a default thread stack or in thread-local storage.
+ */
+#ifndef ASW_FIXED_QUERY_MAX
+#define ASW_FIXED_QUERY_MAX 256
+#endif
+#ifndef ASW_FIXED_DB_MAX
+#define ASW_FIXED_DB_MAX 384
+#endif
+
+/* Fixed-capacity workspace for short reads: all buffers are inline and the
+ * embedded Alignment_ASW points into them, so no allocator calls are made.
+ * Use asw_fixed_init, asw_fixed_prepare and asw_fixed_align in place of
+ * asw_new, asw_prepare and asw_align; functions operating on the results
+ * (asw_locate_minscore, asw_trace and the CIGAR routines) take &fx->al. */
+typedef struct {
+        Alignment_ASW al;
+
+        int match_penalty[PHRED_RANGE],
+            mismatch_penalty[PHRED_RANGE],
+            gopen_penalty[PHRED_RANGE],
+            gext_penalty[PHRED_RANGE];
+
+        int vecPen[2][ASW_FIXED_DB_MAX + 1];
+        int vecIns[2][ASW_FIXED_DB_MAX + 1];
+        uint32_t I_ext[2][ASW_FIXED_DB_MAX + 1];
+
+        cigar_t *rowTra[ASW_FIXED_QUERY_MAX + 1];
+        cigar_t matTra[ASW_FIXED_QUERY_MAX + 1][ASW_FIXED_DB_MAX + 1];
+        cigar_t rcigar[ASW_FIXED_QUERY_MAX + 4];
+        char md[ASW_MD_LEN(ASW_FIXED_DB_MAX, ASW_FIXED_QUERY_MAX)];
+} ASW_Fixed;
+
 typedef struct
 {
         char*   sequence1side;
@@ -146,7 +266,8 @@ Alignment_ASW* asw_alloc(
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_init
- *  Description:  Initialize an Alignment_ASW struct using provided penalty scores
+ *  Description:  Initialize an Alignment_ASW struct using provided penalty scores,
+ *                giving it a scoring model of its own. Returns NULL on failure.
  * =====================================================================================
  */
 Alignment_ASW* asw_init(Alignment_ASW *al,
@@ -154,6 +275,62 @@ Alignment_ASW* asw_init(Alignment_ASW *al,
                         int MISMATCH_PEN,
                         int GAP_OPEN_EXTEND,
                         int GAP_EXTEND);
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_model_new
+ *  Description:  Allocate a scoring model using provided penalty scores. The caller
+ *                owns the one reference it holds. Returns NULL on failure.
+ * =====================================================================================
+ */
+ASW_Model* asw_model_new(int MATCH_PEN,
+                         int MISMATCH_PEN,
+                         int GAP_OPEN_EXTEND,
+                         int GAP_EXTEND);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_model_retain
+ *  Description:  Take a reference to a scoring model (thread-safe)
+ * =====================================================================================
+ */
+ASW_Model* asw_model_retain(ASW_Model *model);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_model_release
+ *  Description:  Drop a reference to a scoring model, freeing it with the last one
+ *                (thread-safe)
+ * =====================================================================================
+ */
+void asw_model_release(ASW_Model *model);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_workspace_new
+ *  Description:  Allocate a workspace scoring with a shared model, to which it takes
+ *                a reference. Returns NULL on failure.
+ * =====================================================================================
+ */
+ASW_Workspace* asw_workspace_new(ASW_Model *model);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_set_model
+ *  Description:  Make a workspace score with given model, releasing the previous
+ *                one. ASW_Fixed workspaces copy the tables instead.
+ * =====================================================================================
+ */
+void asw_set_model(Alignment_ASW *al, ASW_Model *model);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_get_model
+ *  Description:  Scoring model of a workspace (borrowed reference; NULL for
+ *                ASW_Fixed)
+ * =====================================================================================
+ */
+ASW_Model* asw_get_model(const Alignment_ASW *al);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_free
@@ -162,6 +339,16 @@ Alignment_ASW* asw_init(Alignment_ASW *al,
  */
 void asw_free(Alignment_ASW *al);
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_estimate_bytes
+ *  Description:  Number of bytes held by an Alignment_ASW struct after aligning
+ *                sequences of given (unclipped) lengths; mode is a combination of
+ *                ASW_FOOTPRINT_* flags
+ * =====================================================================================
+ */
+size_t asw_estimate_bytes(size_t db_len, size_t query_len, unsigned int mode);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_set_phoffset
@@ -170,6 +357,18 @@ void asw_free(Alignment_ASW *al);
  */
 void asw_set_phoffset(Alignment_ASW* al, int phred_offset);
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_set_layout
+ *  Description:  Select the memory layout of the row state (ASW_LAYOUT_SPLIT or
+ *                ASW_LAYOUT_PACKED) used by the alignment kernel. Returns 0 on
+ *                success, -1 for an unknown layout, on allocation failure, or when
+ *                changing the layout of an ASW_Fixed workspace, which always uses
+ *                ASW_LAYOUT_SPLIT.
+ * =====================================================================================
+ */
+int asw_set_layout(Alignment_ASW* al, int layout);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_prepare_query
@@ -234,6 +433,47 @@ void asw_align_init_semi(Alignment_ASW *al);
  */
 void asw_align(Alignment_ASW *al);
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_align_score
+ *  Description:  First half of asw_align_full: prepare, align and locate the
+ *                minimum score, leaving the traceback to asw_trace_ex (called with
+ *                flags & ~ASW_ALIGN_SEMI and the same clips). Lets callers do other
+ *                work, such as fetching the next input, in between. Returns -1 on
+ *                failure.
+ * =====================================================================================
+ */
+int asw_align_score(Alignment_ASW *al,
+                    const char* m_db,
+                    size_t m_db_len,
+                    const char* m_query,
+                    const uint8_t* m_qual,
+                    size_t m_query_len,
+                    uint32_t clip_head,
+                    uint32_t clip_tail,
+                    unsigned int flags);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_align_full
+ *  Description:  asw_prepare (or asw_fixed_prepare for &fx->al of an ASW_Fixed),
+ *                alignment (semiglobal with ASW_ALIGN_SEMI), asw_locate_minscore
+ *                and asw_trace_ex with the ASW_TRACE_* options in flags, in one
+ *                call. clip_head and clip_tail are passed to both prepare and
+ *                trace. Score, offset, CIGAR and end column are left in al.
+ *                Returns -1 on failure.
+ * =====================================================================================
+ */
+int asw_align_full(Alignment_ASW *al,
+                   const char* m_db,
+                   size_t m_db_len,
+                   const char* m_query,
+                   const uint8_t* m_qual,
+                   size_t m_query_len,
+                   uint32_t clip_head,
+                   uint32_t clip_tail,
+                   unsigned int flags);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_locate_minscore
@@ -250,6 +490,38 @@ int asw_locate_minscore(Alignment_ASW* al);
  */
 int asw_trace(Alignment_ASW* al);
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_trace_many
+ *  Description:  Same as asw_trace on each of n workspaces that have been aligned
+ *                and passed to asw_locate_minscore, but advancing up to
+ *                ASW_TRACE_MANY_LANES tracebacks in round-robin with a prefetch of
+ *                each one's next cell, so that cache misses on large trace
+ *                matrices overlap. The workspaces must be distinct. If status is
+ *                not NULL, it receives the outcome of each traceback (0 or -1).
+ *                Returns -1 if any traceback failed, else 0.
+ * =====================================================================================
+ */
+int asw_trace_many(Alignment_ASW **als, size_t n, int *status);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_trace_ex
+ *  Description:  Produce a traceback post-processed according to ASW_TRACE_* flags
+ *                in a single pass over the trace matrix. The result is the same as
+ *                that of asw_trace followed by asw_softclip_trace,
+ *                asw_compact_trace, asw_append_softclip and asw_append_hardclip
+ *                (in this order) for the selected options; clip_head and clip_tail
+ *                are only used with ASW_TRACE_APPEND_HARDCLIP. Also counts matches,
+ *                mismatches, inserted and deleted bases and, with ASW_TRACE_MD,
+ *                builds the MD tag.
+ * =====================================================================================
+ */
+int asw_trace_ex(Alignment_ASW* al,
+                 unsigned int flags,
+                 uint32_t clip_head,
+                 uint32_t clip_tail);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_append_softclip
@@ -300,11 +572,49 @@ void asw_compact_trace(Alignment_ASW* al);
  */
 int32_t asw_getAlignmentStart(const Alignment_ASW* al, int alstart);
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_cigar_ref_len
+ *  Description:  Number of reference bases covered by CIGAR operations in
+ *                [cigar_begin, cigar_end)
+ * =====================================================================================
+ */
+size_t asw_cigar_ref_len(const cigar_t* cigar_begin, const cigar_t* cigar_end);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_render_pair_range
+ *  Description:  Write gapped reference and query rows of the alignment given by
+ *                CIGAR operations in [cigar_begin, cigar_end) to caller buffers of
+ *                cap bytes each, starting at ref and query. Returns the number of
+ *                columns; the rows are only written if that is less than cap.
+ * =====================================================================================
+ */
+size_t asw_render_pair_range(const cigar_t* cigar_begin,
+                             const cigar_t* cigar_end,
+                             const char *ref,
+                             const char *query,
+                             char *ref_row,
+                             char *query_row,
+                             size_t cap);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_render_pair
+ *  Description:  Write gapped reference and query rows of the traceback to caller
+ *                buffers (see asw_render_pair_range)
+ * =====================================================================================
+ */
+size_t asw_render_pair(const Alignment_ASW* al, char *ref_row, char *query_row, size_t cap);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_getBasicAlignPair
  *  Description:  Allocates and initializes a BASICALIGNMENTPAIR struct for use in
- *                composition alignment from Alignment_ASW struct
+ *                composition alignment from Alignment_ASW struct. Rows are
+ *                allocated with malloc (see freeBasicAlignPair), also for
+ *                workspaces with custom allocators or fixed storage. Returns NULL
+ *                on failure.
  * =====================================================================================
  */
 BASICALIGNPAIR* asw_getBasicAlignPair(const Alignment_ASW* al);
@@ -317,6 +627,48 @@ BASICALIGNPAIR* asw_getBasicAlignPair(const Alignment_ASW* al);
  */
 void freeBasicAlignPair(BASICALIGNPAIR* ap);
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_print_cigar_range
+ *  Description:  Print CIGAR operations in [cigar_p, cigar_end) to specified file
+ *                or stream
+ * =====================================================================================
+ */
+void asw_print_cigar_range(const cigar_t* cigar_p, const cigar_t* cigar_end, FILE *fp);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_format_cigar_range
+ *  Description:  Write CIGAR operations in [cigar_begin, cigar_end) to a caller
+ *                buffer of cap bytes in ASW_CIGAR_SAM or ASW_CIGAR_SPACED style.
+ *                Returns the length of the complete string (without NUL); like
+ *                snprintf, the result is truncated if that is not less than cap.
+ * =====================================================================================
+ */
+size_t asw_format_cigar_range(const cigar_t* cigar_begin,
+                              const cigar_t* cigar_end,
+                              char *buf,
+                              size_t cap,
+                              int style);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_format_cigar
+ *  Description:  Write CIGAR traceback to a caller buffer (see
+ *                asw_format_cigar_range)
+ * =====================================================================================
+ */
+size_t asw_format_cigar(const Alignment_ASW* al, char *buf, size_t cap, int style);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_show_cigar_range
+ *  Description:  Print CIGAR operations in [cigar_begin, cigar_end) to a newly
+ *                allocated string
+ * =====================================================================================
+ */
+const char* asw_show_cigar_range(const cigar_t* cigar_begin, const cigar_t* cigar_end);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  asw_print_cigar
@@ -333,6 +685,44 @@ void asw_print_cigar(const Alignment_ASW* al, FILE *fp);
  */
 const char* asw_show_cigar(const Alignment_ASW* al);
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_fixed_init
+ *  Description:  Initialize an ASW_Fixed workspace (e.g. one on the stack or in
+ *                thread-local storage) using provided penalty scores
+ * =====================================================================================
+ */
+ASW_Fixed* asw_fixed_init(ASW_Fixed *fx,
+                          int MATCH_PEN,
+                          int MISMATCH_PEN,
+                          int GAP_OPEN_EXTEND,
+                          int GAP_EXTEND);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_fixed_prepare
+ *  Description:  Assign data fields of an ASW_Fixed workspace. Returns -1 if the
+ *                sequences exceed ASW_FIXED_DB_MAX or ASW_FIXED_QUERY_MAX.
+ * =====================================================================================
+ */
+int asw_fixed_prepare(ASW_Fixed *fx,
+                      const char* m_db,
+                      size_t m_db_len,
+                      const char* m_query,
+                      const uint8_t* m_qual,
+                      size_t m_query_len,
+                      uint32_t clip_head,
+                      uint32_t clip_tail);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_fixed_align
+ *  Description:  Fill out the top row (global or semiglobal) and perform alignment
+ *                in an ASW_Fixed workspace
+ * =====================================================================================
+ */
+void asw_fixed_align(ASW_Fixed *fx, int semi);
+
 #ifdef DEBUG
 /*
  * ===  FUNCTION  ======================================================================
@@ -347,3 +737,5 @@ void asw_print_matrix1(const Alignment_ASW *al, FILE *fp);
 #ifdef __cplusplus
 }
 #endif
+
+#endif /* ALIGN454_H */
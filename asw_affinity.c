@@ -0,0 +1,236 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_affinity.c
+ *
+ *    Description:  NUMA topology from /sys/devices/system/node and thread binding
+ *                  with sched_setaffinity. Nothing here needs libnuma: memory is
+ *                  placed by first touch, so a thread bound to a node before it
+ *                  allocates and initializes its buffers gets them on that node.
+ *                  On systems without sysfs or CPU affinity, everything is one node
+ *                  and binding does nothing.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "asw_affinity.h"
+
+struct ASW_Topology {
+        unsigned int n_nodes;
+        unsigned int *start;    /* n_nodes + 1 offsets into cpus */
+        int *cpus;              /* allowed CPUs, grouped by node */
+        int *ids;               /* node numbers of the operating system */
+};
+
+#ifdef __linux__
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  parse_cpulist
+ *  Description:  Add the allowed CPUs of a sysfs cpulist ("0-3,8,10-11") to cpus,
+ *                which has room for CPU_SETSIZE entries. Returns the new count.
+ * =====================================================================================
+ */
+static unsigned int parse_cpulist(const char *list, const cpu_set_t *allowed,
+                                  int *cpus, unsigned int n)
+{
+        const char *p = list;
+        while (*p >= '0' && *p <= '9') {
+                char *end;
+                long first = strtol(p, &end, 10), last = first;
+                p = end;
+                if (*p == '-') {
+                        last = strtol(p + 1, &end, 10);
+                        p = end;
+                }
+                long cpu;
+                for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+                        if (CPU_ISSET((int)cpu, allowed)) cpus[n++] = (int)cpu;
+                }
+                if (*p == ',') ++p;
+        }
+        return n;
+}
+#endif
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_load
+ *  Description:  Read the NUMA nodes and their allowed CPUs
+ * =====================================================================================
+ */
+ASW_Topology* asw_topology_load(void)
+{
+        ASW_Topology *topo = (ASW_Topology*)calloc(1u, sizeof(ASW_Topology));
+        if (topo == NULL) return NULL;
+#ifdef __linux__
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) goto single;
+        if ((topo->cpus = (int*)malloc(sizeof(int) * CPU_SETSIZE)) == NULL) goto error;
+
+        /* node numbers run up to the last one in the list of possible nodes */
+        unsigned int node, max_node = 0u, n_cpus = 0u;
+        char path[64], list[4096];
+        FILE *fp = fopen("/sys/devices/system/node/possible", "r");
+        if (fp != NULL) {
+                size_t len = fread(list, 1u, sizeof(list) - 1u, fp);
+                fclose(fp);
+                list[len] = '\0';
+                const char *last = list + strcspn(list, "\n");
+                while (last > list && last[-1] >= '0' && last[-1] <= '9') --last;
+                max_node = (unsigned int)strtoul(last, NULL, 10);
+        }
+        if ((topo->start = (unsigned int*)malloc(sizeof(unsigned int) * (max_node + 2u))) == NULL ||
+            (topo->ids = (int*)malloc(sizeof(int) * (max_node + 1u))) == NULL)
+                goto error;
+        for (node = 0u; node <= max_node; ++node) {
+                snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+                fp = fopen(path, "r");
+                /* node numbers may have holes */
+                if (fp == NULL) continue;
+                size_t len = fread(list, 1u, sizeof(list) - 1u, fp);
+                fclose(fp);
+                list[len] = '\0';
+                unsigned int before = n_cpus;
+                n_cpus = parse_cpulist(list, &allowed, topo->cpus, n_cpus);
+                /* skip memory-only nodes and nodes outside our cpuset */
+                if (n_cpus > before) {
+                        topo->ids[topo->n_nodes] = (int)node;
+                        topo->start[topo->n_nodes++] = before;
+                }
+        }
+        if (topo->n_nodes > 0u) {
+                topo->start[topo->n_nodes] = n_cpus;
+                return topo;
+        }
+        /* no sysfs: all allowed CPUs */
+        int cpu;
+        for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) topo->cpus[n_cpus++] = cpu;
+        }
+        if (n_cpus > 0u) {
+                topo->n_nodes = 1u;
+                topo->start[0] = 0u;
+                topo->start[1] = n_cpus;
+                topo->ids[0] = 0;
+                return topo;
+        }
+single:
+        free(topo->cpus);
+        free(topo->start);
+        free(topo->ids);
+#endif
+        /* one node whose CPUs are not known: binding is a no-op */
+        topo->n_nodes = 1u;
+        topo->cpus = NULL;
+        if ((topo->start = (unsigned int*)calloc(2u, sizeof(unsigned int))) == NULL ||
+            (topo->ids = (int*)calloc(1u, sizeof(int))) == NULL)
+                goto error;
+        return topo;
+error:
+        asw_topology_free(topo);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_nodes
+ *  Description:  Number of nodes with at least one allowed CPU
+ * =====================================================================================
+ */
+unsigned int asw_topology_nodes(const ASW_Topology *topo)
+{
+        return topo->n_nodes;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_node_id
+ *  Description:  Operating system number of a node
+ * =====================================================================================
+ */
+int asw_topology_node_id(const ASW_Topology *topo, unsigned int node)
+{
+        return topo->ids[node];
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_cpus
+ *  Description:  Number of allowed CPUs of a node
+ * =====================================================================================
+ */
+unsigned int asw_topology_cpus(const ASW_Topology *topo, unsigned int node)
+{
+        return topo->start[node + 1u] - topo->start[node];
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_worker_node
+ *  Description:  Node of the n-th worker (round-robin)
+ * =====================================================================================
+ */
+unsigned int asw_topology_worker_node(const ASW_Topology *topo, unsigned int worker)
+{
+        return worker % topo->n_nodes;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_bind
+ *  Description:  Bind the calling thread as the n-th worker
+ * =====================================================================================
+ */
+int asw_topology_bind(const ASW_Topology *topo, int affinity, unsigned int worker)
+{
+        unsigned int node = asw_topology_worker_node(topo, worker),
+                     n_cpus = asw_topology_cpus(topo, node);
+        if (affinity == ASW_AFFINITY_NONE || n_cpus == 0u) return -1;
+#ifdef __linux__
+        const int *cpus = topo->cpus + topo->start[node];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (affinity == ASW_AFFINITY_CORE) {
+                /* the k-th worker of a node takes its k-th CPU */
+                CPU_SET(cpus[(worker / topo->n_nodes) % n_cpus], &set);
+        } else {
+                unsigned int k;
+                for (k = 0u; k < n_cpus; ++k) {
+                        CPU_SET(cpus[k], &set);
+                }
+        }
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &set) != 0) return -1;
+        return topo->ids[node];
+#else
+        return -1;
+#endif
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_free
+ *  Description:  Free a topology
+ * =====================================================================================
+ */
+void asw_topology_free(ASW_Topology *topo)
+{
+        if (topo == NULL) return;
+        free(topo->cpus);
+        free(topo->start);
+        free(topo->ids);
+        free(topo);
+}
@@ -0,0 +1,100 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_affinity.h
+ *
+ *    Description:  NUMA topology and placement of worker threads on cores or nodes
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef ASW_AFFINITY_H
+#define ASW_AFFINITY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Placement of worker threads (ASW_BatchOptions.affinity) */
+#define ASW_AFFINITY_NONE  0    /* left to the scheduler */
+#define ASW_AFFINITY_CORE  1    /* each worker pinned to one CPU */
+#define ASW_AFFINITY_NODE  2    /* each worker bound to the CPUs of one NUMA node */
+
+typedef struct ASW_Topology ASW_Topology;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_load
+ *  Description:  Read the NUMA nodes and their CPUs from sysfs, keeping only CPUs
+ *                the process may run on. Without NUMA information, all allowed
+ *                CPUs form a single node. Returns NULL on allocation failure.
+ * =====================================================================================
+ */
+ASW_Topology* asw_topology_load(void);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_nodes
+ *  Description:  Number of nodes with at least one allowed CPU
+ * =====================================================================================
+ */
+unsigned int asw_topology_nodes(const ASW_Topology *topo);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_node_id
+ *  Description:  Number the operating system gives a node (0 <= node <
+ *                asw_topology_nodes). Nodes are indexed densely here, skipping
+ *                nodes without allowed CPUs, so the two differ on hosts with
+ *                holes in the node numbers or cpusets leaving nodes out.
+ * =====================================================================================
+ */
+int asw_topology_node_id(const ASW_Topology *topo, unsigned int node);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_cpus
+ *  Description:  Number of allowed CPUs of a node (0 <= node < asw_topology_nodes)
+ * =====================================================================================
+ */
+unsigned int asw_topology_cpus(const ASW_Topology *topo, unsigned int node);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_worker_node
+ *  Description:  Node of the n-th worker: workers are spread round-robin over the
+ *                nodes, so that a partial load uses every socket
+ * =====================================================================================
+ */
+unsigned int asw_topology_worker_node(const ASW_Topology *topo, unsigned int worker);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_bind
+ *  Description:  Bind the calling thread as the n-th worker: to one CPU of its node
+ *                (ASW_AFFINITY_CORE, consecutive workers of a node on consecutive
+ *                CPUs) or to all CPUs of its node (ASW_AFFINITY_NODE). Returns the
+ *                operating system number of the node (asw_topology_node_id), or -1
+ *                if the thread was left unbound (ASW_AFFINITY_NONE, or binding is
+ *                not supported or failed).
+ * =====================================================================================
+ */
+int asw_topology_bind(const ASW_Topology *topo, int affinity, unsigned int worker);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_topology_free
+ *  Description:  Free a topology
+ * =====================================================================================
+ */
+void asw_topology_free(ASW_Topology *topo);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASW_AFFINITY_H */
@@ -0,0 +1,747 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_batch.c
+ *
+ *    Description:  Batch alignment on a pool of worker threads. Workers are started
+ *                  once and wait for batches; each keeps its own Alignment_ASW so
+ *                  that buffers stay allocated (and warm) from job to job, while
+ *                  all of them share one scoring model. Every result is written to
+ *                  the index of its job, so results come out in input order
+ *                  without any reordering.
+ *
+ *                  Jobs are scheduled in one of two ways. ASW_SCHEDULE_CHUNKED
+ *                  hands out chunks of consecutive indices from a shared counter.
+ *                  ASW_SCHEDULE_STEAL sorts the jobs by estimated cost (cells of
+ *                  the DP matrix) and deals them round-robin into one deque per
+ *                  worker, so that every deque holds a similar mix, largest first.
+ *                  A worker takes jobs from the head of its own deque; once it is
+ *                  empty, it steals the cheaper half of the fullest other deque
+ *                  from its tail. Large jobs therefore start early and small ones
+ *                  fill the gaps at the end of the batch.
+ *
+ *                  Within a worker, jobs run back to back through run_job, which
+ *                  issues prefetches for the inputs of the worker's next job once
+ *                  the current matrix is filled, so that they arrive while the
+ *                  traceback runs instead of stalling the first rows of the next
+ *                  alignment.
+ *
+ *                  Workers may be bound to cores or NUMA nodes (asw_affinity.h).
+ *                  Each worker binds itself and then allocates its workspace, so
+ *                  first touch places the workspace and its DP buffers on the
+ *                  worker's node. With replicate_model, the first worker on a node
+ *                  also builds that node's copy of the scoring model.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "asw_batch.h"
+
+#define DEFAULT_CHUNK 16u
+
+/* Prefetching of job inputs: cache line size and most bytes fetched per
+ * sequence (the whole reference window is read in the first row; query and
+ * qualities one byte per row, which the hardware prefetcher follows) */
+#define PREFETCH_LINE 64u
+#define PREFETCH_DB_MAX (16u * 1024u)
+#define PREFETCH_QUERY_MAX 512u
+
+/* Jobs of a worker in ASW_SCHEDULE_STEAL: positions [head, tail) of order[] */
+typedef struct {
+        pthread_mutex_t lock;
+        size_t head,            /* next job of the owner (largest remaining) */
+               tail;            /* one past the job thieves take first (smallest) */
+} Deque;
+
+/* A job and its estimated cost, for sorting */
+typedef struct {
+        uint64_t cost;
+        size_t index;
+} CostedJob;
+
+struct ASW_Batch {
+        pthread_mutex_t lock;
+        pthread_cond_t work_cv;         /* signalled when a batch is posted */
+        pthread_cond_t done_cv;         /* signalled when the last job is done */
+
+        pthread_t *threads;
+        Alignment_ASW **workspaces;     /* one per worker */
+        int *nodes;                     /* node of each worker, -1 if unbound */
+        unsigned int nthreads;
+        size_t chunk;
+        int schedule;
+
+        /* worker placement and scoring models, set up by the workers as they
+         * start (guarded by lock) */
+        ASW_BatchOptions opt;
+        ASW_Topology *topo;             /* NULL if workers are not bound */
+        ASW_Model **models;             /* one per node, or only models[0] */
+        unsigned int n_models;
+        unsigned int ready;             /* workers done setting up */
+        int setup_failed;
+
+        /* ASW_SCHEDULE_STEAL: one deque per worker over order[] */
+        Deque *deques;
+        size_t *order;                  /* job indices, dealt into the deques */
+        CostedJob *costed;              /* sorting buffer */
+        size_t order_cap;               /* capacity of order and costed */
+
+        /* statistics of the last batch, one entry per worker */
+        ASW_WorkerStats *stats;
+
+        /* current batch, guarded by lock */
+        const ASW_Job *jobs;
+        ASW_Result *results;
+        size_t n_jobs;
+        size_t next;                    /* first job not yet handed out (chunked) */
+        size_t n_done;                  /* jobs finished */
+        size_t n_failed;
+        unsigned int active;            /* workers still looking for jobs */
+        int stealing;                   /* batch uses the deques */
+        unsigned long generation;       /* incremented for every batch */
+        int shutdown;
+};
+
+typedef struct {
+        ASW_Batch *batch;
+        unsigned int id;
+} WorkerArg;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  now_sec
+ *  Description:  Monotonic wall clock in seconds
+ * =====================================================================================
+ */
+static double now_sec(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_job_cost
+ *  Description:  Estimated cost of a job: cells of the matrices filled by asw_align
+ * =====================================================================================
+ */
+uint64_t asw_job_cost(const ASW_Job *job)
+{
+        size_t clip = (size_t)job->clip_head + job->clip_tail;
+        if (job->query_len <= clip || job->db_len <= clip) return 0u;
+        return (uint64_t)(job->query_len - clip) * (uint64_t)(job->db_len - clip);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  prefetch_range
+ *  Description:  Request up to max bytes starting at p into the cache
+ * =====================================================================================
+ */
+static void prefetch_range(const void *p, size_t len, size_t max)
+{
+        const char *c = (const char*)p;
+        size_t off;
+        if (len > max) len = max;
+        for (off = 0u; off < len; off += PREFETCH_LINE) {
+                ASW_PREFETCH(c + off);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  prefetch_job
+ *  Description:  Request the aligned parts of the sequences of a job into the cache
+ * =====================================================================================
+ */
+static void prefetch_job(const ASW_Job *job)
+{
+        if (asw_job_cost(job) == 0u) return;
+        size_t clip = (size_t)job->clip_head + job->clip_tail;
+        prefetch_range(job->db + job->clip_head, job->db_len - clip, PREFETCH_DB_MAX);
+        prefetch_range(job->query + job->clip_head, job->query_len - clip, PREFETCH_QUERY_MAX);
+        prefetch_range(job->qual + job->clip_head, job->query_len - clip, PREFETCH_QUERY_MAX);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  run_job
+ *  Description:  asw_run_job, prefetching the inputs of next (if not NULL) between
+ *                filling the matrix and the traceback
+ * =====================================================================================
+ */
+static int run_job(Alignment_ASW *al, const ASW_Job *job, ASW_Result *res,
+                   const ASW_Job *next)
+{
+        res->cigar = NULL;
+        res->n_cigar = 0u;
+        res->md = NULL;
+        /* nothing to align */
+        if (job->query_len <= (size_t)job->clip_head + job->clip_tail ||
+            job->db_len <= (size_t)job->clip_head + job->clip_tail)
+                goto error;
+        if (asw_align_score(al, job->db, job->db_len, job->query, job->qual,
+                            job->query_len, job->clip_head, job->clip_tail,
+                            job->flags & ~ASW_JOB_SCORE_ONLY) != 0)
+                goto error;
+        if (next != NULL) prefetch_job(next);
+        if (job->flags & ASW_JOB_SCORE_ONLY) {
+                res->score = al->opt_score;
+                res->offset = 0u;
+                res->end_col = al->opt_score_col;
+                res->nm = 0u;
+                res->status = 0;
+                return 0;
+        }
+        if (asw_trace_ex(al, job->flags & ~(ASW_ALIGN_SEMI | ASW_JOB_SCORE_ONLY),
+                         job->clip_head, job->clip_tail) != 0)
+                goto error;
+
+        size_t n_cigar = al->cigar_end - al->cigar_begin;
+        if ((res->cigar = (cigar_t*)malloc(sizeof(cigar_t) * n_cigar)) == NULL)
+                goto error;
+        memcpy(res->cigar, al->cigar_begin, sizeof(cigar_t) * n_cigar);
+        res->n_cigar = n_cigar;
+        if (job->flags & ASW_TRACE_MD) {
+                size_t md_len = strlen(al->md_begin) + 1u;
+                if ((res->md = (char*)malloc(md_len)) == NULL)
+                        goto error;
+                memcpy(res->md, al->md_begin, md_len);
+        }
+        res->score = al->opt_score;
+        res->offset = al->offset;
+        res->end_col = al->opt_score_col;
+        res->nm = al->nm;
+        res->status = 0;
+        return 0;
+error:
+        asw_result_clear(res, 1u);
+        res->status = -1;
+        return -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_run_job
+ *  Description:  Align one job on the given workspace and fill out its result
+ * =====================================================================================
+ */
+int asw_run_job(Alignment_ASW *al, const ASW_Job *job, ASW_Result *res)
+{
+        return run_job(al, job, res, NULL);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_run_jobs
+ *  Description:  Align n jobs in order on one workspace, prefetching the inputs of
+ *                each next job during the traceback of the current one
+ * =====================================================================================
+ */
+size_t asw_run_jobs(Alignment_ASW *al, const ASW_Job *jobs, ASW_Result *results, size_t n)
+{
+        size_t i, failed = 0u;
+        for (i = 0u; i < n; ++i) {
+                if (run_job(al, &jobs[i], &results[i], i + 1u < n ? &jobs[i + 1u] : NULL) != 0)
+                        ++failed;
+        }
+        return failed;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  take_own
+ *  Description:  Pop the largest remaining job off the head of a worker's deque;
+ *                returns 0 if the deque is empty. *next is set to the job after it
+ *                (SIZE_MAX if there is none), a hint for prefetching only: thieves
+ *                may take it meanwhile.
+ * =====================================================================================
+ */
+static int take_own(ASW_Batch *b, unsigned int id, size_t *index, size_t *next)
+{
+        Deque *d = &b->deques[id];
+        int found = 0;
+        pthread_mutex_lock(&d->lock);
+        if (d->head < d->tail) {
+                *index = b->order[d->head++];
+                *next = d->head < d->tail ? b->order[d->head] : SIZE_MAX;
+                found = 1;
+        }
+        pthread_mutex_unlock(&d->lock);
+        return found;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  steal
+ *  Description:  Move the cheaper half of the fullest other deque into the (empty)
+ *                deque of worker id; returns 0 if all deques are empty
+ * =====================================================================================
+ */
+static int steal(ASW_Batch *b, unsigned int id)
+{
+        for (;;) {
+                /* pick the victim with the most jobs left */
+                unsigned int v, victim = id;
+                size_t most = 0u;
+                for (v = 0u; v < b->nthreads; ++v) {
+                        if (v == id) continue;
+                        Deque *d = &b->deques[v];
+                        pthread_mutex_lock(&d->lock);
+                        size_t left = d->tail - d->head;
+                        pthread_mutex_unlock(&d->lock);
+                        if (left > most) {
+                                most = left;
+                                victim = v;
+                        }
+                }
+                if (victim == id) return 0;
+
+                /* the victim may have drained meanwhile; then look again */
+                Deque *d = &b->deques[victim];
+                size_t begin = 0u, end = 0u;
+                pthread_mutex_lock(&d->lock);
+                if (d->head < d->tail) {
+                        end = d->tail;
+                        begin = d->tail - (d->tail - d->head + 1u) / 2u;
+                        d->tail = begin;
+                }
+                pthread_mutex_unlock(&d->lock);
+                if (begin == end) continue;
+
+                /* the victim's lock is not held here, so two thieves never wait
+                 * on each other */
+                Deque *own = &b->deques[id];
+                pthread_mutex_lock(&own->lock);
+                own->head = begin;
+                own->tail = end;
+                pthread_mutex_unlock(&own->lock);
+                ++b->stats[id].steals;
+                return 1;
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  finish_jobs
+ *  Description:  Account for finished jobs, waking asw_batch_run once the batch is
+ *                complete (lock held)
+ * =====================================================================================
+ */
+static void finish_jobs(ASW_Batch *b, size_t done, size_t failed)
+{
+        b->n_failed += failed;
+        b->n_done += done;
+        if (b->n_done == b->n_jobs && b->active == 0u) {
+                pthread_cond_signal(&b->done_cv);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  worker_setup
+ *  Description:  Bind the calling worker and allocate its workspace on its node,
+ *                then report to asw_batch_new. Returns the workspace (NULL on
+ *                failure).
+ * =====================================================================================
+ */
+static Alignment_ASW* worker_setup(ASW_Batch *b, unsigned int id)
+{
+        const ASW_BatchOptions *opt = &b->opt;
+        int node = b->topo != NULL ? asw_topology_bind(b->topo, opt->affinity, id) : -1;
+
+        pthread_mutex_lock(&b->lock);
+        b->nodes[id] = node;
+        /* models are indexed like the nodes of the topology */
+        unsigned int m = b->n_models > 1u && node >= 0 ?
+                         asw_topology_worker_node(b->topo, id) : 0u;
+        if (b->models[m] == NULL) {
+                b->models[m] = asw_model_new(opt->match, opt->mismatch,
+                                             opt->gap_open_extend, opt->gap_extend);
+        }
+        ASW_Model *model = b->models[m];
+        pthread_mutex_unlock(&b->lock);
+
+        Alignment_ASW *al = model != NULL ? asw_workspace_new(model) : NULL;
+        if (al != NULL) asw_set_phoffset(al, opt->phred_offset);
+
+        pthread_mutex_lock(&b->lock);
+        b->workspaces[id] = al;
+        if (al == NULL) b->setup_failed = 1;
+        ++b->ready;
+        pthread_cond_signal(&b->done_cv);
+        pthread_mutex_unlock(&b->lock);
+        return al;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  worker_main
+ *  Description:  Wait for batches and take jobs until none are left
+ * =====================================================================================
+ */
+static void* worker_main(void *arg)
+{
+        ASW_Batch *b = ((WorkerArg*)arg)->batch;
+        unsigned int id = ((WorkerArg*)arg)->id;
+        ASW_WorkerStats *st = &b->stats[id];
+        free(arg);
+
+        /* without a workspace, only wait for asw_batch_new to shut the pool down */
+        Alignment_ASW *al = worker_setup(b, id);
+
+        unsigned long seen = 0ul;
+        pthread_mutex_lock(&b->lock);
+        for (;;) {
+                while (!b->shutdown && b->generation == seen) {
+                        pthread_cond_wait(&b->work_cv, &b->lock);
+                }
+                if (b->shutdown) break;
+                seen = b->generation;
+                ++b->active;
+
+                const ASW_Job *jobs = b->jobs;
+                ASW_Result *results = b->results;
+
+                if (b->stealing) {
+                        pthread_mutex_unlock(&b->lock);
+                        size_t i, next;
+                        for (;;) {
+                                if (!take_own(b, id, &i, &next)) {
+                                        if (steal(b, id)) continue;
+                                        break;
+                                }
+                                double t0 = now_sec();
+                                int failed = run_job(al, &jobs[i], &results[i],
+                                                     next != SIZE_MAX ? &jobs[next] : NULL) != 0;
+                                st->busy_sec += now_sec() - t0;
+                                st->cells += asw_job_cost(&jobs[i]);
+                                ++st->jobs;
+
+                                pthread_mutex_lock(&b->lock);
+                                finish_jobs(b, 1u, (size_t)failed);
+                                pthread_mutex_unlock(&b->lock);
+                        }
+                        pthread_mutex_lock(&b->lock);
+                } else {
+                        while (b->next < b->n_jobs) {
+                                size_t begin = b->next,
+                                       end = begin + b->chunk < b->n_jobs ? begin + b->chunk : b->n_jobs;
+                                b->next = end;
+                                pthread_mutex_unlock(&b->lock);
+
+                                size_t i, failed;
+                                double t0 = now_sec();
+                                failed = asw_run_jobs(al, &jobs[begin], &results[begin], end - begin);
+                                for (i = begin; i < end; ++i) {
+                                        st->cells += asw_job_cost(&jobs[i]);
+                                }
+                                st->busy_sec += now_sec() - t0;
+                                st->jobs += end - begin;
+
+                                pthread_mutex_lock(&b->lock);
+                                finish_jobs(b, end - begin, failed);
+                        }
+                }
+                --b->active;
+                finish_jobs(b, 0u, 0u);
+        }
+        pthread_mutex_unlock(&b->lock);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  compare_cost
+ *  Description:  qsort comparator: decreasing cost, then increasing index
+ * =====================================================================================
+ */
+static int compare_cost(const void *a, const void *b)
+{
+        const CostedJob *x = (const CostedJob*)a,
+                        *y = (const CostedJob*)b;
+        if (x->cost != y->cost) return x->cost < y->cost ? 1 : -1;
+        return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  deal_jobs
+ *  Description:  Sort jobs by decreasing cost and deal them round-robin into the
+ *                deques; returns -1 if the buffers cannot be grown
+ * =====================================================================================
+ */
+static int deal_jobs(ASW_Batch *b, const ASW_Job *jobs, size_t n)
+{
+        if (n > b->order_cap) {
+                size_t *order = (size_t*)realloc(b->order, sizeof(size_t) * n);
+                if (order == NULL) return -1;
+                b->order = order;
+                CostedJob *costed = (CostedJob*)realloc(b->costed, sizeof(CostedJob) * n);
+                if (costed == NULL) return -1;
+                b->costed = costed;
+                b->order_cap = n;
+        }
+        size_t i;
+        for (i = 0u; i < n; ++i) {
+                b->costed[i].cost = asw_job_cost(&jobs[i]);
+                b->costed[i].index = i;
+        }
+        qsort(b->costed, n, sizeof(CostedJob), compare_cost);
+
+        /* deque w holds every nthreads-th job starting from the w-th largest */
+        unsigned int w, t = b->nthreads;
+        size_t pos = 0u;
+        for (w = 0u; w < t; ++w) {
+                Deque *d = &b->deques[w];
+                d->head = pos;
+                for (i = w; i < n; i += t) {
+                        b->order[pos++] = b->costed[i].index;
+                }
+                d->tail = pos;
+        }
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_options_init
+ *  Description:  Fill ASW_BatchOptions with defaults
+ * =====================================================================================
+ */
+void asw_batch_options_init(ASW_BatchOptions *opt)
+{
+        opt->nthreads = 0u;
+        opt->chunk = 0u;
+        opt->schedule = ASW_SCHEDULE_STEAL;
+        opt->match = -10;
+        opt->mismatch = 30;
+        opt->gap_open_extend = 50;
+        opt->gap_extend = 20;
+        opt->phred_offset = 33;
+        opt->affinity = ASW_AFFINITY_NONE;
+        opt->replicate_model = 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_new
+ *  Description:  Start a pool of worker threads with one workspace each
+ * =====================================================================================
+ */
+ASW_Batch* asw_batch_new(const ASW_BatchOptions *opt)
+{
+        unsigned int nthreads = opt->nthreads;
+        if (nthreads == 0u) {
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                nthreads = ncpu > 0 ? (unsigned int)ncpu : 1u;
+        }
+
+        ASW_Batch *b = (ASW_Batch*)calloc(1u, sizeof(ASW_Batch));
+        if (b == NULL) return NULL;
+        b->chunk = opt->chunk > 0u ? opt->chunk : DEFAULT_CHUNK;
+        b->schedule = opt->schedule;
+        b->opt = *opt;
+        pthread_mutex_init(&b->lock, NULL);
+        pthread_cond_init(&b->work_cv, NULL);
+        pthread_cond_init(&b->done_cv, NULL);
+
+        unsigned int i;
+        if ((b->threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t))) == NULL)
+                goto error;
+        if ((b->workspaces = (Alignment_ASW**)calloc(nthreads, sizeof(Alignment_ASW*))) == NULL)
+                goto error;
+        if ((b->nodes = (int*)calloc(nthreads, sizeof(int))) == NULL)
+                goto error;
+        if ((b->stats = (ASW_WorkerStats*)calloc(nthreads, sizeof(ASW_WorkerStats))) == NULL)
+                goto error;
+        if ((b->deques = (Deque*)calloc(nthreads, sizeof(Deque))) == NULL)
+                goto error;
+        for (i = 0u; i < nthreads; ++i) {
+                pthread_mutex_init(&b->deques[i].lock, NULL);
+        }
+
+        if (opt->affinity != ASW_AFFINITY_NONE) {
+                if ((b->topo = asw_topology_load()) == NULL) goto error;
+        }
+        /* workspaces share one scoring model, or one per node if replicated
+         * (only bound workers know their node) */
+        b->n_models = b->topo != NULL && opt->replicate_model ?
+                      asw_topology_nodes(b->topo) : 1u;
+        if ((b->models = (ASW_Model**)calloc(b->n_models, sizeof(ASW_Model*))) == NULL)
+                goto error;
+
+        for (i = 0u; i < nthreads; ++i) {
+                WorkerArg *arg = (WorkerArg*)malloc(sizeof(WorkerArg));
+                if (arg == NULL) goto error;
+                arg->batch = b;
+                arg->id = i;
+                if (pthread_create(&b->threads[i], NULL, worker_main, arg) != 0) {
+                        free(arg);
+                        goto error;
+                }
+                /* count started threads so that asw_batch_free joins only those */
+                b->nthreads = i + 1u;
+        }
+        pthread_mutex_lock(&b->lock);
+        while (b->ready < nthreads) {
+                pthread_cond_wait(&b->done_cv, &b->lock);
+        }
+        int failed = b->setup_failed;
+        pthread_mutex_unlock(&b->lock);
+        if (failed) goto error;
+        return b;
+error:
+        /* asw_batch_free takes care of what belongs to started threads */
+        for (i = b->nthreads; i < nthreads; ++i) {
+                if (b->deques != NULL) pthread_mutex_destroy(&b->deques[i].lock);
+        }
+        asw_batch_free(b);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_run
+ *  Description:  Perform n jobs on the pool, storing outcomes in input order
+ * =====================================================================================
+ */
+int asw_batch_run(ASW_Batch *b, const ASW_Job *jobs, ASW_Result *results, size_t n)
+{
+        if (n == 0u) return 0;
+
+        pthread_mutex_lock(&b->lock);
+        /* no worker is active between batches, so the deques and statistics can
+         * be set up here */
+        memset(b->stats, 0, sizeof(ASW_WorkerStats) * b->nthreads);
+        /* fall back to chunks if the sorting buffers cannot be grown */
+        b->stealing = b->schedule == ASW_SCHEDULE_STEAL && deal_jobs(b, jobs, n) == 0;
+        b->jobs = jobs;
+        b->results = results;
+        b->n_jobs = n;
+        b->next = 0u;
+        b->n_done = 0u;
+        b->n_failed = 0u;
+        ++b->generation;
+        double t0 = now_sec();
+        pthread_cond_broadcast(&b->work_cv);
+        /* also wait for workers still looking for jobs, which may be reading
+         * the deques */
+        while (b->n_done < n || b->active > 0u) {
+                pthread_cond_wait(&b->done_cv, &b->lock);
+        }
+        double wall = now_sec() - t0;
+        unsigned int i;
+        for (i = 0u; i < b->nthreads; ++i) {
+                b->stats[i].idle_sec = wall - b->stats[i].busy_sec;
+        }
+        size_t failed = b->n_failed;
+        b->jobs = NULL;
+        b->results = NULL;
+        b->n_jobs = 0u;
+        b->next = 0u;
+        pthread_mutex_unlock(&b->lock);
+        return failed == 0u ? 0 : -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_nthreads
+ *  Description:  Number of worker threads of the pool
+ * =====================================================================================
+ */
+unsigned int asw_batch_nthreads(const ASW_Batch *b)
+{
+        return b->nthreads;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_stats
+ *  Description:  Copy per-worker statistics of the last batch
+ * =====================================================================================
+ */
+void asw_batch_stats(ASW_Batch *b, ASW_WorkerStats *stats)
+{
+        pthread_mutex_lock(&b->lock);
+        memcpy(stats, b->stats, sizeof(ASW_WorkerStats) * b->nthreads);
+        unsigned int i;
+        for (i = 0u; i < b->nthreads; ++i) {
+                stats[i].node = b->nodes[i];
+        }
+        pthread_mutex_unlock(&b->lock);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_free
+ *  Description:  Stop the worker threads and free the pool
+ * =====================================================================================
+ */
+void asw_batch_free(ASW_Batch *b)
+{
+        if (b == NULL) return;
+
+        pthread_mutex_lock(&b->lock);
+        b->shutdown = 1;
+        pthread_cond_broadcast(&b->work_cv);
+        pthread_mutex_unlock(&b->lock);
+
+        unsigned int i;
+        for (i = 0u; i < b->nthreads; ++i) {
+                pthread_join(b->threads[i], NULL);
+                asw_free(b->workspaces[i]);
+                pthread_mutex_destroy(&b->deques[i].lock);
+        }
+        if (b->models != NULL) {
+                for (i = 0u; i < b->n_models; ++i) {
+                        asw_model_release(b->models[i]);
+                }
+        }
+        asw_topology_free(b->topo);
+        pthread_cond_destroy(&b->done_cv);
+        pthread_cond_destroy(&b->work_cv);
+        pthread_mutex_destroy(&b->lock);
+        free(b->order);
+        free(b->costed);
+        free(b->deques);
+        free(b->stats);
+        free(b->models);
+        free(b->nodes);
+        free(b->workspaces);
+        free(b->threads);
+        free(b);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_result_clear
+ *  Description:  Free CIGAR and MD buffers of n results
+ * =====================================================================================
+ */
+void asw_result_clear(ASW_Result *results, size_t n)
+{
+        size_t i;
+        for (i = 0u; i < n; ++i) {
+                free(results[i].cigar);
+                free(results[i].md);
+                results[i].cigar = NULL;
+                results[i].n_cigar = 0u;
+                results[i].md = NULL;
+        }
+}
@@ -0,0 +1,190 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_batch.h
+ *
+ *    Description:  Batch alignment on a pool of worker threads, each owning a
+ *                  warm Alignment_ASW workspace
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef ASW_BATCH_H
+#define ASW_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "align454.h"
+#include "asw_affinity.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One alignment to perform: arguments of asw_align_full */
+typedef struct {
+        const char *db;
+        size_t db_len;
+        const char *query;
+        const uint8_t *qual;
+        size_t query_len;
+        uint32_t clip_head;
+        uint32_t clip_tail;
+        unsigned int flags;     /* ASW_ALIGN_SEMI, ASW_TRACE_* and ASW_JOB_* options */
+} ASW_Job;
+
+/* Skip the traceback: the result has score and end column only (offset 0, no
+ * CIGAR, NM or MD) */
+#define ASW_JOB_SCORE_ONLY  0x10000u
+
+/* Outcome of an ASW_Job, stored at the same index as the job */
+typedef struct {
+        int status;             /* 0 on success, -1 on failure */
+        int score;              /* minimum score */
+        size_t offset;          /* position in reference where the alignment starts */
+        size_t end_col;         /* column of the minimum score (alignment end) */
+        uint32_t nm;            /* edit distance */
+        cigar_t *cigar;         /* n_cigar operations (malloc'd, see asw_result_clear) */
+        size_t n_cigar;
+        char *md;               /* MD tag if requested with ASW_TRACE_MD, else NULL */
+} ASW_Result;
+
+/* Scheduling of the jobs of a batch (ASW_BatchOptions.schedule) */
+#define ASW_SCHEDULE_CHUNKED  0  /* chunks of consecutive jobs in input order */
+#define ASW_SCHEDULE_STEAL    1  /* largest first, per-worker deques with stealing */
+
+typedef struct {
+        unsigned int nthreads;  /* worker threads; 0: number of online processors */
+        size_t chunk;           /* jobs handed to a worker at a time with
+                                 * ASW_SCHEDULE_CHUNKED; 0: default */
+        int schedule;           /* ASW_SCHEDULE_* */
+        int match,              /* penalty scores as in asw_init */
+            mismatch,
+            gap_open_extend,
+            gap_extend;
+        int phred_offset;       /* as in asw_set_phoffset */
+        int affinity;           /* ASW_AFFINITY_* placement of the workers */
+        int replicate_model;    /* nonzero: one copy of the scoring model per NUMA
+                                 * node the workers are bound to */
+} ASW_BatchOptions;
+
+/* What a worker did during a batch */
+typedef struct {
+        size_t jobs;            /* jobs performed */
+        size_t steals;          /* times it took jobs from another worker */
+        uint64_t cells;         /* total estimated cost of its jobs (asw_job_cost) */
+        double busy_sec;        /* time spent aligning */
+        double idle_sec;        /* rest of the wall time of the batch */
+        int node;               /* NUMA node the worker is bound to (operating system
+                                 * number, asw_topology_node_id), -1 if unbound */
+} ASW_WorkerStats;
+
+typedef struct ASW_Batch ASW_Batch;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_options_init
+ *  Description:  Fill ASW_BatchOptions with defaults (automatic thread count and
+ *                chunk size, ASW_SCHEDULE_STEAL, the default penalties of the
+ *                Python module, Sanger PHRED offset, unbound workers sharing one
+ *                model)
+ * =====================================================================================
+ */
+void asw_batch_options_init(ASW_BatchOptions *opt);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_new
+ *  Description:  Start a pool of worker threads with one workspace each. Every
+ *                worker binds itself as requested before allocating its workspace,
+ *                so that the workspace lives on the worker's NUMA node. Returns
+ *                NULL on failure.
+ * =====================================================================================
+ */
+ASW_Batch* asw_batch_new(const ASW_BatchOptions *opt);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_run
+ *  Description:  Perform n jobs on the pool and store their outcomes in results
+ *                (in input order), blocking until all are done. Only one batch
+ *                may run on a pool at a time. Returns 0 if all jobs succeeded,
+ *                -1 otherwise (see ASW_Result.status).
+ * =====================================================================================
+ */
+int asw_batch_run(ASW_Batch *batch, const ASW_Job *jobs, ASW_Result *results, size_t n);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_nthreads
+ *  Description:  Number of worker threads of the pool
+ * =====================================================================================
+ */
+unsigned int asw_batch_nthreads(const ASW_Batch *batch);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_stats
+ *  Description:  Copy statistics of the last batch into stats, which must have room
+ *                for asw_batch_nthreads entries
+ * =====================================================================================
+ */
+void asw_batch_stats(ASW_Batch *batch, ASW_WorkerStats *stats);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_job_cost
+ *  Description:  Estimated cost of a job: the number of cells of the alignment
+ *                matrices (aligned part of the query times aligned part of the
+ *                reference)
+ * =====================================================================================
+ */
+uint64_t asw_job_cost(const ASW_Job *job);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_run_job
+ *  Description:  Align one job on the given workspace and fill out its result, as
+ *                the workers of the pool do. Returns result->status.
+ * =====================================================================================
+ */
+int asw_run_job(Alignment_ASW *al, const ASW_Job *job, ASW_Result *result);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_run_jobs
+ *  Description:  Align n jobs one after the other on the given workspace, storing
+ *                outcomes at the same indices in results. The inputs of each next
+ *                job are prefetched while the current one is traced back. Returns
+ *                the number of failed jobs.
+ * =====================================================================================
+ */
+size_t asw_run_jobs(Alignment_ASW *al, const ASW_Job *jobs, ASW_Result *results, size_t n);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_batch_free
+ *  Description:  Stop the worker threads and free the pool
+ * =====================================================================================
+ */
+void asw_batch_free(ASW_Batch *batch);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_result_clear
+ *  Description:  Free CIGAR and MD buffers of n results
+ * =====================================================================================
+ */
+void asw_result_clear(ASW_Result *results, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASW_BATCH_H */
@@ -0,0 +1,371 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_bucket.c
+ *
+ *    Description:  Length-bucketed batching. A group of jobs dispatched to the pool
+ *                  takes as long as its largest job, just like the lanes of an
+ *                  inter-sequence SIMD kernel, so jobs are grouped by the classes
+ *                  of their query and reference lengths (a fixed number of classes
+ *                  per doubling of the length). A group is dispatched as soon as
+ *                  it has one job per lane. Partial groups are dispatched when the
+ *                  reorder window is full (the group holding the oldest job), when
+ *                  their oldest job has waited max_delay_sec, or on flush.
+ *
+ *                  Jobs live in a ring indexed by sequence number until their
+ *                  result has been emitted, so results leave in submission order
+ *                  and the ring size bounds how far the input can be reordered.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "asw_bucket.h"
+
+#define DEFAULT_GROUPS_PER_WINDOW 8u
+#define DEFAULT_CLASSES_PER_OCTAVE 4u
+
+/* A job from submission until its result has been emitted */
+typedef struct {
+        ASW_Job job;
+        ASW_Result result;
+        double arrival;         /* time of asw_bucketer_push */
+        unsigned long key;      /* length class */
+        int done;               /* result is ready */
+} Slot;
+
+/* Pending jobs of one length class */
+typedef struct {
+        unsigned long key;
+        size_t count;
+        size_t *seqs;           /* lanes entries, in submission order */
+} Bucket;
+
+/* Reasons for dispatching a group */
+enum { DISPATCH_FULL, DISPATCH_WINDOW, DISPATCH_TIMED, DISPATCH_FINAL };
+
+struct ASW_Bucketer {
+        ASW_Batch *batch;
+        ASW_EmitFn emit;
+        void *ctx;
+
+        size_t lanes;
+        size_t window;
+        double max_delay_sec;
+        double classes_per_octave;
+
+        Slot *ring;             /* window entries; seq lives in ring[seq % window] */
+        size_t next_seq;        /* sequence number of the next job */
+        size_t emit_seq;        /* sequence number of the next result to emit */
+
+        Bucket *buckets;        /* buckets with pending jobs */
+        size_t n_buckets;
+        size_t *bucket_seqs;    /* storage of Bucket.seqs, lanes per bucket */
+
+        ASW_Job *group_jobs;    /* a group being dispatched, lanes entries each */
+        ASW_Result *group_results;
+
+        ASW_BucketStats stats;
+};
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  now_sec
+ *  Description:  Monotonic wall clock in seconds
+ * =====================================================================================
+ */
+static double now_sec(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  length_class
+ *  Description:  Class of a length: classes_per_octave * log2(len), rounded down
+ * =====================================================================================
+ */
+static unsigned long length_class(const ASW_Bucketer *bk, size_t len)
+{
+        if (len <= 1u) return 0ul;
+        return (unsigned long)(bk->classes_per_octave * log2((double)len));
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  job_key
+ *  Description:  Bucket of a job: length classes of the aligned parts of the query
+ *                and the reference
+ * =====================================================================================
+ */
+static unsigned long job_key(const ASW_Bucketer *bk, const ASW_Job *job)
+{
+        size_t clip = (size_t)job->clip_head + job->clip_tail,
+               query_len = job->query_len > clip ? job->query_len - clip : 0u,
+               db_len = job->db_len > clip ? job->db_len - clip : 0u;
+        return (length_class(bk, query_len) << 16) | length_class(bk, db_len);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  emit_ready
+ *  Description:  Hand out results in submission order as far as they are ready
+ * =====================================================================================
+ */
+static void emit_ready(ASW_Bucketer *bk)
+{
+        while (bk->emit_seq < bk->next_seq) {
+                Slot *slot = &bk->ring[bk->emit_seq % bk->window];
+                if (!slot->done) break;
+                slot->done = 0;
+                bk->emit(bk->ctx, bk->emit_seq, &slot->job, &slot->result);
+                ++bk->emit_seq;
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  dispatch
+ *  Description:  Run the jobs of bucket i as one group on the pool and remove the
+ *                bucket
+ * =====================================================================================
+ */
+static void dispatch(ASW_Bucketer *bk, size_t i, int reason)
+{
+        Bucket *bucket = &bk->buckets[i];
+        size_t k, n = bucket->count;
+        uint64_t largest = 0u;
+        for (k = 0u; k < n; ++k) {
+                const ASW_Job *job = &bk->ring[bucket->seqs[k] % bk->window].job;
+                uint64_t cost = asw_job_cost(job);
+                bk->group_jobs[k] = *job;
+                bk->stats.cells += cost;
+                if (cost > largest) largest = cost;
+        }
+        /* failed jobs are reported through their status */
+        asw_batch_run(bk->batch, bk->group_jobs, bk->group_results, n);
+        for (k = 0u; k < n; ++k) {
+                Slot *slot = &bk->ring[bucket->seqs[k] % bk->window];
+                slot->result = bk->group_results[k];
+                slot->done = 1;
+        }
+
+        bk->stats.jobs += n;
+        ++bk->stats.groups;
+        bk->stats.padded_cells += (uint64_t)bk->lanes * largest;
+        switch (reason) {
+        case DISPATCH_FULL:   ++bk->stats.full_groups; break;
+        case DISPATCH_WINDOW: ++bk->stats.window_flushes; break;
+        case DISPATCH_TIMED:  ++bk->stats.timed_flushes; break;
+        default:              ++bk->stats.final_flushes; break;
+        }
+
+        /* swap with the last bucket, so that every entry keeps storage of its own */
+        size_t last = --bk->n_buckets;
+        if (i != last) {
+                Bucket tmp = *bucket;
+                *bucket = bk->buckets[last];
+                bk->buckets[last] = tmp;
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  find_bucket
+ *  Description:  Index of the bucket with given key, or n_buckets if there is none
+ * =====================================================================================
+ */
+static size_t find_bucket(const ASW_Bucketer *bk, unsigned long key)
+{
+        size_t i;
+        for (i = 0u; i < bk->n_buckets; ++i) {
+                if (bk->buckets[i].key == key) break;
+        }
+        return i;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucket_options_init
+ *  Description:  Fill ASW_BucketOptions with defaults
+ * =====================================================================================
+ */
+void asw_bucket_options_init(ASW_BucketOptions *opt)
+{
+        opt->lanes = 0u;
+        opt->window = 0u;
+        opt->max_delay_sec = 0.0;
+        opt->classes_per_octave = 0u;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_new
+ *  Description:  Create a bucketing stage dispatching to the given pool
+ * =====================================================================================
+ */
+ASW_Bucketer* asw_bucketer_new(ASW_Batch *batch, const ASW_BucketOptions *opt,
+                               ASW_EmitFn emit, void *ctx)
+{
+        ASW_Bucketer *bk = (ASW_Bucketer*)calloc(1u, sizeof(ASW_Bucketer));
+        if (bk == NULL) return NULL;
+
+        bk->batch = batch;
+        bk->emit = emit;
+        bk->ctx = ctx;
+        bk->lanes = opt->lanes > 0u ? opt->lanes : asw_batch_nthreads(batch);
+        bk->window = opt->window > 0u ? opt->window : DEFAULT_GROUPS_PER_WINDOW * bk->lanes;
+        if (bk->window < bk->lanes) bk->window = bk->lanes;
+        bk->max_delay_sec = opt->max_delay_sec;
+        bk->classes_per_octave = opt->classes_per_octave > 0u
+                ? (double)opt->classes_per_octave : (double)DEFAULT_CLASSES_PER_OCTAVE;
+
+        /* every pending job may be in a bucket of its own */
+        if ((bk->ring = (Slot*)calloc(bk->window, sizeof(Slot))) == NULL)
+                goto error;
+        if ((bk->buckets = (Bucket*)calloc(bk->window, sizeof(Bucket))) == NULL)
+                goto error;
+        if ((bk->bucket_seqs = (size_t*)malloc(sizeof(size_t) * bk->window * bk->lanes)) == NULL)
+                goto error;
+        if ((bk->group_jobs = (ASW_Job*)malloc(sizeof(ASW_Job) * bk->lanes)) == NULL)
+                goto error;
+        if ((bk->group_results = (ASW_Result*)malloc(sizeof(ASW_Result) * bk->lanes)) == NULL)
+                goto error;
+        size_t i;
+        for (i = 0u; i < bk->window; ++i) {
+                bk->buckets[i].seqs = bk->bucket_seqs + i * bk->lanes;
+        }
+        return bk;
+error:
+        asw_bucketer_free(bk);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_push
+ *  Description:  Submit a job
+ * =====================================================================================
+ */
+void asw_bucketer_push(ASW_Bucketer *bk, const ASW_Job *job)
+{
+        asw_bucketer_poll(bk);
+
+        if (bk->next_seq - bk->emit_seq == bk->window) {
+                /* the window is full: the oldest job is still pending (results
+                 * are emitted as soon as they can be), so dispatch its group */
+                unsigned long key = bk->ring[bk->emit_seq % bk->window].key;
+                dispatch(bk, find_bucket(bk, key), DISPATCH_WINDOW);
+                emit_ready(bk);
+        }
+
+        size_t seq = bk->next_seq++;
+        Slot *slot = &bk->ring[seq % bk->window];
+        slot->job = *job;
+        slot->arrival = bk->max_delay_sec > 0.0 ? now_sec() : 0.0;
+        slot->key = job_key(bk, job);
+        slot->done = 0;
+        if (bk->next_seq - bk->emit_seq > bk->stats.max_held)
+                bk->stats.max_held = bk->next_seq - bk->emit_seq;
+
+        size_t i = find_bucket(bk, slot->key);
+        if (i == bk->n_buckets) {
+                bk->buckets[i].key = slot->key;
+                bk->buckets[i].count = 0u;
+                ++bk->n_buckets;
+        }
+        Bucket *bucket = &bk->buckets[i];
+        bucket->seqs[bucket->count++] = seq;
+        if (bucket->count == bk->lanes) {
+                dispatch(bk, i, DISPATCH_FULL);
+                emit_ready(bk);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_poll
+ *  Description:  Dispatch partial groups that have waited too long
+ * =====================================================================================
+ */
+void asw_bucketer_poll(ASW_Bucketer *bk)
+{
+        if (bk->max_delay_sec <= 0.0 || bk->n_buckets == 0u) return;
+
+        double now = now_sec();
+        size_t i = 0u;
+        while (i < bk->n_buckets) {
+                const Bucket *bucket = &bk->buckets[i];
+                if (now - bk->ring[bucket->seqs[0] % bk->window].arrival >= bk->max_delay_sec) {
+                        /* the last bucket moves to i */
+                        dispatch(bk, i, DISPATCH_TIMED);
+                } else {
+                        ++i;
+                }
+        }
+        emit_ready(bk);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_flush
+ *  Description:  Dispatch all pending jobs and emit all remaining results
+ * =====================================================================================
+ */
+void asw_bucketer_flush(ASW_Bucketer *bk)
+{
+        /* oldest first, so that results can be emitted as early as possible */
+        while (bk->n_buckets > 0u) {
+                unsigned long key = bk->ring[bk->emit_seq % bk->window].key;
+                dispatch(bk, find_bucket(bk, key), DISPATCH_FINAL);
+                emit_ready(bk);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_stats
+ *  Description:  Copy the counters of a bucketing stage
+ * =====================================================================================
+ */
+void asw_bucketer_stats(const ASW_Bucketer *bk, ASW_BucketStats *stats)
+{
+        *stats = bk->stats;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_free
+ *  Description:  Flush and free a bucketing stage
+ * =====================================================================================
+ */
+void asw_bucketer_free(ASW_Bucketer *bk)
+{
+        if (bk == NULL) return;
+
+        if (bk->ring != NULL && bk->buckets != NULL && bk->bucket_seqs != NULL &&
+            bk->group_jobs != NULL && bk->group_results != NULL)
+        {
+                asw_bucketer_flush(bk);
+        }
+        free(bk->group_results);
+        free(bk->group_jobs);
+        free(bk->bucket_seqs);
+        free(bk->buckets);
+        free(bk->ring);
+        free(bk);
+}
@@ -0,0 +1,128 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_bucket.h
+ *
+ *    Description:  Length-bucketed batching in front of an ASW_Batch pool: jobs are
+ *                  held back in a bounded reorder window, grouped by length class
+ *                  and dispatched one group of similar jobs at a time, while
+ *                  results are handed out in submission order
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef ASW_BUCKET_H
+#define ASW_BUCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asw_batch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+        size_t lanes;           /* jobs per group; 0: threads of the pool */
+        size_t window;          /* jobs held back at most (pending or awaiting
+                                 * output); 0: 8 groups. At least lanes. */
+        double max_delay_sec;   /* dispatch a partial group once its oldest job has
+                                 * waited this long; 0: only when forced */
+        unsigned int classes_per_octave;  /* length classes per doubling of the
+                                           * query or reference length; 0: 4 */
+} ASW_BucketOptions;
+
+/* Counters since asw_bucketer_new. Lane occupancy is jobs / (groups * lanes);
+ * cells / padded_cells is the share of lane time doing useful work when every
+ * lane of a group takes as long as the group's largest job. */
+typedef struct {
+        size_t jobs;            /* jobs dispatched */
+        size_t groups;          /* groups dispatched */
+        size_t full_groups;     /* ... of which had all lanes filled */
+        size_t window_flushes;  /* partial groups forced out by a full window */
+        size_t timed_flushes;   /* partial groups forced out by max_delay_sec */
+        size_t final_flushes;   /* partial groups dispatched by asw_bucketer_flush */
+        uint64_t cells;         /* total asw_job_cost of the jobs */
+        uint64_t padded_cells;  /* sum over groups of lanes * largest asw_job_cost */
+        size_t max_held;        /* largest number of jobs held back */
+} ASW_BucketStats;
+
+/* Receives every result in submission order; seq counts from zero. The
+ * callback owns result (free its buffers with asw_result_clear). */
+typedef void (*ASW_EmitFn)(void *ctx, size_t seq, const ASW_Job *job, ASW_Result *result);
+
+typedef struct ASW_Bucketer ASW_Bucketer;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucket_options_init
+ *  Description:  Fill ASW_BucketOptions with defaults (no time-based flush)
+ * =====================================================================================
+ */
+void asw_bucket_options_init(ASW_BucketOptions *opt);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_new
+ *  Description:  Create a bucketing stage dispatching to the given pool (which must
+ *                outlive it). Returns NULL on failure.
+ * =====================================================================================
+ */
+ASW_Bucketer* asw_bucketer_new(ASW_Batch *batch,
+                               const ASW_BucketOptions *opt,
+                               ASW_EmitFn emit,
+                               void *ctx);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_push
+ *  Description:  Submit a job. The job is copied, but the sequences it points to
+ *                must stay valid until its result is emitted. Dispatches groups and
+ *                emits results as they become ready.
+ * =====================================================================================
+ */
+void asw_bucketer_push(ASW_Bucketer *bk, const ASW_Job *job);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_poll
+ *  Description:  Dispatch partial groups whose oldest job has waited longer than
+ *                max_delay_sec (also done by asw_bucketer_push)
+ * =====================================================================================
+ */
+void asw_bucketer_poll(ASW_Bucketer *bk);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_flush
+ *  Description:  Dispatch all pending jobs and emit all remaining results
+ * =====================================================================================
+ */
+void asw_bucketer_flush(ASW_Bucketer *bk);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_stats
+ *  Description:  Copy the counters of a bucketing stage
+ * =====================================================================================
+ */
+void asw_bucketer_stats(const ASW_Bucketer *bk, ASW_BucketStats *stats);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_bucketer_free
+ *  Description:  Flush and free a bucketing stage
+ * =====================================================================================
+ */
+void asw_bucketer_free(ASW_Bucketer *bk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASW_BUCKET_H */
@@ -0,0 +1,813 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_pipeline.c
+ *
+ *    Description:  Pipelined alignment. A fixed set of batches circulates through
+ *                  three bounded multi-producer/multi-consumer queues:
+ *
+ *                      free  --(reader)-->  filled  --(aligners)-->  aligned
+ *                        ^                                              |
+ *                        +------------------(writer)--------------------+
+ *
+ *                  The reader runs on the caller's thread, the aligners on
+ *                  nthreads threads with a workspace each (sharing one scoring
+ *                  model), the writer on a thread of its own. Aligners finish
+ *                  batches out of order; the writer holds them back by batch
+ *                  number, which needs no more room than the number of batches.
+ *
+ *                  The queues are array-based with a sequence number per cell
+ *                  (after D. Vyukov's bounded MPMC queue): producers and consumers
+ *                  claim cells with one compare-and-swap and never take a lock.
+ *                  Every queue has room for all batches, so pushing never fails;
+ *                  popping from an empty queue backs off by spinning, yielding and
+ *                  finally sleeping. A NULL entry in the filled queue stops one
+ *                  aligner, which passes it on to stop the writer.
+ *
+ *                  Memory is accounted in one counter: the batches themselves and
+ *                  the workspaces when the run starts, the input of a batch when it
+ *                  is read, and the workspace growth and results of a batch before
+ *                  it is aligned (from asw_estimate_bytes, corrected to the actual
+ *                  result sizes afterwards). The writer releases the input and
+ *                  results of every batch it has written. Against a ceiling, the
+ *                  reader and aligners claim their share with a compare-and-swap,
+ *                  and only take a lock to sleep when it does not fit. Batches
+ *                  leave the filled queue in order, so the oldest unwritten batch
+ *                  is always with an aligner or the writer; letting its aligner go
+ *                  over the ceiling is what keeps the pipeline from deadlocking.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "asw_pipeline.h"
+
+#define DEFAULT_BATCH_SIZE 256u
+#define DEFAULT_BATCHES_PER_THREAD 4u
+
+/* keeps the producer and consumer positions of a queue on separate lines */
+#define CACHE_LINE 64
+
+/* Where batches are (ASW_PipelineLevels) */
+enum {
+        LEVEL_FREE,
+        LEVEL_FILLED,
+        LEVEL_ALIGNING,
+        LEVEL_ALIGNED,
+        LEVEL_WRITING,
+        N_LEVELS
+};
+
+struct ASW_PipelineGauges {
+        atomic_size_t used,
+                      peak,
+                      limit;
+        atomic_size_t level[N_LEVELS];
+        atomic_uint reader_blocked,
+                    aligners_blocked;
+};
+
+typedef struct {
+        atomic_size_t seq;
+        ASW_PipeBatch *batch;
+} Cell;
+
+typedef struct {
+        Cell *cells;
+        size_t mask;            /* number of cells minus one (a power of two) */
+        char pad0[CACHE_LINE];
+        atomic_size_t tail;     /* next cell to push to */
+        char pad1[CACHE_LINE];
+        atomic_size_t head;     /* next cell to pop from */
+        char pad2[CACHE_LINE];
+} Queue;
+
+typedef struct {
+        const ASW_PipelineOptions *opt;
+        unsigned int nthreads;
+        Queue free_q,
+              filled_q,
+              aligned_q;
+        ASW_PipeBatch *batches;
+        Alignment_ASW **workspaces;
+        /* statistics of the aligner threads, merged at the end */
+        double *align_sec,
+               *align_wait_sec,
+               *align_memory_sec;
+        size_t *failed;
+        /* batches that reached the writer ahead of their turn, by batch number
+         * modulo depth */
+        ASW_PipeBatch **held;
+        /* statistics of the writer */
+        double write_sec,
+               write_wait_sec;
+        size_t batches_written;
+
+        /* memory accounting */
+        ASW_PipelineGauges *g;  /* the caller's gauges, or own_gauges */
+        ASW_PipelineGauges own_gauges;
+        size_t limit;
+        size_t *charged;        /* input and results of each batch */
+        size_t *ws_bytes;       /* reserved for the workspace of each aligner */
+        atomic_size_t next_write;       /* batch number the writer waits for */
+        atomic_size_t batch_need;       /* most an aligner needed for one batch
+                                         * (workspace and results) */
+        atomic_uint memory_waiters;
+        pthread_mutex_t memory_lock;
+        pthread_cond_t memory_cv;
+} Pipeline;
+
+typedef struct {
+        Pipeline *p;
+        unsigned int id;
+} AlignerArg;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  now_sec
+ *  Description:  Monotonic wall clock in seconds
+ * =====================================================================================
+ */
+static double now_sec(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  gauges_reset
+ *  Description:  Zero the gauges at the start of a run
+ * =====================================================================================
+ */
+static void gauges_reset(ASW_PipelineGauges *g, size_t limit)
+{
+        unsigned int i;
+        atomic_store(&g->used, 0u);
+        atomic_store(&g->peak, 0u);
+        atomic_store(&g->limit, limit);
+        for (i = 0u; i < N_LEVELS; ++i) {
+                atomic_store(&g->level[i], 0u);
+        }
+        atomic_store(&g->reader_blocked, 0u);
+        atomic_store(&g->aligners_blocked, 0u);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  gauges_move
+ *  Description:  Count a batch moving from one stage to the next
+ * =====================================================================================
+ */
+static void gauges_move(ASW_PipelineGauges *g, int from, int to)
+{
+        /* sequentially consistent: the reader decides on the free level whether
+         * it may go over the ceiling */
+        atomic_fetch_sub(&g->level[from], 1u);
+        atomic_fetch_add(&g->level[to], 1u);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  update_peak
+ *  Description:  Raise the peak gauge to used
+ * =====================================================================================
+ */
+static void update_peak(ASW_PipelineGauges *g, size_t used)
+{
+        size_t peak = atomic_load_explicit(&g->peak, memory_order_relaxed);
+        while (used > peak &&
+               !atomic_compare_exchange_weak_explicit(&g->peak, &peak, used,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                ;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  memory_charge
+ *  Description:  Account bytes regardless of the ceiling
+ * =====================================================================================
+ */
+static void memory_charge(Pipeline *p, size_t bytes)
+{
+        update_peak(p->g, atomic_fetch_add(&p->g->used, bytes) + bytes);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  memory_try_charge
+ *  Description:  Account bytes if they fit under the ceiling with slack bytes to
+ *                spare; returns 0 if not
+ * =====================================================================================
+ */
+static int memory_try_charge(Pipeline *p, size_t bytes, size_t slack)
+{
+        size_t used = atomic_load(&p->g->used);
+        do {
+                if (used + bytes + slack > p->limit) return 0;
+        } while (!atomic_compare_exchange_weak(&p->g->used, &used, used + bytes));
+        update_peak(p->g, used + bytes);
+        return 1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  memory_release
+ *  Description:  Give bytes back and wake whoever waits for memory (or for the
+ *                writer to move on, which also calls this)
+ * =====================================================================================
+ */
+static void memory_release(Pipeline *p, size_t bytes)
+{
+        atomic_fetch_sub(&p->g->used, bytes);
+        /* a waiter counts itself before checking the counter under the lock, so
+         * either it sees this release or it is woken here */
+        if (atomic_load(&p->memory_waiters) > 0u) {
+                pthread_mutex_lock(&p->memory_lock);
+                pthread_cond_broadcast(&p->memory_cv);
+                pthread_mutex_unlock(&p->memory_lock);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  memory_reserve
+ *  Description:  Account bytes, waiting while they do not fit under the ceiling.
+ *                The reader (seq SIZE_MAX) leaves room for an aligner to take on
+ *                one more batch, and goes ahead anyway when no batch is in flight;
+ *                an aligner goes ahead when its batch is the next to be written.
+ *                Adds the time spent waiting to *wait_sec.
+ * =====================================================================================
+ */
+static void memory_reserve(Pipeline *p, size_t bytes, size_t seq, double *wait_sec)
+{
+        if (p->limit == 0u) {
+                memory_charge(p, bytes);
+                return;
+        }
+        size_t slack = seq == SIZE_MAX ? atomic_load(&p->batch_need) : 0u;
+        if (memory_try_charge(p, bytes, slack)) return;
+        atomic_uint *blocked = seq == SIZE_MAX ? &p->g->reader_blocked : &p->g->aligners_blocked;
+        double t0 = now_sec();
+        pthread_mutex_lock(&p->memory_lock);
+        atomic_fetch_add(&p->memory_waiters, 1u);
+        atomic_fetch_add(blocked, 1u);
+        for (;;) {
+                if (seq == SIZE_MAX) slack = atomic_load(&p->batch_need);
+                if (memory_try_charge(p, bytes, slack)) break;
+                int exempt = seq == SIZE_MAX ?
+                             atomic_load(&p->g->level[LEVEL_FREE]) == p->opt->depth :
+                             atomic_load(&p->next_write) == seq;
+                if (exempt) {
+                        memory_charge(p, bytes);
+                        break;
+                }
+                pthread_cond_wait(&p->memory_cv, &p->memory_lock);
+        }
+        atomic_fetch_sub(blocked, 1u);
+        atomic_fetch_sub(&p->memory_waiters, 1u);
+        pthread_mutex_unlock(&p->memory_lock);
+        *wait_sec += now_sec() - t0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  job_bytes
+ *  Description:  Workspace bytes a job needs and an upper bound on its results
+ * =====================================================================================
+ */
+static size_t job_bytes(const ASW_Job *job, size_t *results)
+{
+        size_t clip = (size_t)job->clip_head + job->clip_tail;
+        *results = 0u;
+        /* rejected without touching the workspace */
+        if (job->query_len <= clip || job->db_len <= clip) return 0u;
+        unsigned int mode = ASW_FOOTPRINT_TRACE;
+        if (job->flags & ASW_TRACE_MD) mode |= ASW_FOOTPRINT_MD;
+        size_t ws = asw_estimate_bytes(job->db_len - clip, job->query_len - clip, mode);
+        /* the results copy the CIGAR and MD buffers of the workspace */
+        *results = ws - asw_estimate_bytes(job->db_len - clip, job->query_len - clip,
+                                           ASW_FOOTPRINT_SCORE);
+        return ws;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  input_bytes
+ *  Description:  Bytes of the sequences and qualities of a batch
+ * =====================================================================================
+ */
+static size_t input_bytes(const ASW_PipeBatch *batch)
+{
+        size_t bytes = 0u, i;
+        for (i = 0u; i < batch->n; ++i) {
+                const ASW_Job *job = &batch->jobs[i];
+                bytes += job->db_len + job->query_len;
+                if (job->qual != NULL) bytes += job->query_len;
+        }
+        return bytes;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  queue_init
+ *  Description:  Allocate a queue with room for at least n entries
+ * =====================================================================================
+ */
+static int queue_init(Queue *q, size_t n)
+{
+        size_t size = 2u, i;
+        while (size < n) size <<= 1;
+        if ((q->cells = (Cell*)malloc(sizeof(Cell) * size)) == NULL) return -1;
+        for (i = 0u; i < size; ++i) {
+                atomic_init(&q->cells[i].seq, i);
+                q->cells[i].batch = NULL;
+        }
+        q->mask = size - 1u;
+        atomic_init(&q->tail, 0u);
+        atomic_init(&q->head, 0u);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  queue_push
+ *  Description:  Append an entry; the queue has room for all batches, so this
+ *                always succeeds
+ * =====================================================================================
+ */
+static void queue_push(Queue *q, ASW_PipeBatch *batch)
+{
+        size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+                cell = &q->cells[pos & q->mask];
+                size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+                if (dif == 0) {
+                        if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1u,
+                                                                  memory_order_relaxed,
+                                                                  memory_order_relaxed))
+                                break;
+                        /* pos was reloaded by the failed exchange */
+                } else {
+                        /* another producer took the cell */
+                        pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+                }
+        }
+        cell->batch = batch;
+        atomic_store_explicit(&cell->seq, pos + 1u, memory_order_release);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  queue_try_pop
+ *  Description:  Remove the oldest entry; returns 0 if the queue is empty
+ * =====================================================================================
+ */
+static int queue_try_pop(Queue *q, ASW_PipeBatch **batch)
+{
+        size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+                cell = &q->cells[pos & q->mask];
+                size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1u);
+                if (dif == 0) {
+                        if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1u,
+                                                                  memory_order_relaxed,
+                                                                  memory_order_relaxed))
+                                break;
+                } else if (dif < 0) {
+                        return 0;
+                } else {
+                        pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+                }
+        }
+        *batch = cell->batch;
+        atomic_store_explicit(&cell->seq, pos + q->mask + 1u, memory_order_release);
+        return 1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  queue_pop
+ *  Description:  Remove the oldest entry, waiting for one; adds the time spent
+ *                waiting to *wait_sec
+ * =====================================================================================
+ */
+static ASW_PipeBatch* queue_pop(Queue *q, double *wait_sec)
+{
+        ASW_PipeBatch *batch;
+        if (queue_try_pop(q, &batch)) return batch;
+
+        double t0 = now_sec();
+        unsigned int tries;
+        for (tries = 0u; !queue_try_pop(q, &batch); ++tries) {
+                if (tries < 64u) {
+                        continue;
+                } else if (tries < 128u) {
+                        sched_yield();
+                } else {
+                        /* input is slow: do not burn a CPU the aligners could use */
+                        struct timespec ts = {0, 50000};
+                        nanosleep(&ts, NULL);
+                }
+        }
+        *wait_sec += now_sec() - t0;
+        return batch;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  aligner_main
+ *  Description:  Align (and format) filled batches until a NULL entry arrives
+ * =====================================================================================
+ */
+static void* aligner_main(void *arg)
+{
+        Pipeline *p = ((AlignerArg*)arg)->p;
+        unsigned int id = ((AlignerArg*)arg)->id;
+        Alignment_ASW *al = p->workspaces[id];
+        const ASW_PipelineOptions *opt = p->opt;
+        free(arg);
+
+        ASW_PipeBatch *batch;
+        while ((batch = queue_pop(&p->filled_q, &p->align_wait_sec[id])) != NULL) {
+                gauges_move(p->g, LEVEL_FILLED, LEVEL_ALIGNING);
+
+                /* the workspace grows to fit the largest job of the batch and ends
+                 * up at the size of the last one */
+                size_t largest = 0u, last = 0u, bound = 0u, i;
+                for (i = 0u; i < batch->n; ++i) {
+                        size_t results;
+                        last = job_bytes(&batch->jobs[i], &results);
+                        if (last > largest) largest = last;
+                        bound += results;
+                }
+                size_t need = largest + bound,
+                       most = atomic_load(&p->batch_need);
+                while (need > most && !atomic_compare_exchange_weak(&p->batch_need, &most, need))
+                        ;
+                size_t grow = largest > p->ws_bytes[id] ? largest - p->ws_bytes[id] : 0u;
+                memory_reserve(p, grow + bound, batch->seq, &p->align_memory_sec[id]);
+                p->ws_bytes[id] += grow;
+
+                double t0 = now_sec();
+                p->failed[id] += asw_run_jobs(al, batch->jobs, batch->results, batch->n);
+                if (opt->format != NULL) opt->format(opt->ctx, batch);
+                p->align_sec[id] += now_sec() - t0;
+
+                size_t actual = 0u;
+                for (i = 0u; i < batch->n; ++i) {
+                        const ASW_Result *res = &batch->results[i];
+                        actual += sizeof(cigar_t) * res->n_cigar;
+                        if (res->md != NULL) actual += strlen(res->md) + 1u;
+                }
+                if (actual > bound) memory_charge(p, actual - bound);
+                size_t unused = bound > actual ? bound - actual : 0u;
+                if (p->ws_bytes[id] > last) {
+                        unused += p->ws_bytes[id] - last;
+                        p->ws_bytes[id] = last;
+                }
+                if (unused > 0u) memory_release(p, unused);
+                p->charged[batch - p->batches] += actual;
+
+                gauges_move(p->g, LEVEL_ALIGNING, LEVEL_ALIGNED);
+                queue_push(&p->aligned_q, batch);
+        }
+        /* tell the writer that this aligner is done */
+        queue_push(&p->aligned_q, NULL);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  writer_main
+ *  Description:  Write aligned batches in order and recycle them, until all
+ *                aligners are done
+ * =====================================================================================
+ */
+static void* writer_main(void *arg)
+{
+        Pipeline *p = (Pipeline*)arg;
+        const ASW_PipelineOptions *opt = p->opt;
+        size_t depth = opt->depth;
+        ASW_PipeBatch **held = p->held;
+        size_t next = 0u;
+        unsigned int running = p->nthreads;
+        while (running > 0u) {
+                ASW_PipeBatch *batch = queue_pop(&p->aligned_q, &p->write_wait_sec);
+                if (batch == NULL) {
+                        --running;
+                        continue;
+                }
+                held[batch->seq % depth] = batch;
+                while ((batch = held[next % depth]) != NULL && batch->seq == next) {
+                        held[next % depth] = NULL;
+                        gauges_move(p->g, LEVEL_ALIGNED, LEVEL_WRITING);
+                        double t0 = now_sec();
+                        opt->write(opt->ctx, batch);
+                        p->write_sec += now_sec() - t0;
+                        asw_result_clear(batch->results, batch->n);
+                        ++p->batches_written;
+                        ++next;
+                        /* an aligner waiting on the next batch, or the reader
+                         * waiting for all batches to come back, may now go ahead:
+                         * update both before waking them */
+                        atomic_store(&p->next_write, next);
+                        gauges_move(p->g, LEVEL_WRITING, LEVEL_FREE);
+                        size_t *charged = &p->charged[batch - p->batches];
+                        memory_release(p, *charged);
+                        *charged = 0u;
+                        queue_push(&p->free_q, batch);
+                }
+        }
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_options_init
+ *  Description:  Fill ASW_PipelineOptions with defaults
+ * =====================================================================================
+ */
+void asw_pipeline_options_init(ASW_PipelineOptions *opt)
+{
+        opt->nthreads = 0u;
+        opt->batch_size = 0u;
+        opt->depth = 0u;
+        opt->match = -10;
+        opt->mismatch = 30;
+        opt->gap_open_extend = 50;
+        opt->gap_extend = 20;
+        opt->phred_offset = 33;
+        opt->memory_limit = 0u;
+        opt->gauges = NULL;
+        opt->read = NULL;
+        opt->format = NULL;
+        opt->write = NULL;
+        opt->release = NULL;
+        opt->ctx = NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_run
+ *  Description:  Run the pipeline until the read callback ends the input
+ * =====================================================================================
+ */
+int asw_pipeline_run(const ASW_PipelineOptions *user_opt, ASW_PipelineStats *stats)
+{
+        ASW_PipelineOptions opt = *user_opt;
+        if (opt.nthreads == 0u) {
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                opt.nthreads = ncpu > 0 ? (unsigned int)ncpu : 1u;
+        }
+        if (opt.batch_size == 0u) opt.batch_size = DEFAULT_BATCH_SIZE;
+        if (opt.depth == 0u) opt.depth = DEFAULT_BATCHES_PER_THREAD * opt.nthreads;
+        /* room for every aligner's NULL entry next to all batches */
+        size_t queue_len = opt.depth + opt.nthreads;
+
+        Pipeline p;
+        memset(&p, 0, sizeof(Pipeline));
+        p.opt = &opt;
+        p.g = opt.gauges != NULL ? opt.gauges : &p.own_gauges;
+        p.limit = opt.memory_limit;
+        gauges_reset(p.g, p.limit);
+        atomic_init(&p.next_write, 0u);
+        atomic_init(&p.batch_need, 0u);
+        atomic_init(&p.memory_waiters, 0u);
+        pthread_mutex_init(&p.memory_lock, NULL);
+        pthread_cond_init(&p.memory_cv, NULL);
+
+        ASW_PipeBatch *batches = NULL;
+        pthread_t *threads = NULL, writer;
+        int writer_started = 0, status = -1;
+        unsigned int i, started = 0u;
+        size_t b, n_batches = 0u, n_records = 0u;
+        double t_start = 0.0, read_sec = 0.0, read_wait_sec = 0.0, read_memory_sec = 0.0;
+        size_t last_input = 0u;
+
+        if (queue_init(&p.free_q, queue_len) != 0 ||
+            queue_init(&p.filled_q, queue_len) != 0 ||
+            queue_init(&p.aligned_q, queue_len) != 0)
+                goto cleanup;
+        if ((batches = (ASW_PipeBatch*)calloc(opt.depth, sizeof(ASW_PipeBatch))) == NULL)
+                goto cleanup;
+        p.batches = batches;
+        for (b = 0u; b < opt.depth; ++b) {
+                batches[b].cap = opt.batch_size;
+                if ((batches[b].jobs = (ASW_Job*)malloc(sizeof(ASW_Job) * opt.batch_size)) == NULL)
+                        goto cleanup;
+                if ((batches[b].results = (ASW_Result*)calloc(opt.batch_size, sizeof(ASW_Result))) == NULL)
+                        goto cleanup;
+                queue_push(&p.free_q, &batches[b]);
+        }
+        atomic_store(&p.g->level[LEVEL_FREE], opt.depth);
+        if ((threads = (pthread_t*)calloc(opt.nthreads, sizeof(pthread_t))) == NULL)
+                goto cleanup;
+        if ((p.workspaces = (Alignment_ASW**)calloc(opt.nthreads, sizeof(Alignment_ASW*))) == NULL)
+                goto cleanup;
+        if ((p.align_sec = (double*)calloc(opt.nthreads, sizeof(double))) == NULL)
+                goto cleanup;
+        if ((p.align_wait_sec = (double*)calloc(opt.nthreads, sizeof(double))) == NULL)
+                goto cleanup;
+        if ((p.align_memory_sec = (double*)calloc(opt.nthreads, sizeof(double))) == NULL)
+                goto cleanup;
+        if ((p.ws_bytes = (size_t*)calloc(opt.nthreads, sizeof(size_t))) == NULL)
+                goto cleanup;
+        if ((p.charged = (size_t*)calloc(opt.depth, sizeof(size_t))) == NULL)
+                goto cleanup;
+        if ((p.failed = (size_t*)calloc(opt.nthreads, sizeof(size_t))) == NULL)
+                goto cleanup;
+        if ((p.held = (ASW_PipeBatch**)calloc(opt.depth, sizeof(ASW_PipeBatch*))) == NULL)
+                goto cleanup;
+
+        /* all workspaces share one scoring model */
+        ASW_Model *model = asw_model_new(opt.match, opt.mismatch,
+                                         opt.gap_open_extend, opt.gap_extend);
+        if (model == NULL) goto cleanup;
+        for (i = 0u; i < opt.nthreads; ++i) {
+                if ((p.workspaces[i] = asw_workspace_new(model)) == NULL) break;
+                asw_set_phoffset(p.workspaces[i], opt.phred_offset);
+        }
+        asw_model_release(model);
+        if (i < opt.nthreads) goto cleanup;
+
+        /* what stays allocated for the whole run (the shared model is counted
+         * once per workspace, which is close enough) */
+        memory_charge(&p, opt.depth * (sizeof(ASW_PipeBatch) + sizeof(ASW_PipeBatch*) + sizeof(size_t) +
+                                       opt.batch_size * (sizeof(ASW_Job) + sizeof(ASW_Result))) +
+                          (p.free_q.mask + p.filled_q.mask + p.aligned_q.mask + 3u) * sizeof(Cell) +
+                          opt.nthreads * asw_estimate_bytes(0u, 0u, ASW_FOOTPRINT_SCORE));
+
+        /* the writer counts NULL entries of started aligners only */
+        p.nthreads = 0u;
+        for (started = 0u; started < opt.nthreads; ++started) {
+                AlignerArg *arg = (AlignerArg*)malloc(sizeof(AlignerArg));
+                if (arg == NULL) break;
+                arg->p = &p;
+                arg->id = started;
+                if (pthread_create(&threads[started], NULL, aligner_main, arg) != 0) {
+                        free(arg);
+                        break;
+                }
+        }
+        p.nthreads = started;
+        if (started == 0u || pthread_create(&writer, NULL, writer_main, &p) != 0) {
+                /* stop the aligners that did start */
+                for (i = 0u; i < started; ++i) {
+                        queue_push(&p.filled_q, NULL);
+                }
+                goto join;
+        }
+        writer_started = 1;
+        status = 0;
+
+        /* reader stage */
+        t_start = now_sec();
+        for (;;) {
+                ASW_PipeBatch *batch = queue_pop(&p.free_q, &read_wait_sec);
+                /* expect as much input as in the last batch */
+                memory_reserve(&p, last_input, SIZE_MAX, &read_memory_sec);
+                double t0 = now_sec();
+                batch->n = opt.read(opt.ctx, batch);
+                read_sec += now_sec() - t0;
+                if (batch->n == 0u) {
+                        /* the batch is simply not used again */
+                        memory_release(&p, last_input);
+                        break;
+                }
+                if (batch->n > batch->cap) batch->n = batch->cap;
+                size_t input = input_bytes(batch);
+                if (input > last_input) memory_charge(&p, input - last_input);
+                else memory_release(&p, last_input - input);
+                p.charged[batch - batches] = input;
+                last_input = input;
+                batch->seq = n_batches++;
+                n_records += batch->n;
+                gauges_move(p.g, LEVEL_FREE, LEVEL_FILLED);
+                queue_push(&p.filled_q, batch);
+        }
+        for (i = 0u; i < started; ++i) {
+                queue_push(&p.filled_q, NULL);
+        }
+join:
+        for (i = 0u; i < started; ++i) {
+                pthread_join(threads[i], NULL);
+        }
+        if (writer_started) {
+                pthread_join(writer, NULL);
+                if (stats != NULL) {
+                        memset(stats, 0, sizeof(ASW_PipelineStats));
+                        stats->wall_sec = now_sec() - t_start;
+                        stats->batches = n_batches;
+                        stats->records = n_records;
+                        stats->read_sec = read_sec;
+                        stats->read_wait_sec = read_wait_sec;
+                        for (i = 0u; i < started; ++i) {
+                                stats->align_sec += p.align_sec[i];
+                                stats->align_wait_sec += p.align_wait_sec[i];
+                                stats->failed += p.failed[i];
+                        }
+                        stats->write_sec = p.write_sec;
+                        stats->write_wait_sec = p.write_wait_sec;
+                        stats->read_memory_sec = read_memory_sec;
+                        for (i = 0u; i < started; ++i) {
+                                stats->align_memory_sec += p.align_memory_sec[i];
+                        }
+                        stats->peak_bytes = atomic_load(&p.g->peak);
+                }
+        }
+cleanup:
+        if (p.workspaces != NULL) {
+                for (i = 0u; i < opt.nthreads; ++i) {
+                        asw_free(p.workspaces[i]);
+                }
+        }
+        if (batches != NULL) {
+                for (b = 0u; b < opt.depth; ++b) {
+                        if (opt.release != NULL) opt.release(opt.ctx, &batches[b]);
+                        free(batches[b].jobs);
+                        free(batches[b].results);
+                }
+        }
+        free(p.charged);
+        free(p.ws_bytes);
+        free(p.align_memory_sec);
+        free(p.held);
+        free(p.failed);
+        free(p.align_wait_sec);
+        free(p.align_sec);
+        free(p.workspaces);
+        free(threads);
+        free(batches);
+        free(p.aligned_q.cells);
+        free(p.filled_q.cells);
+        free(p.free_q.cells);
+        pthread_cond_destroy(&p.memory_cv);
+        pthread_mutex_destroy(&p.memory_lock);
+        return status;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_gauges_new
+ *  Description:  Allocate gauges
+ * =====================================================================================
+ */
+ASW_PipelineGauges* asw_pipeline_gauges_new(void)
+{
+        ASW_PipelineGauges *g = (ASW_PipelineGauges*)malloc(sizeof(ASW_PipelineGauges));
+        if (g != NULL) gauges_reset(g, 0u);
+        return g;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_gauges_read
+ *  Description:  Take a snapshot of the gauges
+ * =====================================================================================
+ */
+void asw_pipeline_gauges_read(ASW_PipelineGauges *g, ASW_PipelineLevels *levels)
+{
+        levels->memory_used = atomic_load(&g->used);
+        levels->memory_peak = atomic_load(&g->peak);
+        levels->memory_limit = atomic_load(&g->limit);
+        levels->free = atomic_load(&g->level[LEVEL_FREE]);
+        levels->filled = atomic_load(&g->level[LEVEL_FILLED]);
+        levels->aligning = atomic_load(&g->level[LEVEL_ALIGNING]);
+        levels->aligned = atomic_load(&g->level[LEVEL_ALIGNED]);
+        levels->writing = atomic_load(&g->level[LEVEL_WRITING]);
+        levels->reader_blocked = atomic_load(&g->reader_blocked);
+        levels->aligners_blocked = atomic_load(&g->aligners_blocked);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_gauges_free
+ *  Description:  Free gauges
+ * =====================================================================================
+ */
+void asw_pipeline_gauges_free(ASW_PipelineGauges *g)
+{
+        free(g);
+}
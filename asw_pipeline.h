@@ -0,0 +1,172 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_pipeline.h
+ *
+ *    Description:  Pipelined alignment: reading, aligning (and formatting) and
+ *                  writing run as separate stages on their own threads, connected
+ *                  by lock-free bounded queues carrying batches of records, within
+ *                  an optional ceiling on the memory they hold
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef ASW_PIPELINE_H
+#define ASW_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asw_batch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A batch of records travelling through the pipeline. Batches are recycled:
+ * user stays with a batch from one round to the next. */
+typedef struct {
+        size_t seq;             /* batch number, counting from zero */
+        size_t n;               /* records in the batch */
+        size_t cap;             /* room for records (ASW_PipelineOptions.batch_size) */
+        ASW_Job *jobs;          /* cap jobs, filled by the read callback */
+        ASW_Result *results;    /* cap results, filled by the aligner stage */
+        void *user;             /* storage of the callbacks, e.g. sequence buffers */
+} ASW_PipeBatch;
+
+/* Fill batch->jobs and return the number of records (at most batch->cap);
+ * 0 ends the input. Called on the thread of asw_pipeline_run. */
+typedef size_t (*ASW_ReadFn)(void *ctx, ASW_PipeBatch *batch);
+
+/* Callbacks taking a whole batch: format runs on the aligner threads (so it
+ * must be thread-safe), write and release on one thread each */
+typedef void (*ASW_PipeFn)(void *ctx, ASW_PipeBatch *batch);
+
+/* Live fill levels of a running pipeline, shared with other threads */
+typedef struct ASW_PipelineGauges ASW_PipelineGauges;
+
+typedef struct {
+        unsigned int nthreads;  /* aligner threads; 0: number of online processors */
+        size_t batch_size;      /* records per batch; 0: 256 */
+        size_t depth;           /* batches in flight; 0: 4 per aligner thread */
+        int match,              /* penalty scores as in asw_init */
+            mismatch,
+            gap_open_extend,
+            gap_extend;
+        int phred_offset;       /* as in asw_set_phoffset */
+        size_t memory_limit;    /* ceiling in bytes on batches, input, workspaces and
+                                 * results in flight; 0: none */
+        ASW_PipelineGauges *gauges; /* optional: updated while running */
+
+        ASW_ReadFn read;        /* required */
+        ASW_PipeFn format;      /* optional: after alignment, e.g. CIGAR strings */
+        ASW_PipeFn write;       /* required: receives batches in order; results are
+                                 * cleared once it returns */
+        ASW_PipeFn release;     /* optional: free batch->user at the end */
+        void *ctx;              /* passed to the callbacks */
+} ASW_PipelineOptions;
+
+/* Time each stage spent working and waiting for its input queue */
+typedef struct {
+        size_t batches;
+        size_t records;
+        size_t failed;          /* records with nonzero result status */
+        double read_sec,        /* in the read callback */
+               read_wait_sec;   /* waiting for a free batch */
+        double align_sec,       /* aligning and formatting, summed over threads */
+               align_wait_sec;  /* waiting for a filled batch, summed over threads */
+        double write_sec,       /* in the write callback */
+               write_wait_sec;  /* waiting for the next batch in order */
+        double read_memory_sec, /* reader paused at the memory ceiling */
+               align_memory_sec;/* aligners blocked at the memory ceiling, summed */
+        size_t peak_bytes;      /* most memory accounted at a time */
+        double wall_sec;
+} ASW_PipelineStats;
+
+/* Snapshot of ASW_PipelineGauges. Batches are counted where they are: waiting
+ * for the reader, queued for or being aligned, or queued for, held back by or
+ * being written by the writer. */
+typedef struct {
+        size_t memory_used;     /* bytes accounted now */
+        size_t memory_peak;
+        size_t memory_limit;    /* 0: none */
+        size_t free,
+               filled,
+               aligning,
+               aligned,
+               writing;
+        unsigned int reader_blocked;    /* 1 while the reader waits for memory */
+        unsigned int aligners_blocked;  /* aligners waiting for memory */
+} ASW_PipelineLevels;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_options_init
+ *  Description:  Fill ASW_PipelineOptions with defaults (no callbacks, automatic
+ *                thread count, batch size and depth, the default penalties of the
+ *                Python module, Sanger PHRED offset)
+ * =====================================================================================
+ */
+void asw_pipeline_options_init(ASW_PipelineOptions *opt);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_run
+ *  Description:  Run the pipeline until the read callback ends the input, reading
+ *                on the calling thread. Fills stats if not NULL. Returns 0, or -1 if
+ *                the pipeline could not be set up (nothing is read then).
+ *
+ *                With a memory limit, the growth of a workspace and the results of
+ *                a batch (bounded from the job lengths with asw_estimate_bytes)
+ *                are reserved before they are allocated. The input of a batch (its
+ *                sequences and qualities) cannot be known before it is read: the
+ *                reader reserves as much as the previous batch took, and after the
+ *                read charges or releases the difference, so a batch larger than
+ *                the one before it goes over the reservation. The reader pauses
+ *                and aligners block until enough is released by the writer; the
+ *                aligner holding the oldest unwritten batch never blocks, so the
+ *                pipeline keeps moving with a limit below what one batch needs.
+ *                Memory can therefore go over the limit by about one batch (its
+ *                input, or the workspace growth and results of an aligner), plus
+ *                the growth of input from one batch to the next.
+ * =====================================================================================
+ */
+int asw_pipeline_run(const ASW_PipelineOptions *opt, ASW_PipelineStats *stats);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_gauges_new
+ *  Description:  Allocate gauges to pass in ASW_PipelineOptions.gauges. They are
+ *                reset when a run starts and keep their last levels after it ends.
+ *                Returns NULL on allocation failure.
+ * =====================================================================================
+ */
+ASW_PipelineGauges* asw_pipeline_gauges_new(void);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_gauges_read
+ *  Description:  Take a snapshot of the gauges; may be called from any thread while
+ *                the pipeline runs (the levels are read one by one, so their sum
+ *                can be off by the batches moving meanwhile)
+ * =====================================================================================
+ */
+void asw_pipeline_gauges_read(ASW_PipelineGauges *gauges, ASW_PipelineLevels *levels);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_pipeline_gauges_free
+ *  Description:  Free gauges (not while a pipeline is using them)
+ * =====================================================================================
+ */
+void asw_pipeline_gauges_free(ASW_PipelineGauges *gauges);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASW_PIPELINE_H */
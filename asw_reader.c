@@ -0,0 +1,974 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_reader.c
+ *
+ *    Description:  FASTQ/FASTA reader. The input is read in large chunks into a
+ *                  fixed set of buffers (slots), several chunks at a time: with
+ *                  io_uring, all free slots are submitted at once as reads into
+ *                  registered buffers; otherwise a pool of threads calls pread on
+ *                  them (or read, in order, on pipes). Chunks are parsed in input
+ *                  order, in place: records point into the slot buffer, and the
+ *                  slot is handed to the caller as a block until released.
+ *
+ *                  A record cut off at the end of a chunk is copied aside and,
+ *                  when the next chunk arrives, put in front of it in the headroom
+ *                  left before every buffer, so that it is contiguous with its
+ *                  rest. Records longer than the headroom (e.g. whole chromosomes
+ *                  in FASTA) are collected in a heap buffer instead, which then
+ *                  belongs to the block they are parsed into.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+#include "asw_reader.h"
+
+#define DEFAULT_CHUNK_SIZE ((size_t)1u << 20u)
+#define DEFAULT_DEPTH 8u
+#define DEFAULT_THREADS 4u
+
+/* alignment of chunk buffers, and room in front of each one for the part of a
+ * record carried over from the previous chunk */
+#define PAGE 4096u
+#define HEADROOM ((size_t)64u << 10u)
+
+/* States of a slot */
+enum {
+        SLOT_FREE,              /* may be given the next chunk */
+        SLOT_QUEUED,            /* waiting for a pread thread */
+        SLOT_READING,           /* read in progress */
+        SLOT_READY,             /* chunk read (or failed), not yet parsed */
+        SLOT_HELD               /* parsed, records in use by the caller */
+};
+
+typedef struct {
+        ASW_RecordBlock block;  /* first member: blocks handed out are slots */
+        char *buf;              /* HEADROOM bytes, then the chunk */
+        size_t seq;             /* chunk number */
+        size_t len;             /* bytes of the chunk read */
+        int state;
+        int error;              /* errno of a failed read */
+        ASW_Record *records;
+        size_t records_cap;
+        char *spill;            /* heap buffer of a long carried record, or NULL */
+} Slot;
+
+#ifdef HAVE_URING
+typedef struct {
+        int fd;
+        int fixed;              /* buffers registered: IORING_OP_READ_FIXED */
+        unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+        unsigned int *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_sqe *sqes;
+        struct io_uring_cqe *cqes;
+        void *sq_ptr, *cq_ptr;
+        size_t sq_len, cq_len, sqes_len;
+        unsigned int to_submit; /* queued entries not yet passed to the kernel */
+        unsigned int in_flight; /* reads submitted and not yet completed */
+} Uring;
+#endif
+
+struct ASW_Reader {
+        int fd;
+        int close_fd;
+        int engine;
+        int seekable;
+        off_t file_size;        /* -1 unless a regular file */
+        size_t chunk_size;
+        unsigned int depth;
+        Slot *slots;
+        char *arena;            /* buffers of all slots */
+
+        /* chunk numbers, guarded by lock */
+        size_t next_read;       /* next chunk to read */
+        size_t end_chunk;       /* no chunk at or past this one has data */
+        size_t next_parse;      /* next chunk to parse */
+
+        /* parser state, used by the thread calling asw_reader_next */
+        size_t n_blocks;
+        char *carry;            /* incomplete record at the end of the last chunk */
+        size_t carry_len,
+               carry_cap;
+        size_t scanned;         /* bytes of the carried FASTA record known not to
+                                 * contain its end */
+        int format;
+        int error;
+        int done;
+
+        pthread_mutex_t lock;
+        pthread_cond_t cv;      /* slot state changes */
+        pthread_t *threads;     /* ASW_READER_PREAD */
+        unsigned int nthreads;
+        int shutdown;
+#ifdef HAVE_URING
+        Uring ring;
+#endif
+};
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  mark_short_read
+ *  Description:  A chunk came back shorter than chunk_size: nothing lies beyond it
+ *                (lock held)
+ * =====================================================================================
+ */
+static void mark_short_read(ASW_Reader *r, const Slot *s)
+{
+        if (s->len < r->chunk_size && s->seq + 1u < r->end_chunk) {
+                r->end_chunk = s->seq + 1u;
+        }
+}
+
+#ifdef HAVE_URING
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  uring_can_read
+ *  Description:  Whether the ring supports IORING_OP_READ (Linux 5.6). Older kernels
+ *                set up rings but know neither the opcode nor how to probe for it.
+ * =====================================================================================
+ */
+static int uring_can_read(int fd)
+{
+        size_t size = sizeof(struct io_uring_probe) +
+                      256u * sizeof(struct io_uring_probe_op);
+        struct io_uring_probe *probe = (struct io_uring_probe*)calloc(1u, size);
+        if (probe == NULL) return 0;
+        int ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256u) == 0 &&
+                 probe->last_op >= IORING_OP_READ &&
+                 (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+        free(probe);
+        return ok;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  uring_init
+ *  Description:  Set up an io_uring with one entry per slot and register the slot
+ *                buffers (reads go to unregistered buffers if that is not allowed,
+ *                e.g. over RLIMIT_MEMLOCK, and the kernel can read into them).
+ *                Returns -1 if io_uring is unavailable.
+ * =====================================================================================
+ */
+static int uring_init(ASW_Reader *r)
+{
+        Uring *u = &r->ring;
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        u->fd = (int)syscall(__NR_io_uring_setup, r->depth, &p);
+        if (u->fd < 0) return -1;
+
+        u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+        u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                if (u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+                u->cq_len = u->sq_len;
+        }
+        u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         u->fd, IORING_OFF_SQ_RING);
+        if (u->sq_ptr == MAP_FAILED) goto error;
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                u->cq_ptr = u->sq_ptr;
+        } else {
+                u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 u->fd, IORING_OFF_CQ_RING);
+                if (u->cq_ptr == MAP_FAILED) goto error;
+        }
+        u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+        u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+        if (u->sqes == MAP_FAILED) goto error;
+
+        char *sq = (char*)u->sq_ptr,
+             *cq = (char*)u->cq_ptr;
+        u->sq_head = (unsigned int*)(sq + p.sq_off.head);
+        u->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+        u->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+        u->sq_array = (unsigned int*)(sq + p.sq_off.array);
+        u->cq_head = (unsigned int*)(cq + p.cq_off.head);
+        u->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+        u->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+        u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+        struct iovec *iov = (struct iovec*)malloc(sizeof(struct iovec) * r->depth);
+        if (iov == NULL) goto error;
+        unsigned int i;
+        for (i = 0u; i < r->depth; ++i) {
+                iov[i].iov_base = r->slots[i].buf + HEADROOM;
+                iov[i].iov_len = r->chunk_size;
+        }
+        u->fixed = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS,
+                           iov, r->depth) == 0;
+        free(iov);
+        if (!u->fixed && !uring_can_read(u->fd)) goto error;
+        return 0;
+error:
+        if (u->sqes != NULL && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_len);
+        if (u->cq_ptr != NULL && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr)
+                munmap(u->cq_ptr, u->cq_len);
+        if (u->sq_ptr != NULL && u->sq_ptr != MAP_FAILED) munmap(u->sq_ptr, u->sq_len);
+        close(u->fd);
+        memset(u, 0, sizeof(Uring));
+        return -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  uring_queue
+ *  Description:  Queue a read of the rest of a slot's chunk
+ * =====================================================================================
+ */
+static void uring_queue(ASW_Reader *r, unsigned int index)
+{
+        Uring *u = &r->ring;
+        Slot *s = &r->slots[index];
+        unsigned int tail = *u->sq_tail,
+                     entry = tail & *u->sq_mask;
+        struct io_uring_sqe *sqe = &u->sqes[entry];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        sqe->opcode = u->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = r->fd;
+        sqe->addr = (uint64_t)(uintptr_t)(s->buf + HEADROOM + s->len);
+        sqe->len = (uint32_t)(r->chunk_size - s->len);
+        sqe->off = (uint64_t)s->seq * r->chunk_size + s->len;
+        if (u->fixed) sqe->buf_index = (uint16_t)index;
+        sqe->user_data = index;
+        u->sq_array[entry] = entry;
+        __atomic_store_n(u->sq_tail, tail + 1u, __ATOMIC_RELEASE);
+        ++u->to_submit;
+        ++u->in_flight;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  uring_enter
+ *  Description:  Pass queued entries to the kernel and, if wait is set, block until
+ *                a completion is available. Returns 0 or an errno.
+ * =====================================================================================
+ */
+static int uring_enter(ASW_Reader *r, int wait)
+{
+        Uring *u = &r->ring;
+        while (u->to_submit > 0u || wait) {
+                long n = syscall(__NR_io_uring_enter, u->fd, u->to_submit, wait ? 1u : 0u,
+                                 wait ? IORING_ENTER_GETEVENTS : 0u, NULL, 0);
+                if (n < 0) {
+                        if (errno == EINTR) continue;
+                        return errno;
+                }
+                u->to_submit -= (unsigned int)n;
+                wait = 0;
+        }
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  uring_reap
+ *  Description:  Apply available completions to their slots, resubmitting short
+ *                reads before the end of the file (lock held)
+ * =====================================================================================
+ */
+static void uring_reap(ASW_Reader *r)
+{
+        Uring *u = &r->ring;
+        unsigned int head = *u->cq_head,
+                     tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+                const struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+                unsigned int index = (unsigned int)cqe->user_data;
+                Slot *s = &r->slots[index];
+                --u->in_flight;
+                if (s->state != SLOT_READING) continue;
+                if (cqe->res < 0) {
+                        if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+                                uring_queue(r, index);
+                                continue;
+                        }
+                        s->error = -cqe->res;
+                        s->state = SLOT_READY;
+                        continue;
+                }
+                s->len += (size_t)cqe->res;
+                off_t end = (off_t)(s->seq * r->chunk_size + s->len);
+                if (cqe->res > 0 && s->len < r->chunk_size && end < r->file_size) {
+                        uring_queue(r, index);
+                        continue;
+                }
+                mark_short_read(r, s);
+                s->state = SLOT_READY;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  uring_free
+ *  Description:  Wait for reads still in flight, then tear the ring down
+ * =====================================================================================
+ */
+static void uring_free(ASW_Reader *r)
+{
+        Uring *u = &r->ring;
+        while (u->in_flight > 0u) {
+                if (uring_enter(r, 1) != 0) break;
+                pthread_mutex_lock(&r->lock);
+                uring_reap(r);
+                pthread_mutex_unlock(&r->lock);
+        }
+        munmap(u->sqes, u->sqes_len);
+        if (u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+        munmap(u->sq_ptr, u->sq_len);
+        close(u->fd);
+}
+#endif
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  read_chunk
+ *  Description:  Fill a slot's chunk with pread (read on pipes), stopping early
+ *                only at the end of the input
+ * =====================================================================================
+ */
+static void read_chunk(ASW_Reader *r, Slot *s)
+{
+        char *dst = s->buf + HEADROOM;
+        off_t offset = (off_t)(s->seq * r->chunk_size);
+        while (s->len < r->chunk_size) {
+                ssize_t n = r->seekable ?
+                            pread(r->fd, dst + s->len, r->chunk_size - s->len, offset + (off_t)s->len) :
+                            read(r->fd, dst + s->len, r->chunk_size - s->len);
+                if (n < 0) {
+                        if (errno == EINTR) continue;
+                        s->error = errno;
+                        break;
+                }
+                if (n == 0) break;
+                s->len += (size_t)n;
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pread_main
+ *  Description:  Read queued chunks, lowest chunk number first (which keeps the
+ *                single thread used on pipes in order)
+ * =====================================================================================
+ */
+static void* pread_main(void *arg)
+{
+        ASW_Reader *r = (ASW_Reader*)arg;
+        pthread_mutex_lock(&r->lock);
+        for (;;) {
+                Slot *s = NULL;
+                unsigned int i;
+                for (i = 0u; i < r->depth; ++i) {
+                        Slot *t = &r->slots[i];
+                        if (t->state == SLOT_QUEUED && (s == NULL || t->seq < s->seq)) s = t;
+                }
+                if (r->shutdown) break;
+                if (s == NULL) {
+                        pthread_cond_wait(&r->cv, &r->lock);
+                        continue;
+                }
+                s->state = SLOT_READING;
+                pthread_mutex_unlock(&r->lock);
+                read_chunk(r, s);
+                pthread_mutex_lock(&r->lock);
+                if (s->error == 0) mark_short_read(r, s);
+                s->state = SLOT_READY;
+                pthread_cond_broadcast(&r->cv);
+        }
+        pthread_mutex_unlock(&r->lock);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  submit_free
+ *  Description:  Start reading the next chunks into all free slots (lock held)
+ * =====================================================================================
+ */
+static int submit_free(ASW_Reader *r)
+{
+        unsigned int i, queued = 0u;
+        for (i = 0u; i < r->depth && r->next_read < r->end_chunk; ++i) {
+                Slot *s = &r->slots[i];
+                if (s->state != SLOT_FREE) continue;
+                s->seq = r->next_read++;
+                s->len = 0u;
+                s->error = 0;
+#ifdef HAVE_URING
+                if (r->engine == ASW_READER_URING) {
+                        s->state = SLOT_READING;
+                        uring_queue(r, i);
+                        ++queued;
+                        continue;
+                }
+#endif
+                s->state = SLOT_QUEUED;
+                ++queued;
+        }
+        if (queued == 0u) return 0;
+#ifdef HAVE_URING
+        if (r->engine == ASW_READER_URING) return uring_enter(r, 0);
+#endif
+        pthread_cond_broadcast(&r->cv);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  wait_chunk
+ *  Description:  Wait until the next chunk to parse has been read and take its
+ *                slot; NULL if there is none or io_uring failed
+ * =====================================================================================
+ */
+static Slot* wait_chunk(ASW_Reader *r)
+{
+        pthread_mutex_lock(&r->lock);
+        for (;;) {
+                int err = submit_free(r);
+                if (err != 0) {
+                        r->error = err;
+                        break;
+                }
+                Slot *s = NULL;
+                unsigned int i;
+                for (i = 0u; i < r->depth; ++i) {
+                        if (r->slots[i].state != SLOT_FREE && r->slots[i].state != SLOT_HELD &&
+                            r->slots[i].seq == r->next_parse) {
+                                s = &r->slots[i];
+                                break;
+                        }
+                }
+                if (s == NULL && r->next_parse >= r->end_chunk) break;
+                if (s != NULL && s->state == SLOT_READY) {
+                        s->state = SLOT_HELD;
+                        pthread_mutex_unlock(&r->lock);
+                        return s;
+                }
+#ifdef HAVE_URING
+                if (s != NULL && r->engine == ASW_READER_URING) {
+                        pthread_mutex_unlock(&r->lock);
+                        err = uring_enter(r, 1);
+                        pthread_mutex_lock(&r->lock);
+                        if (err != 0) {
+                                r->error = err;
+                                break;
+                        }
+                        uring_reap(r);
+                        continue;
+                }
+#endif
+                /* a pread thread is on it, or all slots are held by the caller */
+                pthread_cond_wait(&r->cv, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  release_slot
+ *  Description:  Make a slot free for the next chunk
+ * =====================================================================================
+ */
+static void release_slot(ASW_Reader *r, Slot *s)
+{
+        free(s->spill);
+        s->spill = NULL;
+        s->block.records = NULL;
+        s->block.n = 0u;
+        pthread_mutex_lock(&r->lock);
+        s->state = SLOT_FREE;
+        pthread_cond_broadcast(&r->cv);
+        pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  add_record
+ *  Description:  Append a record to the block of a slot; returns ENOMEM on failure
+ * =====================================================================================
+ */
+static int add_record(Slot *s, const char *header, size_t header_len,
+                      const char *seq, const char *qual, size_t len)
+{
+        if (s->block.n == s->records_cap) {
+                size_t cap = s->records_cap > 0u ? 2u * s->records_cap : 1024u;
+                ASW_Record *records = (ASW_Record*)realloc(s->records, sizeof(ASW_Record) * cap);
+                if (records == NULL) return ENOMEM;
+                s->records = records;
+                s->records_cap = cap;
+        }
+        ASW_Record *rec = &s->records[s->block.n++];
+        size_t name_len = 0u;
+        while (name_len < header_len && header[name_len] != ' ' && header[name_len] != '\t')
+                ++name_len;
+        rec->name = header;
+        rec->name_len = name_len;
+        rec->seq = seq;
+        rec->qual = (const uint8_t*)qual;
+        rec->len = len;
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  line_end
+ *  Description:  Index of the newline ending the line that starts at pos; len if
+ *                the input ends without one, or SIZE_MAX if the line may go on in
+ *                the next chunk
+ * =====================================================================================
+ */
+static size_t line_end(const char *buf, size_t pos, size_t len, int at_eof)
+{
+        const char *nl = (const char*)memchr(buf + pos, '\n', len - pos);
+        if (nl != NULL) return (size_t)(nl - buf);
+        return at_eof ? len : SIZE_MAX;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  trim_cr
+ *  Description:  End of a line without a trailing carriage return
+ * =====================================================================================
+ */
+static size_t trim_cr(const char *buf, size_t begin, size_t end)
+{
+        return end > begin && buf[end - 1u] == '\r' ? end - 1u : end;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  parse_fastq
+ *  Description:  Add the complete FASTQ records of buf to the block; *used is set
+ *                to the start of the first incomplete one. Returns 0, ENOMEM or
+ *                ASW_READER_EFORMAT.
+ * =====================================================================================
+ */
+static int parse_fastq(Slot *s, char *buf, size_t len, int at_eof, size_t *used)
+{
+        size_t pos = 0u;
+        for (;;) {
+                while (pos < len && (buf[pos] == '\n' || buf[pos] == '\r')) ++pos;
+                *used = pos;
+                if (pos == len) return 0;
+                if (buf[pos] != '@') return ASW_READER_EFORMAT;
+
+                /* header, sequence, separator and quality lines */
+                size_t begin[4], end[4], p = pos;
+                int k;
+                for (k = 0; k < 4; ++k) {
+                        if (p >= len) return at_eof ? ASW_READER_EFORMAT : 0;
+                        size_t e = line_end(buf, p, len, at_eof);
+                        if (e == SIZE_MAX) return 0;
+                        begin[k] = p;
+                        end[k] = trim_cr(buf, p, e);
+                        p = e + 1u;
+                }
+                size_t seq_len = end[1] - begin[1];
+                if (buf[begin[2]] != '+' || end[3] - begin[3] != seq_len)
+                        return ASW_READER_EFORMAT;
+                int err = add_record(s, buf + begin[0] + 1u, end[0] - begin[0] - 1u,
+                                     buf + begin[1], buf + begin[3], seq_len);
+                if (err != 0) return err;
+                pos = p < len ? p : len;
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  parse_fasta
+ *  Description:  Add the complete FASTA records of buf to the block, joining
+ *                sequence lines in place; *used is set to the start of the first
+ *                incomplete one. A record ends where a line starts with '>', so the
+ *                search for the end of a long record resumes past *scanned.
+ * =====================================================================================
+ */
+static int parse_fasta(Slot *s, char *buf, size_t len, int at_eof, size_t *used,
+                       size_t *scanned)
+{
+        size_t pos = 0u;
+        for (;;) {
+                while (pos < len && (buf[pos] == '\n' || buf[pos] == '\r')) ++pos;
+                *used = pos;
+                if (pos == len) return 0;
+                if (buf[pos] != '>') return ASW_READER_EFORMAT;
+
+                size_t header_end = line_end(buf, pos, len, at_eof);
+                if (header_end == SIZE_MAX) return 0;
+                size_t from = header_end;
+                if (pos == 0u && *scanned > from) from = *scanned;
+                size_t end = len;
+                for (;;) {
+                        const char *nl = from < len ?
+                                         (const char*)memchr(buf + from, '\n', len - from) : NULL;
+                        if (nl == NULL || (size_t)(nl - buf) + 1u == len) {
+                                if (at_eof) break;
+                                /* the next line may or may not start a record */
+                                *scanned = len - pos - 1u;
+                                return 0;
+                        }
+                        from = (size_t)(nl - buf) + 1u;
+                        if (buf[from] == '>') {
+                                end = from;
+                                break;
+                        }
+                }
+                *scanned = 0u;
+
+                size_t seq_begin = header_end < len ? header_end + 1u : len,
+                       w = seq_begin, i;
+                for (i = seq_begin; i < end; ++i) {
+                        if (buf[i] != '\n' && buf[i] != '\r') buf[w++] = buf[i];
+                }
+                size_t header_len = trim_cr(buf, pos, header_end) - pos - 1u;
+                int err = add_record(s, buf + pos + 1u, header_len, buf + seq_begin, NULL,
+                                     w - seq_begin);
+                if (err != 0) return err;
+                pos = end;
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  keep_carry
+ *  Description:  Copy the incomplete record at the end of a chunk aside
+ * =====================================================================================
+ */
+static int keep_carry(ASW_Reader *r, const char *data, size_t len)
+{
+        if (len > r->carry_cap) {
+                size_t cap = 2u * len;
+                char *carry = (char*)realloc(r->carry, cap);
+                if (carry == NULL) return ENOMEM;
+                r->carry = carry;
+                r->carry_cap = cap;
+        }
+        memmove(r->carry, data, len);
+        r->carry_len = len;
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  parse_chunk
+ *  Description:  Parse a chunk together with the record carried over from the
+ *                previous one into the block of its slot. Returns 0, an errno or
+ *                ASW_READER_EFORMAT.
+ * =====================================================================================
+ */
+static int parse_chunk(ASW_Reader *r, Slot *s, int at_eof)
+{
+        char *data = s->buf + HEADROOM, *start;
+        size_t total;
+        int spilled = 0, err;
+
+        s->block.n = 0u;
+        if (r->carry_len == 0u) {
+                start = data;
+                total = s->len;
+        } else if (r->carry_len <= HEADROOM) {
+                start = data - r->carry_len;
+                memcpy(start, r->carry, r->carry_len);
+                total = r->carry_len + s->len;
+        } else {
+                /* long record: keep collecting it in the carry buffer */
+                total = r->carry_len + s->len;
+                if (total > r->carry_cap) {
+                        size_t cap = 2u * total;
+                        char *carry = (char*)realloc(r->carry, cap);
+                        if (carry == NULL) return ENOMEM;
+                        r->carry = carry;
+                        r->carry_cap = cap;
+                }
+                memcpy(r->carry + r->carry_len, data, s->len);
+                start = r->carry;
+                spilled = 1;
+        }
+        r->carry_len = 0u;
+
+        if (r->format == 0) {
+                size_t i = 0u;
+                while (i < total && (start[i] == '\n' || start[i] == '\r')) ++i;
+                if (i < total) {
+                        if (start[i] == '@') r->format = ASW_FORMAT_FASTQ;
+                        else if (start[i] == '>') r->format = ASW_FORMAT_FASTA;
+                        else return ASW_READER_EFORMAT;
+                }
+        }
+        size_t used = total;
+        if (r->format == ASW_FORMAT_FASTQ) {
+                err = parse_fastq(s, start, total, at_eof, &used);
+        } else if (r->format == ASW_FORMAT_FASTA) {
+                err = parse_fasta(s, start, total, at_eof, &used, &r->scanned);
+        } else {
+                err = 0;
+        }
+        if (err != 0) return err;
+        if (at_eof) return 0;
+
+        if (spilled && s->block.n > 0u) {
+                /* the records live in the carry buffer: give it to the block */
+                s->spill = r->carry;
+                r->carry = NULL;
+                r->carry_cap = 0u;
+                return keep_carry(r, s->spill + used, total - used);
+        }
+        return keep_carry(r, start + used, total - used);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_options_init
+ *  Description:  Fill ASW_ReaderOptions with defaults
+ * =====================================================================================
+ */
+void asw_reader_options_init(ASW_ReaderOptions *opt)
+{
+        opt->engine = ASW_READER_AUTO;
+        opt->chunk_size = 0u;
+        opt->depth = 0u;
+        opt->nthreads = 0u;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_open
+ *  Description:  Open a FASTQ or FASTA file and start reading ahead
+ * =====================================================================================
+ */
+ASW_Reader* asw_reader_open(const char *path, const ASW_ReaderOptions *opt)
+{
+        ASW_Reader *r = (ASW_Reader*)calloc(1u, sizeof(ASW_Reader));
+        if (r == NULL) return NULL;
+        int err = 0;
+        unsigned int i;
+
+        pthread_mutex_init(&r->lock, NULL);
+        pthread_cond_init(&r->cv, NULL);
+        r->fd = -1;
+        r->chunk_size = opt->chunk_size > 0u ? opt->chunk_size : DEFAULT_CHUNK_SIZE;
+        /* whole pages, so that buffers stay page-aligned */
+        r->chunk_size = (r->chunk_size + PAGE - 1u) / PAGE * PAGE;
+        r->depth = opt->depth > 0u ? opt->depth : DEFAULT_DEPTH;
+        r->end_chunk = SIZE_MAX;
+
+        if (strcmp(path, "-") == 0) {
+                r->fd = STDIN_FILENO;
+        } else {
+                if ((r->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) goto error;
+                r->close_fd = 1;
+        }
+        struct stat st;
+        if (fstat(r->fd, &st) != 0) goto error;
+        r->seekable = S_ISREG(st.st_mode);
+        r->file_size = r->seekable ? st.st_size : -1;
+        if (r->seekable) {
+                /* the chunk at the end of the file is the last one (it comes back
+                 * empty if the size is a multiple of the chunk size) */
+                r->end_chunk = (size_t)r->file_size / r->chunk_size + 1u;
+        }
+
+        if ((r->slots = (Slot*)calloc(r->depth, sizeof(Slot))) == NULL) goto error;
+        if (posix_memalign((void**)&r->arena, PAGE, (HEADROOM + r->chunk_size) * r->depth) != 0) {
+                r->arena = NULL;
+                errno = ENOMEM;
+                goto error;
+        }
+        for (i = 0u; i < r->depth; ++i) {
+                r->slots[i].buf = r->arena + (HEADROOM + r->chunk_size) * i;
+                r->slots[i].state = SLOT_FREE;
+        }
+
+        r->engine = ASW_READER_PREAD;
+        if (opt->engine != ASW_READER_PREAD && r->seekable) {
+#ifdef HAVE_URING
+                if (uring_init(r) == 0) r->engine = ASW_READER_URING;
+#endif
+        }
+        if (opt->engine == ASW_READER_URING && r->engine != ASW_READER_URING) {
+                errno = r->seekable ? ENOSYS : ESPIPE;
+                goto error;
+        }
+        if (r->engine == ASW_READER_PREAD) {
+                unsigned int nthreads = opt->nthreads > 0u ? opt->nthreads : DEFAULT_THREADS;
+                /* read() on a pipe must go in order */
+                if (!r->seekable) nthreads = 1u;
+                if ((r->threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t))) == NULL)
+                        goto error;
+                for (i = 0u; i < nthreads; ++i) {
+                        if ((err = pthread_create(&r->threads[i], NULL, pread_main, r)) != 0) {
+                                errno = err;
+                                goto error;
+                        }
+                        r->nthreads = i + 1u;
+                }
+        }
+
+        pthread_mutex_lock(&r->lock);
+        err = submit_free(r);
+        pthread_mutex_unlock(&r->lock);
+        if (err != 0) {
+                errno = err;
+                goto error;
+        }
+        return r;
+error:
+        err = errno;
+        asw_reader_close(r);
+        errno = err;
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_next
+ *  Description:  Next block of records, in input order
+ * =====================================================================================
+ */
+const ASW_RecordBlock* asw_reader_next(ASW_Reader *r)
+{
+        while (!r->done) {
+                Slot *s = wait_chunk(r);
+                if (s == NULL) {
+                        /* end of input with nothing left over, or io_uring failed */
+                        if (r->error == 0 && r->carry_len > 0u) r->error = ASW_READER_EFORMAT;
+                        r->done = 1;
+                        break;
+                }
+                ++r->next_parse;
+                if (s->error != 0) {
+                        r->error = s->error;
+                        r->done = 1;
+                        release_slot(r, s);
+                        break;
+                }
+                int at_eof = s->len < r->chunk_size;
+                int err = parse_chunk(r, s, at_eof);
+                if (err != 0) {
+                        r->error = err;
+                        r->done = 1;
+                        release_slot(r, s);
+                        break;
+                }
+                if (at_eof) r->done = 1;
+                if (s->block.n > 0u) {
+                        s->block.index = r->n_blocks++;
+                        s->block.records = s->records;
+                        return &s->block;
+                }
+                release_slot(r, s);
+        }
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_release
+ *  Description:  Give the buffer of a block back for reading ahead
+ * =====================================================================================
+ */
+void asw_reader_release(ASW_Reader *r, const ASW_RecordBlock *block)
+{
+        /* the block is the first member of its slot */
+        release_slot(r, (Slot*)block);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_format
+ *  Description:  ASW_FORMAT_* of the input
+ * =====================================================================================
+ */
+int asw_reader_format(const ASW_Reader *r)
+{
+        return r->format;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_engine
+ *  Description:  Engine in use
+ * =====================================================================================
+ */
+int asw_reader_engine(const ASW_Reader *r)
+{
+        return r->engine;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_error
+ *  Description:  0, errno of a failed read, or ASW_READER_EFORMAT
+ * =====================================================================================
+ */
+int asw_reader_error(const ASW_Reader *r)
+{
+        return r->error;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_close
+ *  Description:  Stop reading and free the reader
+ * =====================================================================================
+ */
+void asw_reader_close(ASW_Reader *r)
+{
+        if (r == NULL) return;
+
+        pthread_mutex_lock(&r->lock);
+        r->shutdown = 1;
+        pthread_cond_broadcast(&r->cv);
+        pthread_mutex_unlock(&r->lock);
+        unsigned int i;
+        for (i = 0u; i < r->nthreads; ++i) {
+                pthread_join(r->threads[i], NULL);
+        }
+#ifdef HAVE_URING
+        if (r->engine == ASW_READER_URING) uring_free(r);
+#endif
+        if (r->slots != NULL) {
+                for (i = 0u; i < r->depth; ++i) {
+                        free(r->slots[i].records);
+                        free(r->slots[i].spill);
+                }
+        }
+        if (r->close_fd) close(r->fd);
+        pthread_cond_destroy(&r->cv);
+        pthread_mutex_destroy(&r->lock);
+        free(r->threads);
+        free(r->slots);
+        free(r->arena);
+        free(r->carry);
+        free(r);
+}
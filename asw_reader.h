@@ -0,0 +1,142 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_reader.h
+ *
+ *    Description:  FASTQ/FASTA input with several large reads in flight (io_uring
+ *                  with registered buffers, or a pool of pread threads) and records
+ *                  parsed in place, handed out without copying
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef ASW_READER_H
+#define ASW_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* How chunks are read (ASW_ReaderOptions.engine) */
+#define ASW_READER_AUTO   0     /* io_uring where the kernel allows it, else pread */
+#define ASW_READER_URING  1     /* io_uring only (asw_reader_open fails without it) */
+#define ASW_READER_PREAD  2     /* pool of threads calling pread (read on pipes) */
+
+/* Input formats, detected from the first record */
+#define ASW_FORMAT_FASTQ  1
+#define ASW_FORMAT_FASTA  2
+
+/* asw_reader_error of malformed or truncated input */
+#define ASW_READER_EFORMAT (-1)
+
+typedef struct {
+        int engine;             /* ASW_READER_* */
+        size_t chunk_size;      /* bytes per read; 0: 1 MiB */
+        unsigned int depth;     /* chunk buffers, read ahead or held by the caller;
+                                 * 0: 8 */
+        unsigned int nthreads;  /* threads of ASW_READER_PREAD; 0: 4 */
+} ASW_ReaderOptions;
+
+/* One record, pointing into the reader's buffers. Sequence and qualities can
+ * be used as ASW_Job.query and ASW_Job.qual as they are. */
+typedef struct {
+        const char *name;       /* first word of the header line (not terminated) */
+        size_t name_len;
+        const char *seq;        /* FASTA lines are joined in place */
+        const uint8_t *qual;    /* NULL for FASTA */
+        size_t len;             /* length of seq (and qual) */
+} ASW_Record;
+
+/* Records parsed from one chunk of input, valid until asw_reader_release */
+typedef struct {
+        size_t index;           /* block number, counting from zero */
+        const ASW_Record *records;
+        size_t n;
+} ASW_RecordBlock;
+
+typedef struct ASW_Reader ASW_Reader;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_options_init
+ *  Description:  Fill ASW_ReaderOptions with defaults (ASW_READER_AUTO, 1 MiB
+ *                chunks, 8 buffers, 4 pread threads)
+ * =====================================================================================
+ */
+void asw_reader_options_init(ASW_ReaderOptions *opt);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_open
+ *  Description:  Open a FASTQ or FASTA file ("-" for standard input) and start
+ *                reading ahead. Returns NULL on failure, with errno set.
+ * =====================================================================================
+ */
+ASW_Reader* asw_reader_open(const char *path, const ASW_ReaderOptions *opt);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_next
+ *  Description:  Next block of records, in input order; NULL at the end of the
+ *                input or on error (see asw_reader_error). Every block holds one
+ *                chunk buffer until released, so fewer than depth blocks may be
+ *                held at a time. Called from one thread.
+ * =====================================================================================
+ */
+const ASW_RecordBlock* asw_reader_next(ASW_Reader *reader);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_release
+ *  Description:  Give the buffer of a block back for reading ahead. May be called
+ *                from any thread, in any order.
+ * =====================================================================================
+ */
+void asw_reader_release(ASW_Reader *reader, const ASW_RecordBlock *block);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_format
+ *  Description:  ASW_FORMAT_* of the input (0 before the first block)
+ * =====================================================================================
+ */
+int asw_reader_format(const ASW_Reader *reader);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_engine
+ *  Description:  Engine in use: ASW_READER_URING or ASW_READER_PREAD
+ * =====================================================================================
+ */
+int asw_reader_engine(const ASW_Reader *reader);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_error
+ *  Description:  0 after a clean end of input, else the errno of a failed read or
+ *                ASW_READER_EFORMAT
+ * =====================================================================================
+ */
+int asw_reader_error(const ASW_Reader *reader);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_reader_close
+ *  Description:  Stop reading and free the reader. Blocks still held become
+ *                invalid.
+ * =====================================================================================
+ */
+void asw_reader_close(ASW_Reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASW_READER_H */
@@ -0,0 +1,405 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_stream.c
+ *
+ *    Description:  Streaming parallel alignment. Submitted jobs occupy one of
+ *                  capacity slots from submission until their result has been
+ *                  sunk, which bounds memory: producers wait for a free slot.
+ *                  Workers take slots in submission order from a FIFO, align them
+ *                  on their own workspaces (sharing one scoring model) and mark
+ *                  them done.
+ *
+ *                  In ordered mode the slot of a job is its sequence number modulo
+ *                  capacity, so the slots form a reorder buffer: results are sunk
+ *                  from its head while it is done. In unordered mode slots come
+ *                  from a free list and completed slots are sunk from a second
+ *                  FIFO. Either way, the worker finding results to sink becomes
+ *                  the only one calling the sink until it runs out, so sink calls
+ *                  are serialized without a dedicated thread.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "asw_stream.h"
+
+#define DEFAULT_SLOTS_PER_THREAD 16u
+
+typedef struct {
+        ASW_Job job;
+        ASW_Result result;
+        size_t seq;
+        int done;
+} Slot;
+
+/* FIFO of slot indices with room for all slots */
+typedef struct {
+        size_t *items;
+        size_t head,            /* position of the oldest item */
+               count;
+} SlotQueue;
+
+struct ASW_Stream {
+        pthread_mutex_t lock;
+        pthread_cond_t work_cv;         /* a job was queued, or shutdown */
+        pthread_cond_t space_cv;        /* a slot was freed */
+
+        pthread_t *threads;
+        Alignment_ASW **workspaces;     /* one per worker */
+        unsigned int nthreads;
+
+        ASW_SinkFn sink;
+        void *ctx;
+        int ordered;
+
+        Slot *slots;
+        size_t capacity;
+        SlotQueue pending;              /* submitted, waiting for a worker */
+        SlotQueue completed;            /* unordered mode: done, waiting for the sink */
+        size_t *free_slots;             /* unordered mode: stack of free slots */
+        size_t n_free;
+
+        size_t next_seq;                /* sequence number of the next submission */
+        size_t sink_seq;                /* ordered mode: next sequence number to sink */
+        size_t waiting;                 /* done but not yet sunk */
+        int sinking;                    /* a worker is calling the sink */
+        int shutdown;
+
+        ASW_StreamStats stats;
+};
+
+typedef struct {
+        ASW_Stream *stream;
+        unsigned int id;
+} WorkerArg;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  now_sec
+ *  Description:  Monotonic wall clock in seconds
+ * =====================================================================================
+ */
+static double now_sec(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  queue_push
+ *  Description:  Append a slot index to a FIFO
+ * =====================================================================================
+ */
+static void queue_push(SlotQueue *q, size_t capacity, size_t slot)
+{
+        q->items[(q->head + q->count++) % capacity] = slot;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  queue_pop
+ *  Description:  Remove the oldest slot index from a non-empty FIFO
+ * =====================================================================================
+ */
+static size_t queue_pop(SlotQueue *q, size_t capacity)
+{
+        size_t slot = q->items[q->head];
+        q->head = (q->head + 1u) % capacity;
+        --q->count;
+        return slot;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  next_sinkable
+ *  Description:  Slot whose result may be sunk now, or capacity if there is none
+ *                (lock held)
+ * =====================================================================================
+ */
+static size_t next_sinkable(ASW_Stream *s)
+{
+        if (s->ordered) {
+                size_t slot = s->sink_seq % s->capacity;
+                if (s->sink_seq < s->next_seq && s->slots[slot].done) return slot;
+                return s->capacity;
+        }
+        return s->completed.count > 0u ? queue_pop(&s->completed, s->capacity) : s->capacity;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  drain
+ *  Description:  Sink results for as long as there are any, unless another worker
+ *                is already doing so (lock held; released around sink calls)
+ * =====================================================================================
+ */
+static void drain(ASW_Stream *s)
+{
+        if (s->sinking) return;
+        s->sinking = 1;
+        size_t slot;
+        while ((slot = next_sinkable(s)) < s->capacity) {
+                Slot *sl = &s->slots[slot];
+                /* the sink owns the result once called */
+                int failed = sl->result.status != 0;
+                pthread_mutex_unlock(&s->lock);
+                s->sink(s->ctx, sl->seq, &sl->job, &sl->result);
+                pthread_mutex_lock(&s->lock);
+
+                sl->done = 0;
+                --s->waiting;
+                ++s->stats.sunk;
+                s->stats.failed += (size_t)failed;
+                if (s->ordered) {
+                        ++s->sink_seq;
+                } else {
+                        s->free_slots[s->n_free++] = slot;
+                }
+                pthread_cond_broadcast(&s->space_cv);
+        }
+        s->sinking = 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  worker_main
+ *  Description:  Align queued jobs until shutdown
+ * =====================================================================================
+ */
+static void* worker_main(void *arg)
+{
+        ASW_Stream *s = ((WorkerArg*)arg)->stream;
+        Alignment_ASW *al = s->workspaces[((WorkerArg*)arg)->id];
+        free(arg);
+
+        pthread_mutex_lock(&s->lock);
+        for (;;) {
+                while (!s->shutdown && s->pending.count == 0u) {
+                        pthread_cond_wait(&s->work_cv, &s->lock);
+                }
+                if (s->pending.count == 0u) break;
+
+                size_t slot = queue_pop(&s->pending, s->capacity);
+                Slot *sl = &s->slots[slot];
+                pthread_mutex_unlock(&s->lock);
+
+                asw_run_job(al, &sl->job, &sl->result);
+
+                pthread_mutex_lock(&s->lock);
+                sl->done = 1;
+                if (++s->waiting > s->stats.max_waiting) s->stats.max_waiting = s->waiting;
+                if (!s->ordered) queue_push(&s->completed, s->capacity, slot);
+                drain(s);
+        }
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_options_init
+ *  Description:  Fill ASW_StreamOptions with defaults
+ * =====================================================================================
+ */
+void asw_stream_options_init(ASW_StreamOptions *opt)
+{
+        opt->nthreads = 0u;
+        opt->capacity = 0u;
+        opt->ordered = 1;
+        opt->match = -10;
+        opt->mismatch = 30;
+        opt->gap_open_extend = 50;
+        opt->gap_extend = 20;
+        opt->phred_offset = 33;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_new
+ *  Description:  Start worker threads feeding given sink
+ * =====================================================================================
+ */
+ASW_Stream* asw_stream_new(const ASW_StreamOptions *opt, ASW_SinkFn sink, void *ctx)
+{
+        unsigned int nthreads = opt->nthreads;
+        if (nthreads == 0u) {
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                nthreads = ncpu > 0 ? (unsigned int)ncpu : 1u;
+        }
+
+        ASW_Stream *s = (ASW_Stream*)calloc(1u, sizeof(ASW_Stream));
+        if (s == NULL) return NULL;
+        s->sink = sink;
+        s->ctx = ctx;
+        s->ordered = opt->ordered;
+        s->capacity = opt->capacity > 0u ? opt->capacity : DEFAULT_SLOTS_PER_THREAD * nthreads;
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->work_cv, NULL);
+        pthread_cond_init(&s->space_cv, NULL);
+
+        unsigned int i;
+        if ((s->slots = (Slot*)calloc(s->capacity, sizeof(Slot))) == NULL)
+                goto error;
+        if ((s->pending.items = (size_t*)malloc(sizeof(size_t) * s->capacity)) == NULL)
+                goto error;
+        if ((s->completed.items = (size_t*)malloc(sizeof(size_t) * s->capacity)) == NULL)
+                goto error;
+        if ((s->free_slots = (size_t*)malloc(sizeof(size_t) * s->capacity)) == NULL)
+                goto error;
+        for (s->n_free = 0u; s->n_free < s->capacity; ++s->n_free) {
+                /* lowest slot on top */
+                s->free_slots[s->n_free] = s->capacity - 1u - s->n_free;
+        }
+        if ((s->threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t))) == NULL)
+                goto error;
+        if ((s->workspaces = (Alignment_ASW**)calloc(nthreads, sizeof(Alignment_ASW*))) == NULL)
+                goto error;
+
+        /* all workspaces share one scoring model */
+        ASW_Model *model = asw_model_new(opt->match, opt->mismatch,
+                                         opt->gap_open_extend, opt->gap_extend);
+        if (model == NULL) goto error;
+        for (i = 0u; i < nthreads; ++i) {
+                Alignment_ASW *al = asw_workspace_new(model);
+                if (al == NULL) break;
+                asw_set_phoffset(al, opt->phred_offset);
+                s->workspaces[i] = al;
+        }
+        asw_model_release(model);
+        if (i < nthreads) goto error;
+
+        for (i = 0u; i < nthreads; ++i) {
+                WorkerArg *arg = (WorkerArg*)malloc(sizeof(WorkerArg));
+                if (arg == NULL) goto error;
+                arg->stream = s;
+                arg->id = i;
+                if (pthread_create(&s->threads[i], NULL, worker_main, arg) != 0) {
+                        free(arg);
+                        goto error;
+                }
+                /* count started threads so that asw_stream_free joins only those */
+                s->nthreads = i + 1u;
+        }
+        return s;
+error:
+        if (s->workspaces != NULL) {
+                /* workspaces of threads that did not start */
+                for (i = s->nthreads; i < nthreads; ++i) {
+                        asw_free(s->workspaces[i]);
+                        s->workspaces[i] = NULL;
+                }
+        }
+        asw_stream_free(s);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_submit
+ *  Description:  Queue a job, blocking while the buffer is full
+ * =====================================================================================
+ */
+size_t asw_stream_submit(ASW_Stream *s, const ASW_Job *job)
+{
+        pthread_mutex_lock(&s->lock);
+        /* ordered: the slot of next_seq is free while fewer than capacity jobs are
+         * unsunk; unordered: a slot is on the free list */
+        if (s->ordered ? s->next_seq - s->sink_seq == s->capacity : s->n_free == 0u) {
+                double t0 = now_sec();
+                ++s->stats.producer_waits;
+                do {
+                        pthread_cond_wait(&s->space_cv, &s->lock);
+                } while (s->ordered ? s->next_seq - s->sink_seq == s->capacity : s->n_free == 0u);
+                s->stats.producer_wait_sec += now_sec() - t0;
+        }
+        size_t seq = s->next_seq++;
+        size_t slot = s->ordered ? seq % s->capacity : s->free_slots[--s->n_free];
+        Slot *sl = &s->slots[slot];
+        sl->job = *job;
+        sl->seq = seq;
+        sl->done = 0;
+        ++s->stats.submitted;
+        queue_push(&s->pending, s->capacity, slot);
+        pthread_cond_signal(&s->work_cv);
+        pthread_mutex_unlock(&s->lock);
+        return seq;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_finish
+ *  Description:  Wait until the results of all submitted jobs have been sunk
+ * =====================================================================================
+ */
+void asw_stream_finish(ASW_Stream *s)
+{
+        pthread_mutex_lock(&s->lock);
+        /* space_cv is signalled after every sink call */
+        while (s->stats.sunk < s->stats.submitted) {
+                pthread_cond_wait(&s->space_cv, &s->lock);
+        }
+        pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_stats
+ *  Description:  Copy the counters of a stream
+ * =====================================================================================
+ */
+void asw_stream_stats(ASW_Stream *s, ASW_StreamStats *stats)
+{
+        pthread_mutex_lock(&s->lock);
+        *stats = s->stats;
+        pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_free
+ *  Description:  Finish, stop the worker threads and free the stream
+ * =====================================================================================
+ */
+void asw_stream_free(ASW_Stream *s)
+{
+        if (s == NULL) return;
+
+        if (s->nthreads > 0u) asw_stream_finish(s);
+
+        pthread_mutex_lock(&s->lock);
+        s->shutdown = 1;
+        pthread_cond_broadcast(&s->work_cv);
+        pthread_mutex_unlock(&s->lock);
+
+        unsigned int i;
+        for (i = 0u; i < s->nthreads; ++i) {
+                pthread_join(s->threads[i], NULL);
+                asw_free(s->workspaces[i]);
+        }
+        pthread_cond_destroy(&s->space_cv);
+        pthread_cond_destroy(&s->work_cv);
+        pthread_mutex_destroy(&s->lock);
+        free(s->workspaces);
+        free(s->threads);
+        free(s->free_slots);
+        free(s->completed.items);
+        free(s->pending.items);
+        free(s->slots);
+        free(s);
+}
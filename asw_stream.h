@@ -0,0 +1,115 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  asw_stream.h
+ *
+ *    Description:  Streaming parallel alignment: producers submit jobs one at a
+ *                  time, worker threads align them and a sink receives the results,
+ *                  in submission order or as they complete, through a bounded
+ *                  reorder buffer
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef ASW_STREAM_H
+#define ASW_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asw_batch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+        unsigned int nthreads;  /* worker threads; 0: number of online processors */
+        size_t capacity;        /* jobs submitted but not yet sunk at most; producers
+                                 * block beyond that. 0: 16 per worker */
+        int ordered;            /* nonzero: sink results in submission order */
+        int match,              /* penalty scores as in asw_init */
+            mismatch,
+            gap_open_extend,
+            gap_extend;
+        int phred_offset;       /* as in asw_set_phoffset */
+} ASW_StreamOptions;
+
+typedef struct {
+        size_t submitted;       /* jobs submitted */
+        size_t sunk;            /* results passed to the sink */
+        size_t failed;          /* ... of which with nonzero status */
+        size_t max_waiting;     /* most results completed but held back for order */
+        size_t producer_waits;  /* submissions that blocked on a full buffer */
+        double producer_wait_sec;  /* time spent blocked */
+} ASW_StreamStats;
+
+/* Receives every result; seq is the submission number, counting from zero.
+ * Calls are never concurrent. The sink owns result (free its buffers with
+ * asw_result_clear); job is the copy made at submission. */
+typedef void (*ASW_SinkFn)(void *ctx, size_t seq, const ASW_Job *job, ASW_Result *result);
+
+typedef struct ASW_Stream ASW_Stream;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_options_init
+ *  Description:  Fill ASW_StreamOptions with defaults (automatic thread count and
+ *                capacity, ordered, the default penalties of the Python module,
+ *                Sanger PHRED offset)
+ * =====================================================================================
+ */
+void asw_stream_options_init(ASW_StreamOptions *opt);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_new
+ *  Description:  Start worker threads feeding given sink. Returns NULL on failure.
+ * =====================================================================================
+ */
+ASW_Stream* asw_stream_new(const ASW_StreamOptions *opt, ASW_SinkFn sink, void *ctx);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_submit
+ *  Description:  Queue a job, blocking while the buffer is full, and return its
+ *                sequence number. The job is copied, but the sequences it points to
+ *                must stay valid until its result is sunk. Safe to call from
+ *                several threads (but not from the sink).
+ * =====================================================================================
+ */
+size_t asw_stream_submit(ASW_Stream *stream, const ASW_Job *job);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_finish
+ *  Description:  Wait until the results of all submitted jobs have been sunk
+ * =====================================================================================
+ */
+void asw_stream_finish(ASW_Stream *stream);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_stats
+ *  Description:  Copy the counters of a stream
+ * =====================================================================================
+ */
+void asw_stream_stats(ASW_Stream *stream, ASW_StreamStats *stats);
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  asw_stream_free
+ *  Description:  Finish, stop the worker threads and free the stream
+ * =====================================================================================
+ */
+void asw_stream_free(ASW_Stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASW_STREAM_H */
@@ -20,23 +20,198 @@
 #include <Python.h>
 #include "structmember.h"
 #include "align454.h"
+#include "asw_batch.h"
+
+/* most worker threads align_many and align_ragged may be asked for */
+#define QXALIGN_MAX_THREADS 1024
 
 /*-----------------------------------------------------------------------------
  *  Qxalign type object
  *-----------------------------------------------------------------------------*/
 typedef struct {
         PyObject_HEAD
-        Alignment_ASW* al;
+        Alignment_ASW* al;      /* workspace borrowed from the pool between align()
+                                 * and trace(), or the one inside fx, or NULL */
+        ASW_Fixed* fx;          /* fixed-capacity workspace holding al, or NULL */
         Py_buffer db_seq;
         Py_buffer query_seq;
         Py_buffer query_qual;
         uint8_t* default_qual;
+        const uint8_t* qual;    /* either query_qual.buf or default_qual */
+        int phred_offset;
+        int aligned;            /* 0: nothing to trace, 1: al holds the alignment,
+                                 * 2: its workspace went back to the pool and
+                                 * trace() aligns again */
+        int semi;               /* mode of the last align() */
+        int busy;               /* a method is running with the GIL released */
         int match;
         int mismatch;
         int gap_open_extend;
         int gap_extend;
+
+        /* result of the last traceback, copied out of the workspace */
+        cigar_t* cigar;
+        size_t cigar_len;
+        size_t cigar_cap;
+        Py_ssize_t cigar_exports;       /* buffer views of cigar handed out */
+        Py_ssize_t cigar_shape;         /* cigar_len as seen by those views */
+        size_t offset;
+        uint32_t n_match;
+        uint32_t n_mismatch;
+        uint32_t n_ins;
+        uint32_t n_del;
+        uint32_t nm;
+        PyObject* md;           /* MD tag (str) if requested, or NULL */
+
+        /* worker threads of align_many, started on first use */
+        ASW_Batch* batch;
+        unsigned int batch_threads;     /* threads asked for (0: one per processor) */
+        int batch_phred;                /* PHRED offset the workers were started with */
 } Qxalign;
 
+/*-----------------------------------------------------------------------------
+ *  Workspace pool shared by all Qxalign instances. Workspaces are borrowed by
+ *  align() and returned by trace() (or by the next prepare), so memory held by
+ *  alignment matrices is bounded by the number of alignments in progress
+ *  rather than by the number of Qxalign objects; tracing again after that
+ *  borrows a workspace and redoes the alignment. Accessed with the GIL held;
+ *  workspaces allocate with the raw allocators, which do not need the GIL, as
+ *  they are resized and traced with the GIL released.
+ *-----------------------------------------------------------------------------*/
+typedef struct {
+        Alignment_ASW* al;
+        int match;              /* penalties al has been initialized with */
+        int mismatch;
+        int gap_open_extend;
+        int gap_extend;
+} PoolEntry;
+
+static struct {
+        PoolEntry* idle;        /* stack of idle workspaces, most recently used on top */
+        Py_ssize_t size;        /* number of idle workspaces */
+        Py_ssize_t limit;       /* maximum number of idle workspaces kept */
+        Py_ssize_t in_use;      /* number of workspaces currently borrowed */
+        Py_ssize_t high_water;  /* maximum of in_use */
+        Py_ssize_t borrows;     /* number of times a workspace was borrowed */
+        Py_ssize_t allocations; /* borrows that had to allocate a new workspace */
+        ASW_Model* model;       /* scoring model of the penalties last asked for */
+        PoolEntry model_key;    /* ... and those penalties (al unused) */
+} pool = {NULL, 0, 16, 0, 0, 0, 0, NULL, {NULL, 0, 0, 0, 0}};
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pool_model
+ *  Description:  Scoring model for given penalties (borrowed reference). Instances
+ *                mostly share their penalties, so the last model is kept and
+ *                shared by all workspaces using it.
+ * =====================================================================================
+ */
+static ASW_Model*
+pool_model(int match, int mismatch, int gap_open_extend, int gap_extend)
+{
+        PoolEntry *k = &pool.model_key;
+        if (pool.model != NULL &&
+            k->match == match && k->mismatch == mismatch &&
+            k->gap_open_extend == gap_open_extend && k->gap_extend == gap_extend)
+        {
+                return pool.model;
+        }
+        ASW_Model *model = asw_model_new(match, mismatch, gap_open_extend, gap_extend);
+        if (model == NULL) return NULL;
+        /* workspaces using the previous model hold their own references */
+        asw_model_release(pool.model);
+        pool.model = model;
+        k->match = match;
+        k->mismatch = mismatch;
+        k->gap_open_extend = gap_open_extend;
+        k->gap_extend = gap_extend;
+        return model;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pool_borrow
+ *  Description:  Take a workspace initialized with the penalties of given Qxalign
+ *                instance out of the pool, allocating one if the pool is empty
+ * =====================================================================================
+ */
+static Alignment_ASW*
+pool_borrow(int match, int mismatch, int gap_open_extend, int gap_extend)
+{
+        Alignment_ASW *al = NULL;
+        Py_ssize_t i;
+
+        /* prefer a workspace already scoring with these penalties */
+        for (i = pool.size - 1; i >= 0; --i) {
+                PoolEntry *e = &pool.idle[i];
+                if (e->match == match && e->mismatch == mismatch &&
+                    e->gap_open_extend == gap_open_extend && e->gap_extend == gap_extend)
+                {
+                        al = e->al;
+                        *e = pool.idle[--pool.size];
+                        break;
+                }
+        }
+        if (al == NULL) {
+                ASW_Model *model = pool_model(match, mismatch, gap_open_extend, gap_extend);
+                if (model == NULL) return NULL;
+                if (pool.size > 0) {
+                        al = pool.idle[--pool.size].al;
+                } else {
+                        al = asw_alloc(PyMem_RawMalloc, PyMem_RawRealloc, PyMem_RawFree);
+                        if (al == NULL) return NULL;
+                        ++pool.allocations;
+                }
+                asw_set_model(al, model);
+        }
+        ++pool.borrows;
+        if (++pool.in_use > pool.high_water)
+                pool.high_water = pool.in_use;
+        return al;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pool_return
+ *  Description:  Give a borrowed workspace back to the pool, freeing it if the pool
+ *                is at its limit
+ * =====================================================================================
+ */
+static void
+pool_return(Alignment_ASW* al, int match, int mismatch, int gap_open_extend, int gap_extend)
+{
+        --pool.in_use;
+        if (pool.size < pool.limit) {
+                PoolEntry *e = &pool.idle[pool.size++];
+                e->al = al;
+                e->match = match;
+                e->mismatch = mismatch;
+                e->gap_open_extend = gap_open_extend;
+                e->gap_extend = gap_extend;
+        } else {
+                asw_free(al);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pool_resize
+ *  Description:  Change the maximum number of idle workspaces, freeing the excess
+ * =====================================================================================
+ */
+static int
+pool_resize(Py_ssize_t limit)
+{
+        while (pool.size > limit) {
+                asw_free(pool.idle[--pool.size].al);
+        }
+        PoolEntry *tmp = PyMem_Realloc(pool.idle, sizeof(PoolEntry) * (limit > 0 ? limit : 1));
+        if (tmp == NULL) return -1;
+        pool.idle = tmp;
+        pool.limit = limit;
+        return 0;
+}
+
 /*-----------------------------------------------------------------------------
  *  Custom exception objects
  *-----------------------------------------------------------------------------*/
@@ -58,11 +233,8 @@ Qxalign_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
                 return NULL;
         }
 
-        if ((self->al = asw_alloc(PyMem_Malloc, PyMem_Realloc, PyMem_Free)) == NULL) {
-                Py_DECREF(self);
-                PyErr_SetString(PyExc_MemoryError, "cannot allocate alignment object");
-                return NULL;
-        }
+        /* workspaces are borrowed from the pool on demand */
+        self->al = NULL;
 
         /* self->db_seq.buf = NULL; */
         /* self->query_seq.buf = NULL; */
@@ -78,10 +250,123 @@ Qxalign_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
         self->gap_extend = 20;
 
         self->default_qual = NULL;
+        self->qual = NULL;
+        self->phred_offset = 33;
+        self->aligned = 0;
+        self->semi = 0;
+        self->busy = 0;
+        self->fx = NULL;
+
+        self->cigar = NULL;
+        self->cigar_len = 0u;
+        self->cigar_cap = 0u;
+        self->cigar_exports = 0;
+        self->cigar_shape = 0;
+        self->offset = 0u;
+        self->n_match = self->n_mismatch = self->n_ins = self->n_del = self->nm = 0u;
+        self->md = NULL;
+
+        self->batch = NULL;
+        self->batch_threads = 0u;
+        self->batch_phred = 0;
 
         return (PyObject *)self;
 }
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_release
+ *  Description:  Return a borrowed workspace (if any) to the pool. An alignment it
+ *                held is dropped with it and redone by the next trace(); a fixed
+ *                workspace keeps its alignment.
+ * =====================================================================================
+ */
+static void
+Qxalign_release(Qxalign* self)
+{
+        if (self->fx == NULL && self->al != NULL) {
+                if (self->aligned) {
+                        self->aligned = 2;
+                }
+                pool_return(self->al,
+                            self->match,
+                            self->mismatch,
+                            self->gap_open_extend,
+                            self->gap_extend);
+                self->al = NULL;
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_idle
+ *  Description:  Check that no method is running on the object with the GIL
+ *                released, so that sequences and the kept result may be read. Sets
+ *                a Python exception and returns -1 if the object is in use.
+ * =====================================================================================
+ */
+static int
+Qxalign_idle(Qxalign* self)
+{
+        /* checked with the GIL held */
+        if (self->busy) {
+                PyErr_SetString(PyExc_RuntimeError,
+                        "Qxalign object is in use by another thread");
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_enter
+ *  Description:  Claim the object for a method that changes it. Methods drop the
+ *                GIL while aligning, so another thread could otherwise replace the
+ *                buffers or the workspace under them. Sets a Python exception and
+ *                returns -1 if the object is in use.
+ * =====================================================================================
+ */
+static int
+Qxalign_enter(Qxalign* self)
+{
+        if (Qxalign_idle(self) != 0) {
+                return -1;
+        }
+        self->busy = 1;
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_leave
+ *  Description:  Release the object claimed by Qxalign_enter
+ * =====================================================================================
+ */
+static void
+Qxalign_leave(Qxalign* self)
+{
+        self->busy = 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_cigar_unlocked
+ *  Description:  Check that the CIGAR of the last traceback may be replaced: views
+ *                handed out by the buffer protocol point into it. Sets BufferError
+ *                and returns -1 otherwise.
+ * =====================================================================================
+ */
+static int
+Qxalign_cigar_unlocked(Qxalign* self)
+{
+        if (self->cigar_exports > 0) {
+                PyErr_SetString(PyExc_BufferError,
+                        "cannot trace while the CIGAR buffer is exported");
+                return -1;
+        }
+        return 0;
+}
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  Qxalign_dealloc
@@ -91,7 +376,16 @@ Qxalign_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 static void
 Qxalign_dealloc(Qxalign* self)
 {
-        asw_free(self->al);
+        if (self->fx != NULL) {
+                PyMem_Free(self->fx);
+        } else {
+                Qxalign_release(self);
+        }
+        if (self->cigar != NULL) {
+                PyMem_Free(self->cigar);
+        }
+        Py_XDECREF(self->md);
+        asw_batch_free(self->batch);
 
         PyBuffer_Release(&(self->db_seq));
         PyBuffer_Release(&(self->query_seq));
@@ -115,21 +409,209 @@ static int
 Qxalign_init(Qxalign *self, PyObject *args, PyObject *kwds)
 {
         static char *kwlist[] =
-                {"match", "mismatch", "gap_open_extend", "gap_extend", NULL};
+                {"match", "mismatch", "gap_open_extend", "gap_extend", "fixed", NULL};
+
+        int fixed = 0;
 
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iiii", kwlist,
+        if (Qxalign_enter(self) != 0) {
+                return -1;
+        }
+        /* a borrowed workspace was initialized with the current penalties */
+        Qxalign_release(self);
+        self->aligned = 0;
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iiiip", kwlist,
                                 &self->match,
                                 &self->mismatch,
                                 &self->gap_open_extend,
-                                &self->gap_extend))
+                                &self->gap_extend,
+                                &fixed))
+        {
+                goto error;
+        }
+        /* workers score with the previous penalties */
+        asw_batch_free(self->batch);
+        self->batch = NULL;
+        if (fixed && self->fx == NULL) {
+                /* lightweight mode: one allocation up front, none per alignment */
+                ASW_Fixed *fx = (ASW_Fixed*)PyMem_Malloc(sizeof(ASW_Fixed));
+                if (fx == NULL) {
+                        PyErr_SetString(PyExc_MemoryError, "cannot allocate fixed workspace");
+                        goto error;
+                }
+                self->fx = fx;
+                self->al = &fx->al;
+        } else if (!fixed && self->fx != NULL) {
+                PyMem_Free(self->fx);
+                self->fx = NULL;
+                self->al = NULL;
+        }
+        if (self->fx != NULL) {
+                asw_fixed_init(self->fx,
+                               self->match,
+                               self->mismatch,
+                               self->gap_open_extend,
+                               self->gap_extend);
+        }
+        Qxalign_leave(self);
+        return 0;
+error:
+        Qxalign_leave(self);
+        return -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_assign
+ *  Description:  Assign the current sequences to the alignment object. A fixed
+ *                workspace is prepared right away; otherwise any borrowed workspace
+ *                is returned to the pool and the next align() prepares a new one.
+ *                Sets a Python exception and returns -1 on failure.
+ * =====================================================================================
+ */
+static int
+Qxalign_assign(Qxalign* self)
+{
+        Qxalign_release(self);
+        if (self->fx != NULL &&
+            asw_fixed_prepare(self->fx,
+                        (const char*)self->db_seq.buf,
+                        self->db_seq.len,
+                        (const char*)self->query_seq.buf,
+                        self->qual,
+                        self->query_seq.len, 0u, 0u)
+                != 0)
         {
+                PyErr_Format(PyExc_ValueError,
+                        "sequences exceed capacity of fixed workspace (%d, %d)",
+                        ASW_FIXED_DB_MAX, ASW_FIXED_QUERY_MAX);
                 return -1;
         }
-        asw_init(self->al,
-                 self->match,
-                 self->mismatch,
-                 self->gap_open_extend,
-                 self->gap_extend);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_acquire
+ *  Description:  Make sure al is a workspace prepared with the current sequences,
+ *                borrowing one from the pool if needed. Sets a Python exception and
+ *                returns -1 on failure.
+ * =====================================================================================
+ */
+static int
+Qxalign_acquire(Qxalign* self)
+{
+        if (self->fx == NULL) {
+                if (self->al == NULL &&
+                    (self->al = pool_borrow(self->match,
+                                            self->mismatch,
+                                            self->gap_open_extend,
+                                            self->gap_extend)) == NULL)
+                {
+                        PyErr_SetString(PyExc_MemoryError, "cannot allocate alignment object");
+                        return -1;
+                }
+                int status;
+                /* the caller holds the object (Qxalign_enter) */
+                Py_BEGIN_ALLOW_THREADS
+                status = asw_prepare(self->al,
+                            (const char*)self->db_seq.buf,
+                            self->db_seq.len,
+                            (const char*)self->query_seq.buf,
+                            self->qual,
+                            self->query_seq.len, 0u, 0u);
+                Py_END_ALLOW_THREADS
+                if (status != 0) {
+                        Qxalign_release(self);
+                        PyErr_SetString(PyExc_MemoryError, "cannot resize alignment object");
+                        return -1;
+                }
+        }
+        asw_set_phoffset(self->al, self->phred_offset);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_forget
+ *  Description:  Drop the result of the last traceback: its CIGAR and offset refer
+ *                to the sequences about to be replaced. Exported CIGAR views keep
+ *                their own length and stay readable.
+ * =====================================================================================
+ */
+static void
+Qxalign_forget(Qxalign* self)
+{
+        self->aligned = 0;
+        self->cigar_len = 0u;
+        self->offset = 0u;
+        self->n_match = self->n_mismatch = self->n_ins = self->n_del = self->nm = 0u;
+        Py_CLEAR(self->md);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_store
+ *  Description:  Take over parsed sequence buffers (db_seq may be NULL) and set up
+ *                quality scores. Sets a Python exception and returns -1 on failure.
+ * =====================================================================================
+ */
+static int
+Qxalign_store(Qxalign* self,
+              Py_buffer* db_seq,
+              Py_buffer* query_seq,
+              Py_buffer* query_qual,
+              int phred_offset,
+              int assume_phred)
+{
+        Qxalign_forget(self);
+        if (db_seq != NULL && db_seq->buf != NULL) {
+                PyBuffer_Release(&(self->db_seq));
+                self->db_seq = *db_seq;
+        }
+        if (query_seq->buf != NULL) {
+                PyBuffer_Release(&(self->query_seq));
+                self->query_seq = *query_seq;
+        }
+
+        uint8_t *final_qual;
+        if (query_qual->buf != NULL) {
+                if (query_qual->len < self->query_seq.len) {
+                        PyErr_SetString(PyExc_IndexError,
+                                "quality score array is shorter than query sequence");
+                        return -1;
+                } else if (query_qual->len > self->query_seq.len &&
+                           PyErr_WarnEx(PyExc_UserWarning,
+                            "quality score array is longer than query sequence", 2) < 0)
+                {
+                        return -1;
+                }
+                PyBuffer_Release(&(self->query_qual));
+                self->query_qual = *query_qual;
+                final_qual = query_qual->buf;
+        } else {
+                if (assume_phred >= PHRED_RANGE || assume_phred < 0) {
+                        PyErr_Format(PyExc_IndexError,
+                                "assumed PHRED score %d is outside of valid range 0-%d",
+                                assume_phred, PHRED_RANGE - 1);
+                        return -1;
+                }
+                /* maintain a buffer with default PHRED scores */
+                uint8_t* tmp = PyMem_Realloc(self->default_qual,
+                                             sizeof(uint8_t) * self->query_seq.len);
+                if (tmp == NULL) {
+                        PyErr_SetString(PyExc_MemoryError,
+                                "cannot resize default quality score array");
+                        return -1;
+                }
+                self->default_qual = tmp;
+
+                memset(tmp, assume_phred + phred_offset, self->query_seq.len);
+                final_qual = tmp;
+        }
+
+        self->qual = final_qual;
+        self->phred_offset = phred_offset;
         return 0;
 }
 
@@ -154,16 +636,18 @@ Qxalign_prepare_db(Qxalign* self, PyObject *args, PyObject *kwds)
         {
                 return NULL;
         }
+        if (Qxalign_enter(self) != 0) {
+                if (db_seq.buf != NULL) PyBuffer_Release(&db_seq);
+                return NULL;
+        }
         if (db_seq.buf != NULL) {
+                Qxalign_forget(self);
                 PyBuffer_Release(&(self->db_seq));
                 self->db_seq = db_seq;
         }
-        if (asw_prepare_db(self->al,
-                    (const char*)self->db_seq.buf,
-                    self->db_seq.len, 0u, 0u)
-                != 0)
-        {
-                PyErr_SetString(PyExc_MemoryError, "cannot resize alignment object");
+        int status = Qxalign_assign(self);
+        Qxalign_leave(self);
+        if (status != 0) {
                 return NULL;
         }
         Py_RETURN_NONE;
@@ -200,60 +684,20 @@ Qxalign_prepare_query(Qxalign* self, PyObject *args, PyObject *kwds)
         {
                 return NULL;
         }
-        if (query_seq.buf != NULL) {
-                PyBuffer_Release(&(self->query_seq));
-                self->query_seq = query_seq;
+        if (Qxalign_enter(self) != 0) {
+                if (query_seq.buf != NULL) PyBuffer_Release(&query_seq);
+                if (query_qual.buf != NULL) PyBuffer_Release(&query_qual);
+                return NULL;
         }
-
-        uint8_t *final_qual;
-        if (query_qual.buf != NULL) {
-                if (query_qual.len < self->query_seq.len) {
-                        PyErr_SetString(PyExc_IndexError,
-                                "quality score array is shorter than query sequence");
-                        return NULL;
-                } else if (query_qual.len > self->query_seq.len &&
-                           PyErr_WarnEx(PyExc_UserWarning,
-                            "quality score array is longer than query sequence", 2) < 0)
-                {
-                        return NULL;
-                }
-                PyBuffer_Release(&(self->query_qual));
-                self->query_qual = query_qual;
-                final_qual = query_qual.buf;
-        } else {
-                if (assume_phred >= PHRED_RANGE || assume_phred < 0) {
-                        PyErr_Format(PyExc_IndexError,
-                                "assumed PHRED score %d is outside of valid range 0-%d",
-                                assume_phred, PHRED_RANGE - 1);
-                        return NULL;
-                }
-                /* maintain a buffer with default PHRED scores */
-                uint8_t* tmp = PyMem_Realloc(self->default_qual,
-                                             sizeof(uint8_t) * self->query_seq.len);
-                if (tmp == NULL) {
-                        PyErr_SetString(PyExc_MemoryError,
-                                "cannot resize default quality score array");
-                        return NULL;
-                }
-                self->default_qual = tmp;
-
-                memset(tmp, assume_phred + phred_offset, self->query_seq.len);
-                final_qual = tmp;
+        int status = Qxalign_store(self, NULL, &query_seq, &query_qual,
+                                   phred_offset, assume_phred);
+        if (status == 0) {
+                status = Qxalign_assign(self);
         }
-
-        if (asw_prepare(self->al,
-                    (const char*)self->db_seq.buf,
-                    self->db_seq.len,
-                    (const char*)self->query_seq.buf,
-                    (const uint8_t*)final_qual,
-                    self->query_seq.len, 0u, 0u)
-                != 0)
-        {
-                PyErr_SetString(PyExc_MemoryError, "cannot resize alignment object");
+        Qxalign_leave(self);
+        if (status != 0) {
                 return NULL;
         }
-        asw_set_phoffset(self->al, phred_offset);
-
         Py_RETURN_NONE;
 }
 /*
@@ -291,145 +735,1463 @@ Qxalign_prepare(Qxalign* self, PyObject *args, PyObject *kwds)
         {
                 return NULL;
         }
-        if (db_seq.buf != NULL) {
-                PyBuffer_Release(&(self->db_seq));
-                self->db_seq = db_seq;
+        if (Qxalign_enter(self) != 0) {
+                if (db_seq.buf != NULL) PyBuffer_Release(&db_seq);
+                if (query_seq.buf != NULL) PyBuffer_Release(&query_seq);
+                if (query_qual.buf != NULL) PyBuffer_Release(&query_qual);
+                return NULL;
         }
-        if (query_seq.buf != NULL) {
-                PyBuffer_Release(&(self->query_seq));
-                self->query_seq = query_seq;
+        int status = Qxalign_store(self, &db_seq, &query_seq, &query_qual,
+                                   phred_offset, assume_phred);
+        if (status == 0) {
+                status = Qxalign_assign(self);
         }
-
-        uint8_t *final_qual;
-        if (query_qual.buf != NULL) {
-                if (query_qual.len < self->query_seq.len) {
-                        PyErr_SetString(PyExc_IndexError,
-                                "quality score array is shorter than query sequence");
-                        return NULL;
-                } else if (query_qual.len > self->query_seq.len &&
-                           PyErr_WarnEx(PyExc_UserWarning,
-                            "quality score array is longer than query sequence", 2) < 0)
-                {
-                        return NULL;
-                }
-                PyBuffer_Release(&(self->query_qual));
-                self->query_qual = query_qual;
-                final_qual = query_qual.buf;
+        Qxalign_leave(self);
+        if (status != 0) {
+                return NULL;
+        }
+        Py_RETURN_NONE;
+}
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_align
+ *  Description:  Perofrm alignment
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_align(Qxalign* self, PyObject *args, PyObject *kwds)
+{
+        PyObject *x = Py_False;
+        static char *kwlist[] = {"semi", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:bool", kwlist, &x)) {
+                return NULL;
+        }
+        int semi = PyObject_IsTrue(x);
+
+        if (self->db_seq.len == 0 || self->query_seq.len == 0) {
+                PyErr_SetString(PyExc_IndexError,
+                        "cannot perform alignment on a zero-element matrix");
+                return NULL;
+        }
+        if (Qxalign_enter(self) != 0) {
+                return NULL;
+        }
+        if (Qxalign_acquire(self) != 0) {
+                Qxalign_leave(self);
+                return NULL;
+        }
+        int score;
+        Py_BEGIN_ALLOW_THREADS
+        if (self->fx != NULL) {
+                asw_fixed_align(self->fx, semi);
         } else {
-                if (assume_phred >= PHRED_RANGE || assume_phred < 0) {
+                if (semi) {
+                        /* semiglobal alignment: fill top row (parallel to db) with zeroes */
+                        asw_align_init_semi(self->al);
+                } else {
+                        /* global alignment: penalize deletions in db at the beginning */
+                        asw_align_init(self->al);
+                }
+                asw_align(self->al);
+        }
+        /* asw_print_matrix1(self->al, stdout); */
+        score = asw_locate_minscore(self->al);
+        Py_END_ALLOW_THREADS
+        self->aligned = 1;
+        self->semi = semi;
+        Qxalign_leave(self);
+        return Py_BuildValue("i", score);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_keep
+ *  Description:  Copy the result of a traceback out of the workspace, so that the
+ *                workspace can be returned to the pool. Sets a Python exception
+ *                and returns -1 on failure.
+ * =====================================================================================
+ */
+static int
+Qxalign_keep(Qxalign* self, int md)
+{
+        size_t len = self->al->cigar_end - self->al->cigar_begin;
+        if (len > self->cigar_cap) {
+                cigar_t *tmp = PyMem_Realloc(self->cigar, sizeof(cigar_t) * len);
+                if (tmp == NULL) {
+                        PyErr_SetString(PyExc_MemoryError, "cannot resize CIGAR buffer");
+                        return -1;
+                }
+                self->cigar = tmp;
+                self->cigar_cap = len;
+        }
+        memcpy(self->cigar, self->al->cigar_begin, sizeof(cigar_t) * len);
+        self->cigar_len = len;
+        self->offset = self->al->offset;
+        self->n_match = self->al->n_match;
+        self->n_mismatch = self->al->n_mismatch;
+        self->n_ins = self->al->n_ins;
+        self->n_del = self->al->n_del;
+        self->nm = self->al->nm;
+        Py_CLEAR(self->md);
+        if (md && (self->md = PyUnicode_FromString(self->al->md_begin)) == NULL) {
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_trace
+ *  Description:  Performs traceback on an alignment, optionally replacing edits at
+ *                the ends with soft clipping and/or collapsing matches and
+ *                mismatches into M operations. Edit statistics (and the MD tag if
+ *                requested) are recorded along the way.
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_trace(Qxalign* self, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = {"softclip", "compact", "md", NULL};
+        int softclip = 0, compact = 0, md = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ppp", kwlist,
+                                &softclip,
+                                &compact,
+                                &md))
+        {
+                return NULL;
+        }
+        if (self->db_seq.len == 0 || self->query_seq.len == 0) {
+                PyErr_SetString(PyExc_IndexError,
+                        "cannot perform traceback on a zero-element matrix");
+                return NULL;
+        }
+        if (Qxalign_enter(self) != 0) {
+                return NULL;
+        }
+        if (Qxalign_cigar_unlocked(self) != 0) {
+                Qxalign_leave(self);
+                return NULL;
+        }
+        if (!self->aligned) {
+                Qxalign_leave(self);
+                PyErr_SetString(PyExc_RuntimeError,
+                        "no alignment to trace: call align() first");
+                return NULL;
+        }
+        /* the workspace of the alignment went back to the pool: align again */
+        int realign = self->aligned == 2;
+        if (realign && Qxalign_acquire(self) != 0) {
+                Qxalign_leave(self);
+                return NULL;
+        }
+        unsigned int flags = (softclip ? ASW_TRACE_SOFTCLIP : 0u)
+                           | (compact ? ASW_TRACE_COMPACT : 0u)
+                           | (md ? ASW_TRACE_MD : 0u);
+        int status;
+        Py_BEGIN_ALLOW_THREADS
+        if (realign) {
+                if (self->semi) {
+                        asw_align_init_semi(self->al);
+                } else {
+                        asw_align_init(self->al);
+                }
+                asw_align(self->al);
+                asw_locate_minscore(self->al);
+        }
+        status = asw_trace_ex(self->al, flags, 0u, 0u);
+        Py_END_ALLOW_THREADS
+        if (status != 0) {
+                Qxalign_release(self);
+                Qxalign_leave(self);
+                PyErr_SetString(PyExc_MemoryError, "cannot perform traceback");
+                return NULL;
+        }
+
+        /* keep the result so that the workspace can go back to the pool */
+        status = Qxalign_keep(self, md);
+        Qxalign_release(self);
+        Qxalign_leave(self);
+        if (status != 0) {
+                return NULL;
+        }
+        Py_RETURN_NONE;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_print_trace
+ *  Description:  Print CIGAR traceback of the alignment
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_print_trace(Qxalign* self)
+{
+        if (Qxalign_idle(self) != 0) {
+                return NULL;
+        }
+        asw_print_cigar_range(self->cigar, self->cigar + self->cigar_len, stdout);
+        Py_RETURN_NONE;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_show_pair
+ *  Description:  Return gapped reference and query rows of the alignment as a pair
+ *                of bytes objects, rendered directly into them
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_show_pair(Qxalign* self)
+{
+        if (Qxalign_idle(self) != 0) {
+                return NULL;
+        }
+        const cigar_t *cigar_end = self->cigar + self->cigar_len;
+        const char *ref = (const char*)self->db_seq.buf + self->offset,
+                   *query = (const char*)self->query_seq.buf;
+        size_t len = asw_render_pair_range(self->cigar, cigar_end, ref, query,
+                                           NULL, NULL, 0u);
+        if (len == (size_t)-1) {
+                PyErr_SetString(PyExc_ValueError, "unknown CIGAR operation");
+                return NULL;
+        }
+        PyObject *ref_row = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)len),
+                 *query_row = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)len);
+        if (ref_row == NULL || query_row == NULL) {
+                Py_XDECREF(ref_row);
+                Py_XDECREF(query_row);
+                return NULL;
+        }
+        /* bytes objects have room for the terminating NUL */
+        asw_render_pair_range(self->cigar, cigar_end, ref, query,
+                              PyBytes_AS_STRING(ref_row),
+                              PyBytes_AS_STRING(query_row),
+                              len + 1u);
+        return Py_BuildValue("(NN)", ref_row, query_row);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_align_full
+ *  Description:  Assign sequences, align and trace in a single call; return a
+ *                tuple (score, offset, CIGAR, end), where offset and end delimit
+ *                the aligned part of the reference
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_align_full(Qxalign* self, PyObject *args, PyObject *kwds)
+{
+        Py_buffer db_seq, query_seq, query_qual;
+
+        db_seq.buf = NULL;
+        query_seq.buf = NULL;
+        query_qual.buf = NULL;
+
+        int phred_offset = 33,
+            assume_phred = PHRED_RANGE - 1,
+            semi = 0,
+            softclip = 0,
+            compact = 0,
+            md = 0,
+            sam = 1;
+
+        static char *kwlist[] = {
+                "db_seq",
+                "query_seq",
+                "query_qual",
+                "phred_offset",
+                "assume_phred",
+                "semi",
+                "softclip",
+                "compact",
+                "md",
+                "sam",
+                NULL /*  Sentinel */
+        };
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "z*z*|z*iipppp$p", kwlist,
+                                         &db_seq,
+                                         &query_seq,
+                                         &query_qual,
+                                         &phred_offset,
+                                         &assume_phred,
+                                         &semi,
+                                         &softclip,
+                                         &compact,
+                                         &md,
+                                         &sam))
+        {
+                return NULL;
+        }
+        if (Qxalign_enter(self) != 0) {
+                if (db_seq.buf != NULL) PyBuffer_Release(&db_seq);
+                if (query_seq.buf != NULL) PyBuffer_Release(&query_seq);
+                if (query_qual.buf != NULL) PyBuffer_Release(&query_qual);
+                return NULL;
+        }
+        if (Qxalign_cigar_unlocked(self) != 0) {
+                if (db_seq.buf != NULL) PyBuffer_Release(&db_seq);
+                if (query_seq.buf != NULL) PyBuffer_Release(&query_seq);
+                if (query_qual.buf != NULL) PyBuffer_Release(&query_qual);
+                goto error;
+        }
+        Qxalign_release(self);
+        if (Qxalign_store(self, &db_seq, &query_seq, &query_qual,
+                          phred_offset, assume_phred) != 0)
+        {
+                goto error;
+        }
+        if (self->db_seq.len == 0 || self->query_seq.len == 0) {
+                PyErr_SetString(PyExc_IndexError,
+                        "cannot perform alignment on a zero-element matrix");
+                goto error;
+        }
+        if (self->fx == NULL &&
+            (self->al = pool_borrow(self->match,
+                                    self->mismatch,
+                                    self->gap_open_extend,
+                                    self->gap_extend)) == NULL)
+        {
+                PyErr_SetString(PyExc_MemoryError, "cannot allocate alignment object");
+                goto error;
+        }
+        asw_set_phoffset(self->al, self->phred_offset);
+
+        unsigned int flags = (semi ? ASW_ALIGN_SEMI : 0u)
+                           | (softclip ? ASW_TRACE_SOFTCLIP : 0u)
+                           | (compact ? ASW_TRACE_COMPACT : 0u)
+                           | (md ? ASW_TRACE_MD : 0u);
+        int status;
+        Py_BEGIN_ALLOW_THREADS
+        status = asw_align_full(self->al,
+                    (const char*)self->db_seq.buf,
+                    self->db_seq.len,
+                    (const char*)self->query_seq.buf,
+                    self->qual,
+                    self->query_seq.len, 0u, 0u, flags);
+        Py_END_ALLOW_THREADS
+        if (status != 0) {
+                Qxalign_release(self);
+                if (self->fx != NULL) {
+                        PyErr_Format(PyExc_ValueError,
+                                "sequences exceed capacity of fixed workspace (%d, %d)",
+                                ASW_FIXED_DB_MAX, ASW_FIXED_QUERY_MAX);
+                } else {
+                        PyErr_SetString(PyExc_MemoryError, "cannot resize alignment object");
+                }
+                goto error;
+        }
+        int score = self->al->opt_score;
+        status = Qxalign_keep(self, md);
+        Qxalign_release(self);
+        Qxalign_leave(self);
+        if (status != 0) {
+                return NULL;
+        }
+
+        const cigar_t *cigar_end = self->cigar + self->cigar_len;
+        size_t end = self->offset + asw_cigar_ref_len(self->cigar, cigar_end);
+
+        int style = sam ? ASW_CIGAR_SAM : ASW_CIGAR_SPACED;
+        size_t len = asw_format_cigar_range(self->cigar, cigar_end, NULL, 0u, style);
+        PyObject *str = PyUnicode_New((Py_ssize_t)len, 127);
+        if (str == NULL) {
+                return NULL;
+        }
+        asw_format_cigar_range(self->cigar, cigar_end,
+                               (char*)PyUnicode_1BYTE_DATA(str), len + 1u, style);
+        return Py_BuildValue("(inNn)", score, (Py_ssize_t)self->offset, str,
+                             (Py_ssize_t)end);
+error:
+        Qxalign_leave(self);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_batch
+ *  Description:  Worker threads for align_many, started with the penalties of the
+ *                instance. The pool is kept between calls and restarted when asked
+ *                for another number of threads or PHRED offset. Sets a Python
+ *                exception and returns NULL on failure.
+ * =====================================================================================
+ */
+static ASW_Batch*
+Qxalign_batch(Qxalign* self, int threads, int phred_offset)
+{
+        if (threads < 0 || threads > QXALIGN_MAX_THREADS) {
+                PyErr_Format(PyExc_ValueError,
+                        "number of threads %d is outside of valid range 0-%d",
+                        threads, QXALIGN_MAX_THREADS);
+                return NULL;
+        }
+        if (self->batch != NULL &&
+            self->batch_threads == (unsigned int)threads && self->batch_phred == phred_offset)
+        {
+                return self->batch;
+        }
+        asw_batch_free(self->batch);
+        self->batch = NULL;
+
+        ASW_BatchOptions opt;
+        asw_batch_options_init(&opt);
+        opt.nthreads = (unsigned int)threads;
+        opt.match = self->match;
+        opt.mismatch = self->mismatch;
+        opt.gap_open_extend = self->gap_open_extend;
+        opt.gap_extend = self->gap_extend;
+        opt.phred_offset = phred_offset;
+        if ((self->batch = asw_batch_new(&opt)) == NULL) {
+                PyErr_SetString(PyExc_MemoryError, "cannot start alignment threads");
+                return NULL;
+        }
+        self->batch_threads = (unsigned int)threads;
+        self->batch_phred = phred_offset;
+        return self->batch;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_run_batch
+ *  Description:  Perform n jobs on the worker threads with the GIL released. The
+ *                caller holds the object (Qxalign_enter) and the buffers the jobs
+ *                point into. Jobs that fail are left with status -1 for the caller
+ *                to report. Sets a Python exception and returns -1 if the workers
+ *                cannot be started, leaving no results to clear.
+ * =====================================================================================
+ */
+static int
+Qxalign_run_batch(Qxalign* self, const ASW_Job* jobs, ASW_Result* results, size_t n,
+                  int threads, int phred_offset)
+{
+        ASW_Batch *batch = Qxalign_batch(self, threads, phred_offset);
+        if (batch == NULL) {
+                return -1;
+        }
+        Py_BEGIN_ALLOW_THREADS
+        asw_batch_run(batch, jobs, results, n);
+        Py_END_ALLOW_THREADS
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  many_view
+ *  Description:  Byte view of a str (its UTF-8 form) or of a bytes-like object, as
+ *                the "s*" format unit gives. Sets a Python exception and returns -1
+ *                on failure.
+ * =====================================================================================
+ */
+static int
+many_view(PyObject* obj, Py_buffer* view)
+{
+        if (PyUnicode_Check(obj)) {
+                Py_ssize_t len;
+                const char *str = PyUnicode_AsUTF8AndSize(obj, &len);
+                if (str == NULL) {
+                        return -1;
+                }
+                return PyBuffer_FillInfo(view, obj, (void*)str, len, 1, PyBUF_SIMPLE);
+        }
+        return PyObject_GetBuffer(obj, view, PyBUF_SIMPLE);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  many_results
+ *  Description:  List of (score, offset, CIGAR, end) tuples of n batch results, as
+ *                align_full returns them. Jobs run without traceback have None for
+ *                offset and CIGAR, and end at the column of the minimum score
+ *                (before any soft clipping). Failed jobs have None in place of
+ *                the tuple.
+ * =====================================================================================
+ */
+static PyObject *
+many_results(const ASW_Job* jobs, const ASW_Result* results, size_t n, int style)
+{
+        PyObject *list = PyList_New((Py_ssize_t)n);
+        if (list == NULL) {
+                return NULL;
+        }
+        size_t i;
+        for (i = 0u; i < n; ++i) {
+                const ASW_Result *r = &results[i];
+                PyObject *item;
+                if (r->status != 0) {
+                        Py_INCREF(Py_None);
+                        item = Py_None;
+                } else if (jobs[i].flags & ASW_JOB_SCORE_ONLY) {
+                        item = Py_BuildValue("(iOOn)", r->score, Py_None, Py_None,
+                                             (Py_ssize_t)r->end_col);
+                } else {
+                        const cigar_t *cigar_end = r->cigar + r->n_cigar;
+                        size_t len = asw_format_cigar_range(r->cigar, cigar_end,
+                                                            NULL, 0u, style);
+                        PyObject *str = PyUnicode_New((Py_ssize_t)len, 127);
+                        if (str == NULL) {
+                                Py_DECREF(list);
+                                return NULL;
+                        }
+                        asw_format_cigar_range(r->cigar, cigar_end,
+                                               (char*)PyUnicode_1BYTE_DATA(str),
+                                               len + 1u, style);
+                        size_t end = r->offset + asw_cigar_ref_len(r->cigar, cigar_end);
+                        item = Py_BuildValue("(inNn)", r->score, (Py_ssize_t)r->offset,
+                                             str, (Py_ssize_t)end);
+                }
+                if (item == NULL) {
+                        Py_DECREF(list);
+                        return NULL;
+                }
+                PyList_SET_ITEM(list, (Py_ssize_t)i, item);
+        }
+        return list;
+}
+
+/*-----------------------------------------------------------------------------
+ *  BatchResult type: outcome of a batch as contiguous columns, one entry per
+ *  alignment (CIGARs back to back in one array), so that numpy and the like
+ *  take them over without a Python object per alignment. Each column is a
+ *  bytes object filled in place and handed out as a read-only typed memoryview.
+ *-----------------------------------------------------------------------------*/
+typedef struct {
+        PyObject_HEAD
+        Py_ssize_t n;
+        int style;               /* ASW_CIGAR_* of CIGARs returned by sq_item */
+        PyObject* scores;        /* int32 */
+        PyObject* offsets;       /* int64, -1 without traceback */
+        PyObject* ends;          /* int64, -1 if failed */
+        PyObject* nm;            /* uint32 */
+        PyObject* cigar_offsets; /* int64, n + 1 entries into cigars */
+        PyObject* cigars;        /* uint32, BAM-packed */
+        PyObject* status;        /* int32, 0 or -1 if the alignment failed */
+} BatchResult;
+
+static PyTypeObject BatchResultType;
+
+/* column of BatchResult and the struct format of its items */
+typedef struct {
+        size_t member;
+        const char* format;
+} BatchColumn;
+
+static const BatchColumn batch_columns[] = {
+        {offsetof(BatchResult, scores), "i"},
+        {offsetof(BatchResult, offsets), "q"},
+        {offsetof(BatchResult, ends), "q"},
+        {offsetof(BatchResult, nm), "I"},
+        {offsetof(BatchResult, cigar_offsets), "q"},
+        {offsetof(BatchResult, cigars), "I"},
+        {offsetof(BatchResult, status), "i"},
+};
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  BatchResult_dealloc
+ *  Description:  deallocate an instance of BatchResult
+ * =====================================================================================
+ */
+static void
+BatchResult_dealloc(BatchResult* self)
+{
+        Py_XDECREF(self->scores);
+        Py_XDECREF(self->offsets);
+        Py_XDECREF(self->ends);
+        Py_XDECREF(self->nm);
+        Py_XDECREF(self->cigar_offsets);
+        Py_XDECREF(self->cigars);
+        Py_XDECREF(self->status);
+        Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  BatchResult_column
+ *  Description:  Getter of a column: read-only memoryview of the bytes object
+ *                holding it, cast to the item format
+ * =====================================================================================
+ */
+static PyObject *
+BatchResult_column(BatchResult* self, void* closure)
+{
+        const BatchColumn *column = (const BatchColumn*)closure;
+        PyObject *bytes = *(PyObject**)((char*)self + column->member);
+        PyObject *raw = PyMemoryView_FromObject(bytes);
+        if (raw == NULL) {
+                return NULL;
+        }
+        PyObject *view = PyObject_CallMethod(raw, "cast", "s", column->format);
+        Py_DECREF(raw);
+        return view;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  BatchResult_length
+ *  Description:  sq_length: number of alignments
+ * =====================================================================================
+ */
+static Py_ssize_t
+BatchResult_length(BatchResult* self)
+{
+        return self->n;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  BatchResult_item
+ *  Description:  sq_item: (score, offset, CIGAR, end) of one alignment, or None if
+ *                it failed, as the list form of the batch methods gives it (same
+ *                CIGAR style)
+ * =====================================================================================
+ */
+static PyObject *
+BatchResult_item(BatchResult* self, Py_ssize_t i)
+{
+        if (i < 0 || i >= self->n) {
+                PyErr_SetString(PyExc_IndexError, "BatchResult index out of range");
+                return NULL;
+        }
+        if (((const int32_t*)PyBytes_AS_STRING(self->status))[i] != 0) {
+                Py_RETURN_NONE;
+        }
+        int32_t score = ((const int32_t*)PyBytes_AS_STRING(self->scores))[i];
+        int64_t offset = ((const int64_t*)PyBytes_AS_STRING(self->offsets))[i],
+                end = ((const int64_t*)PyBytes_AS_STRING(self->ends))[i];
+        if (offset < 0) {
+                return Py_BuildValue("(iOOL)", (int)score, Py_None, Py_None,
+                                     (long long)end);
+        }
+        const int64_t *cigar_offsets = (const int64_t*)PyBytes_AS_STRING(self->cigar_offsets);
+        const cigar_t *cigars = (const cigar_t*)PyBytes_AS_STRING(self->cigars),
+                      *cigar_begin = cigars + cigar_offsets[i],
+                      *cigar_end = cigars + cigar_offsets[i + 1];
+        size_t len = asw_format_cigar_range(cigar_begin, cigar_end, NULL, 0u, self->style);
+        PyObject *str = PyUnicode_New((Py_ssize_t)len, 127);
+        if (str == NULL) {
+                return NULL;
+        }
+        asw_format_cigar_range(cigar_begin, cigar_end,
+                               (char*)PyUnicode_1BYTE_DATA(str), len + 1u, self->style);
+        return Py_BuildValue("(iLNL)", (int)score, (long long)offset, str,
+                             (long long)end);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  many_columns
+ *  Description:  BatchResult of n batch results, whose items format CIGARs in the
+ *                given ASW_CIGAR_* style. Ends are those of the list form:
+ *                end of the traced alignment in the reference, or the column of the
+ *                minimum score for jobs run without traceback (offset -1). Failed
+ *                jobs have status -1, offset and end -1 and no CIGAR.
+ * =====================================================================================
+ */
+static PyObject *
+many_columns(const ASW_Job* jobs, const ASW_Result* results, size_t n, int style)
+{
+        size_t i, n_cigars = 0u;
+        for (i = 0u; i < n; ++i) {
+                n_cigars += results[i].n_cigar;
+        }
+        /* tp_alloc clears the columns, so that a partial one can be deallocated */
+        BatchResult *self = (BatchResult*)BatchResultType.tp_alloc(&BatchResultType, 0);
+        if (self == NULL) {
+                return NULL;
+        }
+        self->n = (Py_ssize_t)n;
+        self->style = style;
+        if ((self->scores = PyBytes_FromStringAndSize(NULL,
+                        (Py_ssize_t)(sizeof(int32_t) * n))) == NULL ||
+            (self->offsets = PyBytes_FromStringAndSize(NULL,
+                        (Py_ssize_t)(sizeof(int64_t) * n))) == NULL ||
+            (self->ends = PyBytes_FromStringAndSize(NULL,
+                        (Py_ssize_t)(sizeof(int64_t) * n))) == NULL ||
+            (self->nm = PyBytes_FromStringAndSize(NULL,
+                        (Py_ssize_t)(sizeof(uint32_t) * n))) == NULL ||
+            (self->cigar_offsets = PyBytes_FromStringAndSize(NULL,
+                        (Py_ssize_t)(sizeof(int64_t) * (n + 1u)))) == NULL ||
+            (self->cigars = PyBytes_FromStringAndSize(NULL,
+                        (Py_ssize_t)(sizeof(cigar_t) * n_cigars))) == NULL ||
+            (self->status = PyBytes_FromStringAndSize(NULL,
+                        (Py_ssize_t)(sizeof(int32_t) * n))) == NULL)
+        {
+                Py_DECREF(self);
+                return NULL;
+        }
+
+        int32_t *scores = (int32_t*)PyBytes_AS_STRING(self->scores);
+        int64_t *offsets = (int64_t*)PyBytes_AS_STRING(self->offsets),
+                *ends = (int64_t*)PyBytes_AS_STRING(self->ends),
+                *cigar_offsets = (int64_t*)PyBytes_AS_STRING(self->cigar_offsets);
+        int32_t *status = (int32_t*)PyBytes_AS_STRING(self->status);
+        uint32_t *nm = (uint32_t*)PyBytes_AS_STRING(self->nm);
+        cigar_t *cigars = (cigar_t*)PyBytes_AS_STRING(self->cigars);
+        size_t pos = 0u;
+        for (i = 0u; i < n; ++i) {
+                const ASW_Result *r = &results[i];
+                scores[i] = r->score;
+                nm[i] = r->nm;
+                status[i] = r->status;
+                cigar_offsets[i] = (int64_t)pos;
+                if (r->status != 0) {
+                        offsets[i] = -1;
+                        ends[i] = -1;
+                } else if (jobs[i].flags & ASW_JOB_SCORE_ONLY) {
+                        offsets[i] = -1;
+                        ends[i] = (int64_t)r->end_col;
+                } else {
+                        offsets[i] = (int64_t)r->offset;
+                        ends[i] = (int64_t)(r->offset +
+                                asw_cigar_ref_len(r->cigar, r->cigar + r->n_cigar));
+                        if (r->n_cigar > 0u) {
+                                memcpy(cigars + pos, r->cigar, sizeof(cigar_t) * r->n_cigar);
+                                pos += r->n_cigar;
+                        }
+                }
+        }
+        cigar_offsets[n] = (int64_t)pos;
+        return (PyObject*)self;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_align_many
+ *  Description:  Align a sequence of queries (with an optional sequence of quality
+ *                strings) against one reference on native worker threads, with the
+ *                GIL released for the whole batch; return a list of (score, offset,
+ *                CIGAR, end) tuples in input order, or a BatchResult of columns
+ *                with columnar=True
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_align_many(Qxalign* self, PyObject *args, PyObject *kwds)
+{
+        PyObject *queries, *quals = Py_None;
+        Py_buffer db_seq;
+        int threads = 0;
+        int phred_offset = 33,
+            assume_phred = PHRED_RANGE - 1,
+            trace = 1,
+            semi = 0,
+            softclip = 0,
+            compact = 0,
+            sam = 1,
+            columnar = 0;
+
+        static char *kwlist[] = {
+                "db_seq",
+                "queries",
+                "quals",
+                "threads",
+                "phred_offset",
+                "assume_phred",
+                "trace",
+                "semi",
+                "softclip",
+                "compact",
+                "sam",
+                "columnar",
+                NULL /*  Sentinel */
+        };
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "s*O|O$iiipppppp", kwlist,
+                                         &db_seq,
+                                         &queries,
+                                         &quals,
+                                         &threads,
+                                         &phred_offset,
+                                         &assume_phred,
+                                         &trace,
+                                         &semi,
+                                         &softclip,
+                                         &compact,
+                                         &sam,
+                                         &columnar))
+        {
+                return NULL;
+        }
+
+        PyObject *seq_list = NULL, *qual_list = NULL, *list = NULL;
+        Py_buffer *views = NULL;
+        ASW_Job *jobs = NULL;
+        ASW_Result *results = NULL;
+        uint8_t *default_qual = NULL;
+        Py_ssize_t n = 0, n_views = 0, i;
+        size_t max_len = 0u;
+        int entered = 0;
+
+        if (assume_phred >= PHRED_RANGE || assume_phred < 0) {
+                PyErr_Format(PyExc_IndexError,
+                        "assumed PHRED score %d is outside of valid range 0-%d",
+                        assume_phred, PHRED_RANGE - 1);
+                goto error;
+        }
+        if (db_seq.len == 0) {
+                PyErr_SetString(PyExc_IndexError,
+                        "cannot perform alignment on a zero-element matrix");
+                goto error;
+        }
+        if ((seq_list = PySequence_Fast(queries, "queries must be a sequence")) == NULL) {
+                goto error;
+        }
+        n = PySequence_Fast_GET_SIZE(seq_list);
+        if (quals != Py_None) {
+                if ((qual_list = PySequence_Fast(quals, "quals must be a sequence")) == NULL) {
+                        goto error;
+                }
+                if (PySequence_Fast_GET_SIZE(qual_list) != n) {
+                        PyErr_SetString(PyExc_ValueError,
+                                "quals must have as many entries as queries");
+                        goto error;
+                }
+        }
+        views = PyMem_Malloc(sizeof(Py_buffer) * 2u * (size_t)(n > 0 ? n : 1));
+        jobs = PyMem_Malloc(sizeof(ASW_Job) * (size_t)(n > 0 ? n : 1));
+        results = PyMem_Malloc(sizeof(ASW_Result) * (size_t)(n > 0 ? n : 1));
+        if (views == NULL || jobs == NULL || results == NULL) {
+                PyErr_NoMemory();
+                goto error;
+        }
+
+        unsigned int flags = (semi ? ASW_ALIGN_SEMI : 0u)
+                           | (softclip ? ASW_TRACE_SOFTCLIP : 0u)
+                           | (compact ? ASW_TRACE_COMPACT : 0u)
+                           | (trace ? 0u : ASW_JOB_SCORE_ONLY);
+        for (i = 0; i < n; ++i) {
+                Py_buffer *seq = &views[n_views];
+                if (many_view(PySequence_Fast_GET_ITEM(seq_list, i), seq) != 0) {
+                        goto error;
+                }
+                ++n_views;
+                if (seq->len == 0) {
                         PyErr_Format(PyExc_IndexError,
-                                "assumed PHRED score %d is outside of valid range 0-%d",
-                                assume_phred, PHRED_RANGE - 1);
-                        return NULL;
+                                "cannot perform alignment on a zero-element matrix (query %zd)",
+                                i);
+                        goto error;
                 }
-                /* maintain a buffer with default PHRED scores */
-                uint8_t* tmp = PyMem_Realloc(self->default_qual,
-                                             sizeof(uint8_t) * self->query_seq.len);
-                if (tmp == NULL) {
-                        PyErr_SetString(PyExc_MemoryError,
-                                "cannot resize default quality score array");
-                        return NULL;
+                ASW_Job *job = &jobs[i];
+                job->db = (const char*)db_seq.buf;
+                job->db_len = (size_t)db_seq.len;
+                job->query = (const char*)seq->buf;
+                job->qual = NULL;
+                job->query_len = (size_t)seq->len;
+                job->clip_head = job->clip_tail = 0u;
+                job->flags = flags;
+
+                PyObject *qual = qual_list != NULL ?
+                        PySequence_Fast_GET_ITEM(qual_list, i) : Py_None;
+                if (qual != Py_None) {
+                        Py_buffer *q = &views[n_views];
+                        if (many_view(qual, q) != 0) {
+                                goto error;
+                        }
+                        ++n_views;
+                        if (q->len < seq->len) {
+                                PyErr_Format(PyExc_IndexError,
+                                        "quality score array is shorter than query sequence (query %zd)",
+                                        i);
+                                goto error;
+                        }
+                        job->qual = (const uint8_t*)q->buf;
+                } else if (job->query_len > max_len) {
+                        max_len = job->query_len;
                 }
-                self->default_qual = tmp;
+        }
+        if (max_len > 0u) {
+                /* one buffer of default PHRED scores serves all queries without any */
+                if ((default_qual = PyMem_Malloc(max_len)) == NULL) {
+                        PyErr_NoMemory();
+                        goto error;
+                }
+                memset(default_qual, assume_phred + phred_offset, max_len);
+                for (i = 0; i < n; ++i) {
+                        if (jobs[i].qual == NULL) jobs[i].qual = default_qual;
+                }
+        }
 
-                memset(tmp, assume_phred + phred_offset, self->query_seq.len);
-                final_qual = tmp;
+        if (Qxalign_enter(self) != 0) {
+                goto error;
+        }
+        entered = 1;
+        if (Qxalign_run_batch(self, jobs, results, (size_t)n, threads, phred_offset) != 0) {
+                goto error;
         }
+        int style = sam ? ASW_CIGAR_SAM : ASW_CIGAR_SPACED;
+        list = columnar ? many_columns(jobs, results, (size_t)n, style)
+                        : many_results(jobs, results, (size_t)n, style);
+        asw_result_clear(results, (size_t)n);
+error:
+        if (entered) Qxalign_leave(self);
+        while (n_views > 0) {
+                PyBuffer_Release(&views[--n_views]);
+        }
+        PyMem_Free(default_qual);
+        PyMem_Free(results);
+        PyMem_Free(jobs);
+        PyMem_Free(views);
+        Py_XDECREF(qual_list);
+        Py_XDECREF(seq_list);
+        PyBuffer_Release(&db_seq);
+        return list;
+}
 
-        if (asw_prepare(self->al,
-                    (const char*)self->db_seq.buf,
-                    self->db_seq.len,
-                    (const char*)self->query_seq.buf,
-                    (const uint8_t*)final_qual,
-                    self->query_seq.len, 0u, 0u)
-                != 0)
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  ragged_view
+ *  Description:  View of a one-dimensional array of 32- or 64-bit integers (offsets
+ *                or window numbers of align_ragged), such as a numpy int64 array or
+ *                array.array("q"). Sets a Python exception and returns -1 on failure.
+ * =====================================================================================
+ */
+static int
+ragged_view(PyObject* obj, Py_buffer* view, const char* name)
+{
+        if (PyObject_GetBuffer(obj, view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) != 0) {
+                return -1;
+        }
+        const char *format = view->format != NULL ? view->format : "B";
+        if (*format == '@' || *format == '=') ++format;
+        if (view->ndim != 1 || format[0] == '\0' || format[1] != '\0' ||
+            strchr("ilqnILQN", format[0]) == NULL ||
+            (view->itemsize != 4 && view->itemsize != 8))
+        {
+                PyErr_Format(PyExc_TypeError,
+                        "%s must be a one-dimensional array of 32- or 64-bit integers",
+                        name);
+                PyBuffer_Release(view);
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  ragged_get
+ *  Description:  i-th element of an array checked by ragged_view; unsigned values
+ *                beyond the range of long long come out negative
+ * =====================================================================================
+ */
+static long long
+ragged_get(const Py_buffer* view, Py_ssize_t i)
+{
+        int is_signed = view->format == NULL ||
+                        strpbrk(view->format, "ilqn") != NULL;
+        if (view->itemsize == 4) {
+                return is_signed ? (long long)((const int32_t*)view->buf)[i]
+                                 : (long long)((const uint32_t*)view->buf)[i];
+        }
+        return is_signed ? (long long)((const int64_t*)view->buf)[i]
+                         : (long long)((const uint64_t*)view->buf)[i];
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  ragged_bounds
+ *  Description:  Check that offsets, an array of n + 1 entries, are non-decreasing
+ *                and within a buffer of len bytes. Sets a Python exception and
+ *                returns -1 otherwise.
+ * =====================================================================================
+ */
+static int
+ragged_bounds(const Py_buffer* offsets, Py_ssize_t len, const char* name)
+{
+        Py_ssize_t i, n = offsets->len / offsets->itemsize;
+        long long prev = 0;
+        if (n < 1) {
+                PyErr_Format(PyExc_ValueError, "%s must have at least one entry", name);
+                return -1;
+        }
+        for (i = 0; i < n; ++i) {
+                long long off = ragged_get(offsets, i);
+                if (off < prev || off > (long long)len) {
+                        PyErr_Format(PyExc_ValueError,
+                                "%s must be non-decreasing and within the buffer (entry %zd)",
+                                name, i);
+                        return -1;
+                }
+                prev = off;
+        }
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_align_ragged
+ *  Description:  Align records stored back to back in one sequence buffer (and one
+ *                quality buffer laid out alike), delimited by an offsets array of
+ *                n + 1 entries, without a Python object per record. The reference
+ *                is one sequence, or several windows delimited by db_offsets, with
+ *                windows[i] the window of record i (record i against window i if
+ *                windows is not given). Return a list of (score, offset, CIGAR, end)
+ *                tuples (or a BatchResult) as align_many does, with offset and end
+ *                within the window.
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_align_ragged(Qxalign* self, PyObject *args, PyObject *kwds)
+{
+        PyObject *seqs_obj, *offsets_obj, *quals_obj = Py_None,
+                 *db_offsets_obj = Py_None, *windows_obj = Py_None;
+        Py_buffer db_seq;
+        int threads = 0;
+        int phred_offset = 33,
+            assume_phred = PHRED_RANGE - 1,
+            trace = 1,
+            semi = 0,
+            softclip = 0,
+            compact = 0,
+            sam = 1,
+            columnar = 0;
+
+        static char *kwlist[] = {
+                "db_seq",
+                "seqs",
+                "offsets",
+                "quals",
+                "db_offsets",
+                "windows",
+                "threads",
+                "phred_offset",
+                "assume_phred",
+                "trace",
+                "semi",
+                "softclip",
+                "compact",
+                "sam",
+                "columnar",
+                NULL /*  Sentinel */
+        };
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "s*OO|O$OOiiipppppp", kwlist,
+                                         &db_seq,
+                                         &seqs_obj,
+                                         &offsets_obj,
+                                         &quals_obj,
+                                         &db_offsets_obj,
+                                         &windows_obj,
+                                         &threads,
+                                         &phred_offset,
+                                         &assume_phred,
+                                         &trace,
+                                         &semi,
+                                         &softclip,
+                                         &compact,
+                                         &sam,
+                                         &columnar))
         {
-                PyErr_SetString(PyExc_MemoryError, "cannot resize alignment object");
                 return NULL;
         }
-        asw_set_phoffset(self->al, phred_offset);
 
-        Py_RETURN_NONE;
+        /* views are released in reverse order of acquisition */
+        Py_buffer views[5];
+        Py_buffer *seqs = &views[0], *offsets = &views[1], *quals = NULL,
+                  *db_offsets = NULL, *windows = NULL;
+        PyObject *list = NULL;
+        ASW_Job *jobs = NULL;
+        ASW_Result *results = NULL;
+        uint8_t *default_qual = NULL;
+        Py_ssize_t n = 0, n_windows = 1, n_views = 0, i;
+        size_t max_len = 0u;
+        int entered = 0;
+
+        if (assume_phred >= PHRED_RANGE || assume_phred < 0) {
+                PyErr_Format(PyExc_IndexError,
+                        "assumed PHRED score %d is outside of valid range 0-%d",
+                        assume_phred, PHRED_RANGE - 1);
+                goto error;
+        }
+        if (many_view(seqs_obj, seqs) != 0) goto error;
+        ++n_views;
+        if (ragged_view(offsets_obj, offsets, "offsets") != 0) goto error;
+        ++n_views;
+        if (ragged_bounds(offsets, seqs->len, "offsets") != 0) goto error;
+        n = offsets->len / offsets->itemsize - 1;
+        if (quals_obj != Py_None) {
+                quals = &views[n_views];
+                if (many_view(quals_obj, quals) != 0) goto error;
+                ++n_views;
+                if (quals->len < seqs->len) {
+                        PyErr_SetString(PyExc_IndexError,
+                                "quality score buffer is shorter than sequence buffer");
+                        goto error;
+                }
+        }
+        if (db_offsets_obj != Py_None) {
+                db_offsets = &views[n_views];
+                if (ragged_view(db_offsets_obj, db_offsets, "db_offsets") != 0) goto error;
+                ++n_views;
+                if (ragged_bounds(db_offsets, db_seq.len, "db_offsets") != 0) goto error;
+                n_windows = db_offsets->len / db_offsets->itemsize - 1;
+        }
+        if (windows_obj != Py_None) {
+                if (db_offsets == NULL) {
+                        PyErr_SetString(PyExc_ValueError, "windows requires db_offsets");
+                        goto error;
+                }
+                windows = &views[n_views];
+                if (ragged_view(windows_obj, windows, "windows") != 0) goto error;
+                ++n_views;
+                if (windows->len / windows->itemsize != n) {
+                        PyErr_SetString(PyExc_ValueError,
+                                "windows must have one entry per record");
+                        goto error;
+                }
+        } else if (db_offsets != NULL && n_windows != n) {
+                PyErr_SetString(PyExc_ValueError,
+                        "without windows, db_offsets must delimit one window per record");
+                goto error;
+        }
+
+        jobs = PyMem_Malloc(sizeof(ASW_Job) * (size_t)(n > 0 ? n : 1));
+        results = PyMem_Malloc(sizeof(ASW_Result) * (size_t)(n > 0 ? n : 1));
+        if (jobs == NULL || results == NULL) {
+                PyErr_NoMemory();
+                goto error;
+        }
+
+        unsigned int flags = (semi ? ASW_ALIGN_SEMI : 0u)
+                           | (softclip ? ASW_TRACE_SOFTCLIP : 0u)
+                           | (compact ? ASW_TRACE_COMPACT : 0u)
+                           | (trace ? 0u : ASW_JOB_SCORE_ONLY);
+        for (i = 0; i < n; ++i) {
+                long long start = ragged_get(offsets, i),
+                          end = ragged_get(offsets, i + 1);
+                long long window = windows != NULL ? ragged_get(windows, i) : i;
+                long long db_start = 0, db_end = db_seq.len;
+                if (db_offsets != NULL) {
+                        if (window < 0 || window >= n_windows) {
+                                PyErr_Format(PyExc_IndexError,
+                                        "window %lld of record %zd is out of range",
+                                        window, i);
+                                goto error;
+                        }
+                        db_start = ragged_get(db_offsets, (Py_ssize_t)window);
+                        db_end = ragged_get(db_offsets, (Py_ssize_t)window + 1);
+                }
+                if (start == end || db_start == db_end) {
+                        PyErr_Format(PyExc_IndexError,
+                                "cannot perform alignment on a zero-element matrix (record %zd)",
+                                i);
+                        goto error;
+                }
+                ASW_Job *job = &jobs[i];
+                job->db = (const char*)db_seq.buf + db_start;
+                job->db_len = (size_t)(db_end - db_start);
+                job->query = (const char*)seqs->buf + start;
+                job->qual = quals != NULL ? (const uint8_t*)quals->buf + start : NULL;
+                job->query_len = (size_t)(end - start);
+                job->clip_head = job->clip_tail = 0u;
+                job->flags = flags;
+                if (quals == NULL && job->query_len > max_len) {
+                        max_len = job->query_len;
+                }
+        }
+        if (max_len > 0u) {
+                if ((default_qual = PyMem_Malloc(max_len)) == NULL) {
+                        PyErr_NoMemory();
+                        goto error;
+                }
+                memset(default_qual, assume_phred + phred_offset, max_len);
+                for (i = 0; i < n; ++i) {
+                        jobs[i].qual = default_qual;
+                }
+        }
+
+        if (Qxalign_enter(self) != 0) {
+                goto error;
+        }
+        entered = 1;
+        if (Qxalign_run_batch(self, jobs, results, (size_t)n, threads, phred_offset) != 0) {
+                goto error;
+        }
+        int style = sam ? ASW_CIGAR_SAM : ASW_CIGAR_SPACED;
+        list = columnar ? many_columns(jobs, results, (size_t)n, style)
+                        : many_results(jobs, results, (size_t)n, style);
+        asw_result_clear(results, (size_t)n);
+error:
+        if (entered) Qxalign_leave(self);
+        while (n_views > 0) {
+                PyBuffer_Release(&views[--n_views]);
+        }
+        PyMem_Free(default_qual);
+        PyMem_Free(results);
+        PyMem_Free(jobs);
+        PyBuffer_Release(&db_seq);
+        return list;
 }
+
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  Qxalign_align
- *  Description:  Perofrm alignment
+ *         Name:  Qxalign_trace_stats
+ *  Description:  Return edit statistics of the last traceback as a dictionary
  * =====================================================================================
  */
 static PyObject *
-Qxalign_align(Qxalign* self, PyObject *args, PyObject *kwds)
+Qxalign_trace_stats(Qxalign* self)
 {
-        PyObject *x = Py_False;
-        static char *kwlist[] = {"semi", NULL};
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:bool", kwlist, &x)) {
+        if (Qxalign_idle(self) != 0) {
                 return NULL;
         }
-        int semi = PyObject_IsTrue(x);
+        return Py_BuildValue("{s:I,s:I,s:I,s:I,s:I,s:O}",
+                             "matches", self->n_match,
+                             "mismatches", self->n_mismatch,
+                             "insertions", self->n_ins,
+                             "deletions", self->n_del,
+                             "nm", self->nm,
+                             "md", self->md != NULL ? self->md : Py_None);
+}
 
-        if (self->al->subdb_len == 0u || self->al->subquery_len == 0u) {
-                PyErr_SetString(PyExc_IndexError,
-                        "cannot perform alignment on a zero-element matrix");
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_show_trace
+ *  Description:  Return CIGAR traceback of the alignment as a string, formatted
+ *                directly into the string object
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_show_trace(Qxalign* self, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = {"sam", NULL};
+        int sam = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p", kwlist, &sam) ||
+            Qxalign_idle(self) != 0)
+        {
                 return NULL;
         }
-        if (semi) {
-                /* semiglobal alignment: fill top row (parallel to db) with zeroes */
-                asw_align_init_semi(self->al);
-        } else {
-                /* global alignment: penalize deletions in db at the beginning */
-                asw_align_init(self->al);
+        int style = sam ? ASW_CIGAR_SAM : ASW_CIGAR_SPACED;
+        const cigar_t *cigar_end = self->cigar + self->cigar_len;
+        size_t len = asw_format_cigar_range(self->cigar, cigar_end, NULL, 0u, style);
+        PyObject *str = PyUnicode_New((Py_ssize_t)len, 127);
+        if (str == NULL) {
+                return NULL;
         }
-        asw_align(self->al);
-        /* asw_print_matrix1(self->al, stdout); */
-        return Py_BuildValue("i", asw_locate_minscore(self->al));
+        /* compact ASCII strings have room for the terminating NUL */
+        asw_format_cigar_range(self->cigar, cigar_end,
+                               (char*)PyUnicode_1BYTE_DATA(str), len + 1u, style);
+        return str;
 }
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  Qxalign_trace
- *  Description:  Performs traceback on an alignment
+ *         Name:  Qxalign_getbuffer
+ *  Description:  bf_getbuffer: read-only view of the CIGAR of the last traceback,
+ *                one uint32 per operation packed as in BAM (length << 4 | op).
+ *                Tracing again raises BufferError until all views are released,
+ *                and so does exporting while another thread uses the object.
+ * =====================================================================================
+ */
+static int
+Qxalign_getbuffer(Qxalign* self, Py_buffer* view, int flags)
+{
+        /* an empty CIGAR still needs a valid address */
+        static cigar_t empty;
+
+        if (flags & PyBUF_WRITABLE) {
+                PyErr_SetString(PyExc_BufferError, "CIGAR buffer is read-only");
+                view->obj = NULL;
+                return -1;
+        }
+        /* trace() and align_full() in another thread checked for views before
+         * dropping the GIL, and are about to replace the CIGAR */
+        if (self->busy) {
+                PyErr_SetString(PyExc_BufferError,
+                        "cannot export the CIGAR while the object is in use by another thread");
+                view->obj = NULL;
+                return -1;
+        }
+        self->cigar_shape = (Py_ssize_t)self->cigar_len;
+        view->obj = (PyObject*)self;
+        Py_INCREF(self);
+        view->buf = self->cigar != NULL ? (void*)self->cigar : (void*)&empty;
+        view->len = self->cigar_shape * (Py_ssize_t)sizeof(cigar_t);
+        view->readonly = 1;
+        view->itemsize = sizeof(cigar_t);
+        view->format = (flags & PyBUF_FORMAT) ? "I" : NULL;
+        view->ndim = 1;
+        view->shape = (flags & PyBUF_ND) ? &self->cigar_shape : NULL;
+        view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &view->itemsize : NULL;
+        view->suboffsets = NULL;
+        view->internal = NULL;
+        ++self->cigar_exports;
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_releasebuffer
+ *  Description:  bf_releasebuffer
+ * =====================================================================================
+ */
+static void
+Qxalign_releasebuffer(Qxalign* self, Py_buffer* view)
+{
+        --self->cigar_exports;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_cigar
+ *  Description:  Return a read-only uint32 memoryview of the CIGAR of the last
+ *                traceback, without copying
  * =====================================================================================
  */
 static PyObject *
-Qxalign_trace(Qxalign* self)
+Qxalign_cigar(Qxalign* self)
 {
-        if (self->al->subdb_len == 0u || self->al->subquery_len == 0u) {
-                PyErr_SetString(PyExc_IndexError,
-                        "cannot perform traceback on a zero-element matrix");
+        return PyMemoryView_FromObject((PyObject*)self);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  Qxalign_cigar_copy
+ *  Description:  Return the CIGAR of the last traceback as a uint32 memoryview of a
+ *                bytes object of its own, which later tracebacks leave alone
+ * =====================================================================================
+ */
+static PyObject *
+Qxalign_cigar_copy(Qxalign* self)
+{
+        if (Qxalign_idle(self) != 0) {
                 return NULL;
         }
-        asw_trace(self->al);
-        Py_RETURN_NONE;
+        PyObject *bytes = PyBytes_FromStringAndSize((const char*)self->cigar,
+                        (Py_ssize_t)(sizeof(cigar_t) * self->cigar_len));
+        if (bytes == NULL) {
+                return NULL;
+        }
+        PyObject *raw = PyMemoryView_FromObject(bytes);
+        Py_DECREF(bytes);
+        if (raw == NULL) {
+                return NULL;
+        }
+        PyObject *view = PyObject_CallMethod(raw, "cast", "s", "I");
+        Py_DECREF(raw);
+        return view;
 }
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  Qxalign_print_trace
- *  Description:  Print CIGAR traceback of the alignment
+ *         Name:  qxalign_estimate_bytes
+ *  Description:  Return number of bytes held by an alignment workspace after
+ *                aligning sequences of given lengths
  * =====================================================================================
  */
 static PyObject *
-Qxalign_print_trace(Qxalign* self)
+qxalign_estimate_bytes(PyObject *module, PyObject *args, PyObject *kwds)
 {
-        asw_print_cigar(self->al, stdout);
-        Py_RETURN_NONE;
+        Py_ssize_t db_len, query_len;
+        int trace = 1,
+            packed = 0,
+            debug = 0,
+            fixed = 0,
+            md = 0;
+
+        static char *kwlist[] = {
+                "db_len",
+                "query_len",
+                "trace",
+                "packed",
+                "debug",
+                "fixed",
+                "md",
+                NULL /*  Sentinel */
+        };
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "nn|ppppp", kwlist,
+                                         &db_len,
+                                         &query_len,
+                                         &trace,
+                                         &packed,
+                                         &debug,
+                                         &fixed,
+                                         &md))
+        {
+                return NULL;
+        }
+        if (db_len < 0 || query_len < 0) {
+                PyErr_SetString(PyExc_ValueError, "sequence lengths must be non-negative");
+                return NULL;
+        }
+        unsigned int mode = ASW_FOOTPRINT_SCORE;
+        if (trace) mode |= ASW_FOOTPRINT_TRACE;
+        if (packed) mode |= ASW_FOOTPRINT_PACKED;
+        if (debug) mode |= ASW_FOOTPRINT_DEBUG;
+        if (fixed) mode |= ASW_FOOTPRINT_FIXED;
+        if (md) mode |= ASW_FOOTPRINT_MD;
+
+        return PyLong_FromSize_t(asw_estimate_bytes((size_t)db_len, (size_t)query_len, mode));
 }
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  Qxalign_show_trace
- *  Description:  Print CIGAR traceback of the alignment
+ *         Name:  qxalign_pool_stats
+ *  Description:  Return statistics of the workspace pool as a dictionary
  * =====================================================================================
  */
 static PyObject *
-Qxalign_show_trace(Qxalign* self)
+qxalign_pool_stats(PyObject *module)
 {
-        const char *buf = asw_show_cigar(self->al);
-        PyObject *str = PyUnicode_FromString(buf);
-        free(buf);
-        return str;
+        return Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:n}",
+                             "size", pool.size,
+                             "limit", pool.limit,
+                             "in_use", pool.in_use,
+                             "high_water", pool.high_water,
+                             "borrows", pool.borrows,
+                             "allocations", pool.allocations);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  qxalign_set_pool_limit
+ *  Description:  Set the maximum number of idle workspaces kept by the pool and
+ *                return the previous limit
+ * =====================================================================================
+ */
+static PyObject *
+qxalign_set_pool_limit(PyObject *module, PyObject *args)
+{
+        Py_ssize_t limit;
+        if (!PyArg_ParseTuple(args, "n", &limit)) {
+                return NULL;
+        }
+        if (limit < 0) {
+                PyErr_SetString(PyExc_ValueError, "pool limit must be non-negative");
+                return NULL;
+        }
+        Py_ssize_t previous = pool.limit;
+        if (pool_resize(limit) != 0) {
+                PyErr_SetString(PyExc_MemoryError, "cannot resize workspace pool");
+                return NULL;
+        }
+        return PyLong_FromSsize_t(previous);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  qxalign_free
+ *  Description:  m_free: release idle workspaces when the module is unloaded
+ * =====================================================================================
+ */
+static void
+qxalign_free(void *module)
+{
+        pool_resize(0);
+        PyMem_Free(pool.idle);
+        pool.idle = NULL;
+        asw_model_release(pool.model);
+        pool.model = NULL;
 }
 
+/*-----------------------------------------------------------------------------
+ *  Module-level functions
+ *-----------------------------------------------------------------------------*/
+static PyMethodDef qxalign_functions[] = {
+        {"estimate_bytes", (PyCFunction)qxalign_estimate_bytes, METH_VARARGS|METH_KEYWORDS,
+                "Return number of bytes an aligner allocates for sequences of given lengths"},
+        {"pool_stats", (PyCFunction)qxalign_pool_stats, METH_NOARGS,
+                "Return statistics of the workspace pool shared by Qxalign instances"},
+        {"set_pool_limit", (PyCFunction)qxalign_set_pool_limit, METH_VARARGS,
+                "Set maximum number of idle workspaces kept by the pool; return previous"},
+        {NULL}  /* Sentinel */
+};
+
 /*-----------------------------------------------------------------------------
  *  Module-level data fields
  *-----------------------------------------------------------------------------*/
@@ -438,7 +2200,7 @@ static PyModuleDef qxalign_module = {
         "qxalign",
         "Quality-aware realignment of sequence reads",
         -1,
-        NULL, NULL, NULL, NULL, NULL
+        qxalign_functions, NULL, NULL, NULL, qxalign_free
 };
 
 /*-----------------------------------------------------------------------------
@@ -477,15 +2239,107 @@ static PyMethodDef Qxalign_methods[] = {
                 "Assign query sequence, query quality string and resizes the alignment matrix"},
         {"align", (PyCFunction)Qxalign_align, METH_VARARGS|METH_KEYWORDS,
                 "Perform an alignment and returns resulting score"},
-        {"trace", (PyCFunction)Qxalign_trace, METH_NOARGS,
-                "Perform traceback on an alignment"},
+        {"align_full", (PyCFunction)Qxalign_align_full, METH_VARARGS|METH_KEYWORDS,
+                "Assign sequences, align and trace; return (score, offset, CIGAR, end)"},
+        {"align_many", (PyCFunction)Qxalign_align_many, METH_VARARGS|METH_KEYWORDS,
+                "Align many queries to one reference on native threads; return a list of "
+                "(score, offset, CIGAR, end) (None where an alignment failed), or a "
+                "BatchResult if columnar=True"},
+        {"align_ragged", (PyCFunction)Qxalign_align_ragged, METH_VARARGS|METH_KEYWORDS,
+                "Align records stored back to back in one buffer, delimited by offsets, "
+                "against one reference or several windows; return as align_many"},
+        {"trace", (PyCFunction)Qxalign_trace, METH_VARARGS|METH_KEYWORDS,
+                "Perform traceback on an alignment (optionally soft-clipped and compacted)"},
+        {"show_pair", (PyCFunction)Qxalign_show_pair, METH_NOARGS,
+                "Return gapped reference and query rows of an alignment as bytes"},
+        {"trace_stats", (PyCFunction)Qxalign_trace_stats, METH_NOARGS,
+                "Return matches, mismatches, insertions, deletions, NM and MD of last traceback"},
         {"print_trace", (PyCFunction)Qxalign_print_trace, METH_NOARGS,
                 "Print CIGAR traceback of an alignment to stdout"},
-        {"show_trace", (PyCFunction)Qxalign_show_trace, METH_NOARGS,
-                "Return CIGAR traceback of an alignment"},
+        {"show_trace", (PyCFunction)Qxalign_show_trace, METH_VARARGS|METH_KEYWORDS,
+                "Return CIGAR traceback of an alignment (space-separated, or SAM if sam=True)"},
+        {"cigar", (PyCFunction)Qxalign_cigar, METH_NOARGS,
+                "Return CIGAR of last traceback as a read-only uint32 memoryview (BAM packing)"},
+        {"cigar_copy", (PyCFunction)Qxalign_cigar_copy, METH_NOARGS,
+                "Return a copy of CIGAR of last traceback as a uint32 memoryview"},
         {NULL}  /* Sentinel */
 };
 
+/*-----------------------------------------------------------------------------
+ *  BatchResult columns
+ *-----------------------------------------------------------------------------*/
+static PyGetSetDef BatchResult_getset[] = {
+        {"scores", (getter)BatchResult_column, NULL,
+                "minimum scores (int32)", (void*)&batch_columns[0]},
+        {"offsets", (getter)BatchResult_column, NULL,
+                "start of each alignment in the reference (int64, -1 if not traced)",
+                (void*)&batch_columns[1]},
+        {"ends", (getter)BatchResult_column, NULL,
+                "end of each alignment in the reference (int64)", (void*)&batch_columns[2]},
+        {"nm", (getter)BatchResult_column, NULL,
+                "edit distances (uint32)", (void*)&batch_columns[3]},
+        {"cigar_offsets", (getter)BatchResult_column, NULL,
+                "start of the CIGAR of each alignment in cigars, and its end (int64)",
+                (void*)&batch_columns[4]},
+        {"cigars", (getter)BatchResult_column, NULL,
+                "CIGARs back to back, packed as length << 4 | op (uint32)",
+                (void*)&batch_columns[5]},
+        {"status", (getter)BatchResult_column, NULL,
+                "0, or -1 where the alignment failed (int32)", (void*)&batch_columns[6]},
+        {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods BatchResult_as_sequence = {
+        (lenfunc)BatchResult_length,      /* sq_length */
+        0,                                /* sq_concat */
+        0,                                /* sq_repeat */
+        (ssizeargfunc)BatchResult_item,   /* sq_item */
+};
+
+/*-----------------------------------------------------------------------------
+ *  BatchResult type info
+ *-----------------------------------------------------------------------------*/
+static PyTypeObject BatchResultType = {
+        PyVarObject_HEAD_INIT(NULL, 0)
+                "qxalign.BatchResult",     /* tp_name */
+        sizeof(BatchResult),       /* tp_basicsize */
+        0,                         /* tp_itemsize */
+        (destructor)BatchResult_dealloc, /* tp_dealloc */
+        0,                         /* tp_print */
+        0,                         /* tp_getattr */
+        0,                         /* tp_setattr */
+        0,                         /* tp_reserved */
+        0,                         /* tp_repr */
+        0,                         /* tp_as_number */
+        &BatchResult_as_sequence,  /* tp_as_sequence */
+        0,                         /* tp_as_mapping */
+        0,                         /* tp_hash  */
+        0,                         /* tp_call */
+        0,                         /* tp_str */
+        0,                         /* tp_getattro */
+        0,                         /* tp_setattro */
+        0,                         /* tp_as_buffer */
+        Py_TPFLAGS_DEFAULT,        /* tp_flags */
+        "Columns of a batch of alignments",  /* tp_doc */
+        0,                         /* tp_traverse */
+        0,                         /* tp_clear */
+        0,                         /* tp_richcompare */
+        0,                         /* tp_weaklistoffset */
+        0,                         /* tp_iter */
+        0,                         /* tp_iternext */
+        0,                         /* tp_methods */
+        0,                         /* tp_members */
+        BatchResult_getset,        /* tp_getset */
+};
+
+/*-----------------------------------------------------------------------------
+ *  Qxalign buffer protocol: CIGAR of the last traceback
+ *-----------------------------------------------------------------------------*/
+static PyBufferProcs Qxalign_as_buffer = {
+        (getbufferproc)Qxalign_getbuffer,
+        (releasebufferproc)Qxalign_releasebuffer
+};
+
 /*-----------------------------------------------------------------------------
  *  Qxalign type type info
  *-----------------------------------------------------------------------------*/
@@ -508,7 +2362,7 @@ static PyTypeObject QxalignType = {
         0,                         /* tp_str */
         0,                         /* tp_getattro */
         0,                         /* tp_setattro */
-        0,                         /* tp_as_buffer */
+        &Qxalign_as_buffer,        /* tp_as_buffer */
         Py_TPFLAGS_DEFAULT |
                 Py_TPFLAGS_BASETYPE,   /* tp_flags */
         "Qxalign objects",           /* tp_doc */
@@ -543,7 +2397,11 @@ PyInit_qxalign(void)
         PyObject* m;
 
         /* QxalignType.tp_new = Qxalign_new; */
-        if (PyType_Ready(&QxalignType) < 0) {
+        if (PyType_Ready(&QxalignType) < 0 || PyType_Ready(&BatchResultType) < 0) {
+                return NULL;
+        }
+        if (pool_resize(pool.limit) != 0) {
+                PyErr_SetString(PyExc_MemoryError, "cannot allocate workspace pool");
                 return NULL;
         }
         if ((m = PyModule_Create(&qxalign_module)) == NULL) {
@@ -552,6 +2410,12 @@ PyInit_qxalign(void)
 
         Py_INCREF(&QxalignType);
         PyModule_AddObject(m, "Qxalign", (PyObject *)&QxalignType);
+        Py_INCREF(&BatchResultType);
+        PyModule_AddObject(m, "BatchResult", (PyObject *)&BatchResultType);
+
+        /* capacity of aligners created with fixed=True */
+        PyModule_AddIntConstant(m, "FIXED_DB_MAX", ASW_FIXED_DB_MAX);
+        PyModule_AddIntConstant(m, "FIXED_QUERY_MAX", ASW_FIXED_QUERY_MAX);
 
         /*  create custom exception */
         /* if (QxalignError == NULL) {
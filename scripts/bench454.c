@@ -0,0 +1,1630 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  bench454.c
+ *
+ *    Description:  Micro-benchmarks for the routines in align454.c
+ *
+ *                  Build with `make bench' and run e.g.
+ *
+ *                      scripts/bench454 layout [query_len] [reps]
+ *                      scripts/bench454 fixed [query_len] [reps]
+ *                      scripts/bench454 trace [query_len] [reps]
+ *                      scripts/bench454 batch [max_query_len] [n_jobs]
+ *                      scripts/bench454 bucket [max_query_len] [n_jobs]
+ *                      scripts/bench454 stream [max_query_len] [n_jobs]
+ *                      scripts/bench454 pipeline [max_query_len] [n_jobs]
+ *                      scripts/bench454 backpressure [max_query_len] [n_jobs]
+ *                      scripts/bench454 numa [max_query_len] [n_jobs]
+ *                      scripts/bench454 prefetch [query_len] [n_jobs]
+ *                      scripts/bench454 tracemany [query_len] [n_alignments]
+ *                      scripts/bench454 reader [read_len] [megabytes]
+ *                      scripts/bench454 readercheck [n_records]
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "align454.h"
+#include "asw_batch.h"
+#include "asw_bucket.h"
+#include "asw_stream.h"
+#include "asw_pipeline.h"
+#include "asw_reader.h"
+
+static const char bases[] = "ACGT";
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  now_sec
+ *  Description:  Monotonic wall clock in seconds
+ * =====================================================================================
+ */
+static double now_sec(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  random_seq
+ *  Description:  Fill a buffer with random bases
+ * =====================================================================================
+ */
+static void random_seq(char *seq, size_t len)
+{
+        size_t i;
+        for (i = 0u; i < len; ++i) {
+                seq[i] = bases[rand() & 3];
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  mutate_read
+ *  Description:  Copy a window of the reference into a read, introducing roughly
+ *                one substitution in twenty bases
+ * =====================================================================================
+ */
+static void mutate_read(char *read, const char *ref, size_t len)
+{
+        size_t i;
+        for (i = 0u; i < len; ++i) {
+                read[i] = (rand() % 20 == 0) ? bases[rand() & 3] : ref[i];
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_layout
+ *  Description:  Compare ASW_LAYOUT_SPLIT and ASW_LAYOUT_PACKED across window sizes
+ * =====================================================================================
+ */
+static int bench_layout(size_t query_len, unsigned int reps)
+{
+        static const size_t windows[] = {64, 128, 256, 512, 1024, 2048, 4096, 8192};
+        static const int layouts[] = {ASW_LAYOUT_SPLIT, ASW_LAYOUT_PACKED};
+        static const char *names[] = {"split", "packed"};
+
+        size_t w;
+        printf("%8s %8s %12s %12s %8s\n",
+               "window", "query", "split ns/c", "packed ns/c", "speedup");
+        for (w = 0u; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+                size_t db_len = windows[w];
+                size_t q_len = query_len < db_len ? query_len : db_len;
+                char *db = (char*)malloc(db_len);
+                char *query = (char*)malloc(q_len);
+                uint8_t *qual = (uint8_t*)malloc(q_len);
+                random_seq(db, db_len);
+                mutate_read(query, db + (db_len - q_len) / 2u, q_len);
+                memset(qual, 33 + 30, q_len);
+
+                double ns_per_cell[2];
+                int score[2];
+                unsigned int l;
+                for (l = 0u; l < 2u; ++l) {
+                        Alignment_ASW *al = asw_new(-10, 30, 50, 20);
+                        if (al == NULL || asw_set_layout(al, layouts[l]) != 0) {
+                                fprintf(stderr, "cannot allocate %s workspace\n", names[l]);
+                                return 1;
+                        }
+                        asw_set_phoffset(al, 33);
+                        if (asw_prepare(al, db, db_len, query, qual, q_len, 0u, 0u) != 0) {
+                                fprintf(stderr, "cannot prepare %s workspace\n", names[l]);
+                                return 1;
+                        }
+                        unsigned int r;
+                        /* warm up caches and page tables */
+                        asw_align_init_semi(al);
+                        asw_align(al);
+                        double t0 = now_sec();
+                        for (r = 0u; r < reps; ++r) {
+                                asw_align_init_semi(al);
+                                asw_align(al);
+                        }
+                        double t1 = now_sec();
+                        score[l] = asw_locate_minscore(al);
+                        ns_per_cell[l] = 1e9 * (t1 - t0)
+                                / ((double)reps * (double)db_len * (double)q_len);
+                        asw_free(al);
+                }
+                if (score[0] != score[1]) {
+                        fprintf(stderr, "score mismatch at window %zu: %d != %d\n",
+                                db_len, score[0], score[1]);
+                        return 1;
+                }
+                printf("%8zu %8zu %12.3f %12.3f %8.2f\n", db_len, q_len,
+                       ns_per_cell[0], ns_per_cell[1], ns_per_cell[0] / ns_per_cell[1]);
+                free(db);
+                free(query);
+                free(qual);
+        }
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_fixed
+ *  Description:  Per-call latency of prepare + align + trace on short reads of
+ *                varying length, heap workspace versus ASW_Fixed
+ * =====================================================================================
+ */
+static int bench_fixed(size_t query_len, unsigned int reps)
+{
+        enum { NREADS = 64 };
+        if (query_len + 32u > ASW_FIXED_DB_MAX) {
+                fprintf(stderr, "query length must not exceed %d\n", ASW_FIXED_DB_MAX - 32);
+                return 2;
+        }
+        char *db[NREADS], *query[NREADS];
+        uint8_t *qual[NREADS];
+        size_t db_len[NREADS], q_len[NREADS];
+        unsigned int i;
+        for (i = 0u; i < NREADS; ++i) {
+                /* lengths vary from read to read, as they do in real data */
+                q_len[i] = query_len - (size_t)(rand() % (int)(query_len / 4u + 1u));
+                db_len[i] = q_len[i] + (size_t)(rand() % 32);
+                db[i] = (char*)malloc(db_len[i]);
+                query[i] = (char*)malloc(q_len[i]);
+                qual[i] = (uint8_t*)malloc(q_len[i]);
+                random_seq(db[i], db_len[i]);
+                mutate_read(query[i], db[i], q_len[i]);
+                memset(qual[i], 33 + 30, q_len[i]);
+        }
+
+        Alignment_ASW *al = asw_new(-10, 30, 50, 20);
+        ASW_Fixed *fx = (ASW_Fixed*)malloc(sizeof(ASW_Fixed));
+        if (al == NULL || fx == NULL) {
+                fprintf(stderr, "cannot allocate workspaces\n");
+                return 1;
+        }
+        asw_fixed_init(fx, -10, 30, 50, 20);
+        asw_set_phoffset(al, 33);
+        asw_set_phoffset(&fx->al, 33);
+
+        unsigned int r;
+        double t0 = now_sec();
+        for (r = 0u; r < reps; ++r) {
+                for (i = 0u; i < NREADS; ++i) {
+                        asw_prepare(al, db[i], db_len[i], query[i], qual[i], q_len[i], 0u, 0u);
+                        asw_align_init_semi(al);
+                        asw_align(al);
+                        asw_locate_minscore(al);
+                        asw_trace(al);
+                }
+        }
+        double t1 = now_sec();
+        for (r = 0u; r < reps; ++r) {
+                for (i = 0u; i < NREADS; ++i) {
+                        asw_fixed_prepare(fx, db[i], db_len[i], query[i], qual[i], q_len[i], 0u, 0u);
+                        asw_fixed_align(fx, 1);
+                        asw_locate_minscore(&fx->al);
+                        asw_trace(&fx->al);
+                }
+        }
+        double t2 = now_sec();
+        double calls = (double)reps * NREADS;
+        printf("%8s %12s %12s\n", "query", "heap us", "fixed us");
+        printf("%8zu %12.3f %12.3f\n", query_len, 1e6 * (t1 - t0) / calls, 1e6 * (t2 - t1) / calls);
+
+        asw_free(al);
+        free(fx);
+        for (i = 0u; i < NREADS; ++i) {
+                free(db[i]);
+                free(query[i]);
+                free(qual[i]);
+        }
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_trace
+ *  Description:  Traceback producing a soft-clipped compact CIGAR: asw_trace followed
+ *                by asw_softclip_trace and asw_compact_trace versus asw_trace_ex
+ * =====================================================================================
+ */
+static int bench_trace(size_t query_len, unsigned int reps)
+{
+        size_t db_len = query_len + 32u;
+        char *db = (char*)malloc(db_len);
+        char *query = (char*)malloc(query_len);
+        uint8_t *qual = (uint8_t*)malloc(query_len);
+        random_seq(db, db_len);
+        mutate_read(query, db + 16, query_len);
+        memset(qual, 33 + 30, query_len);
+
+        Alignment_ASW *al = asw_new(-10, 30, 50, 20);
+        if (al == NULL) {
+                fprintf(stderr, "cannot allocate workspace\n");
+                return 1;
+        }
+        asw_set_phoffset(al, 33);
+        asw_prepare(al, db, db_len, query, qual, query_len, 0u, 0u);
+        asw_align_init_semi(al);
+        asw_align(al);
+        asw_locate_minscore(al);
+
+        unsigned int r;
+        double t0 = now_sec();
+        for (r = 0u; r < reps; ++r) {
+                asw_trace(al);
+                asw_softclip_trace(al);
+                asw_compact_trace(al);
+        }
+        double t1 = now_sec();
+        for (r = 0u; r < reps; ++r) {
+                asw_trace_ex(al, ASW_TRACE_SOFTCLIP | ASW_TRACE_COMPACT, 0u, 0u);
+        }
+        double t2 = now_sec();
+        printf("%8s %12s %12s %8s\n", "query", "chained ns", "fused ns", "speedup");
+        printf("%8zu %12.1f %12.1f %8.2f\n", query_len,
+               1e9 * (t1 - t0) / reps, 1e9 * (t2 - t1) / reps, (t1 - t0) / (t2 - t1));
+
+        asw_free(al);
+        free(db);
+        free(query);
+        free(qual);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  skewed_jobs
+ *  Description:  Jobs with read lengths spread log-uniformly over max_query_len / 20
+ *                to max_query_len and reference windows over 1x to 10x the read,
+ *                so that matrix sizes vary by more than 1000x
+ * =====================================================================================
+ */
+static ASW_Job* skewed_jobs(size_t max_query_len, size_t n_jobs)
+{
+        ASW_Job *jobs = (ASW_Job*)malloc(sizeof(ASW_Job) * n_jobs);
+        if (jobs == NULL) return NULL;
+        size_t i;
+        for (i = 0u; i < n_jobs; ++i) {
+                double u = (double)rand() / RAND_MAX,
+                       v = (double)rand() / RAND_MAX;
+                size_t query_len = (size_t)((double)max_query_len * pow(20.0, u - 1.0));
+                if (query_len == 0u) query_len = 1u;
+                size_t db_len = (size_t)((double)query_len * pow(10.0, v)) + 32u;
+                char *db = (char*)malloc(db_len);
+                char *query = (char*)malloc(query_len);
+                uint8_t *qual = (uint8_t*)malloc(query_len);
+                random_seq(db, db_len);
+                mutate_read(query, db + (db_len - query_len) / 2u, query_len);
+                memset(qual, 33 + 30, query_len);
+                jobs[i].db = db;
+                jobs[i].db_len = db_len;
+                jobs[i].query = query;
+                jobs[i].qual = qual;
+                jobs[i].query_len = query_len;
+                jobs[i].clip_head = 0u;
+                jobs[i].clip_tail = 0u;
+                jobs[i].flags = ASW_ALIGN_SEMI | ASW_TRACE_SOFTCLIP | ASW_TRACE_COMPACT;
+        }
+        return jobs;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  free_jobs
+ *  Description:  Free jobs made by skewed_jobs
+ * =====================================================================================
+ */
+static void free_jobs(ASW_Job *jobs, size_t n_jobs)
+{
+        size_t i;
+        for (i = 0u; i < n_jobs; ++i) {
+                free((char*)jobs[i].db);
+                free((char*)jobs[i].query);
+                free((uint8_t*)jobs[i].qual);
+        }
+        free(jobs);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_batch
+ *  Description:  Throughput of asw_batch_run on 1, 2, 4, ... threads up to the number
+ *                of online processors, with chunked and work-stealing schedules,
+ *                on skewed_jobs. Idle is the share of worker time spent waiting.
+ * =====================================================================================
+ */
+static int bench_batch(size_t max_query_len, size_t n_jobs)
+{
+        static const int schedules[] = {ASW_SCHEDULE_CHUNKED, ASW_SCHEDULE_STEAL};
+        static const char *names[] = {"chunked", "steal"};
+
+        ASW_Job *jobs = skewed_jobs(max_query_len, n_jobs);
+        ASW_Result *results = (ASW_Result*)calloc(n_jobs, sizeof(ASW_Result));
+        if (jobs == NULL || results == NULL) {
+                fprintf(stderr, "cannot allocate jobs\n");
+                return 1;
+        }
+
+        ASW_BatchOptions opt;
+        asw_batch_options_init(&opt);
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned int max_threads = ncpu > 0 ? (unsigned int)ncpu : 1u;
+        double base = 0.0;
+        printf("%8s %8s %12s %8s %8s %8s\n",
+               "threads", "schedule", "aligns/s", "speedup", "idle %", "steals");
+        for (opt.nthreads = 1u; opt.nthreads <= max_threads; opt.nthreads *= 2u) {
+                unsigned int s;
+                for (s = 0u; s < 2u; ++s) {
+                        opt.schedule = schedules[s];
+                        ASW_Batch *batch = asw_batch_new(&opt);
+                        ASW_WorkerStats *stats = (ASW_WorkerStats*)malloc(
+                                sizeof(ASW_WorkerStats) * opt.nthreads);
+                        if (batch == NULL || stats == NULL) {
+                                fprintf(stderr, "cannot start %u threads\n", opt.nthreads);
+                                return 1;
+                        }
+                        /* warm up the workspaces */
+                        asw_batch_run(batch, jobs, results, n_jobs);
+                        asw_result_clear(results, n_jobs);
+                        double t0 = now_sec();
+                        if (asw_batch_run(batch, jobs, results, n_jobs) != 0) {
+                                fprintf(stderr, "batch failed\n");
+                                return 1;
+                        }
+                        double t1 = now_sec();
+                        asw_batch_stats(batch, stats);
+                        asw_result_clear(results, n_jobs);
+                        asw_batch_free(batch);
+
+                        double busy = 0.0, idle = 0.0;
+                        size_t steals = 0u;
+                        unsigned int w;
+                        for (w = 0u; w < opt.nthreads; ++w) {
+                                busy += stats[w].busy_sec;
+                                idle += stats[w].idle_sec;
+                                steals += stats[w].steals;
+                        }
+                        free(stats);
+                        double rate = (double)n_jobs / (t1 - t0);
+                        if (base == 0.0) base = rate;
+                        printf("%8u %8s %12.0f %8.2f %8.1f %8zu\n", opt.nthreads, names[s],
+                               rate, rate / base, 100.0 * idle / (busy + idle), steals);
+                }
+        }
+
+        free_jobs(jobs, n_jobs);
+        free(results);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  count_result
+ *  Description:  ASW_EmitFn of bench_bucket: check the order and drop the result
+ * =====================================================================================
+ */
+static void count_result(void *ctx, size_t seq, const ASW_Job *job, ASW_Result *result)
+{
+        size_t *expected = (size_t*)ctx;
+        (void)job;
+        if (seq != (*expected)++) {
+                fprintf(stderr, "result %zu out of order\n", seq);
+                exit(1);
+        }
+        asw_result_clear(result, 1u);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_bucket
+ *  Description:  Lane occupancy, useful share of lane time and throughput of the
+ *                bucketing stage on skewed_jobs for growing reorder windows, with
+ *                one lane per online processor
+ * =====================================================================================
+ */
+static int bench_bucket(size_t max_query_len, size_t n_jobs)
+{
+        static const size_t windows[] = {1, 16, 64, 256, 1024};
+
+        ASW_Job *jobs = skewed_jobs(max_query_len, n_jobs);
+        ASW_BatchOptions opt;
+        asw_batch_options_init(&opt);
+        ASW_Batch *batch = asw_batch_new(&opt);
+        if (jobs == NULL || batch == NULL) {
+                fprintf(stderr, "cannot allocate jobs\n");
+                return 1;
+        }
+        size_t lanes = asw_batch_nthreads(batch) > 1u ? asw_batch_nthreads(batch) : 4u;
+        printf("%8s %8s %10s %10s %12s\n", "lanes", "window", "occupancy", "useful", "aligns/s");
+        unsigned int w;
+        for (w = 0u; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+                ASW_BucketOptions bopt;
+                asw_bucket_options_init(&bopt);
+                bopt.lanes = lanes;
+                bopt.window = windows[w];
+                size_t expected = 0u;
+                ASW_Bucketer *bk = asw_bucketer_new(batch, &bopt, count_result, &expected);
+                if (bk == NULL) {
+                        fprintf(stderr, "cannot allocate bucketer\n");
+                        return 1;
+                }
+                double t0 = now_sec();
+                size_t i;
+                for (i = 0u; i < n_jobs; ++i) {
+                        asw_bucketer_push(bk, &jobs[i]);
+                }
+                asw_bucketer_flush(bk);
+                double t1 = now_sec();
+                ASW_BucketStats st;
+                asw_bucketer_stats(bk, &st);
+                asw_bucketer_free(bk);
+                printf("%8zu %8zu %10.2f %10.2f %12.0f\n", lanes, windows[w] > lanes ? windows[w] : lanes,
+                       (double)st.jobs / ((double)st.groups * (double)lanes),
+                       (double)st.cells / (double)st.padded_cells,
+                       (double)n_jobs / (t1 - t0));
+        }
+        asw_batch_free(batch);
+        free_jobs(jobs, n_jobs);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  drop_result
+ *  Description:  ASW_SinkFn of bench_stream
+ * =====================================================================================
+ */
+static void drop_result(void *ctx, size_t seq, const ASW_Job *job, ASW_Result *result)
+{
+        (void)ctx;
+        (void)seq;
+        (void)job;
+        asw_result_clear(result, 1u);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_stream
+ *  Description:  Throughput of asw_stream on skewed_jobs, ordered versus unordered,
+ *                for growing buffer capacities, with one worker per online processor
+ * =====================================================================================
+ */
+static int bench_stream(size_t max_query_len, size_t n_jobs)
+{
+        static const size_t capacities[] = {4, 16, 64, 256};
+
+        ASW_Job *jobs = skewed_jobs(max_query_len, n_jobs);
+        if (jobs == NULL) {
+                fprintf(stderr, "cannot allocate jobs\n");
+                return 1;
+        }
+        printf("%8s %9s %12s %10s %12s\n", "capacity", "mode", "aligns/s", "held max", "producer s");
+        unsigned int c;
+        for (c = 0u; c < sizeof(capacities) / sizeof(capacities[0]); ++c) {
+                int ordered;
+                for (ordered = 1; ordered >= 0; --ordered) {
+                        ASW_StreamOptions opt;
+                        asw_stream_options_init(&opt);
+                        opt.capacity = capacities[c];
+                        opt.ordered = ordered;
+                        ASW_Stream *stream = asw_stream_new(&opt, drop_result, NULL);
+                        if (stream == NULL) {
+                                fprintf(stderr, "cannot start stream\n");
+                                return 1;
+                        }
+                        double t0 = now_sec();
+                        size_t i;
+                        for (i = 0u; i < n_jobs; ++i) {
+                                asw_stream_submit(stream, &jobs[i]);
+                        }
+                        asw_stream_finish(stream);
+                        double t1 = now_sec();
+                        ASW_StreamStats st;
+                        asw_stream_stats(stream, &st);
+                        asw_stream_free(stream);
+                        printf("%8zu %9s %12.0f %10zu %12.3f\n", capacities[c],
+                               ordered ? "ordered" : "unordered", (double)n_jobs / (t1 - t0),
+                               st.max_waiting, st.producer_wait_sec);
+                }
+        }
+        free_jobs(jobs, n_jobs);
+        return 0;
+}
+
+/* Input and output of bench_pipeline */
+typedef struct {
+        const ASW_Job *jobs;
+        size_t n_jobs;
+        size_t next;            /* next job to read */
+        FILE *out;
+        long write_delay_ns;    /* simulated slow storage, per batch */
+} PipeBench;
+
+/* Formatted records of one batch, in ASW_PipeBatch.user */
+typedef struct {
+        char *text;
+        size_t len, cap;
+} PipeText;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  format_record
+ *  Description:  Append one tab-separated output line for a result to text
+ * =====================================================================================
+ */
+static void format_record(PipeText *text, size_t seq, const ASW_Result *result)
+{
+        /* room for the numbers plus up to 11 characters per CIGAR operation */
+        size_t need = text->len + 64u + 11u * result->n_cigar;
+        if (need > text->cap) {
+                char *grown = (char*)realloc(text->text, 2u * need);
+                if (grown == NULL) return;
+                text->text = grown;
+                text->cap = 2u * need;
+        }
+        char *p = text->text + text->len;
+        p += sprintf(p, "%zu\t%d\t%d\t", seq, result->status, result->score);
+        p += asw_format_cigar_range(result->cigar, result->cigar + result->n_cigar,
+                                    p, text->cap - (size_t)(p - text->text), ASW_CIGAR_SAM);
+        *p++ = '\n';
+        text->len = (size_t)(p - text->text);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pipe_read
+ *  Description:  ASW_ReadFn of bench_pipeline
+ * =====================================================================================
+ */
+static size_t pipe_read(void *ctx, ASW_PipeBatch *batch)
+{
+        PipeBench *bench = (PipeBench*)ctx;
+        if (batch->user == NULL) {
+                batch->user = calloc(1u, sizeof(PipeText));
+        }
+        size_t n = bench->n_jobs - bench->next;
+        if (n > batch->cap) n = batch->cap;
+        memcpy(batch->jobs, bench->jobs + bench->next, n * sizeof(ASW_Job));
+        bench->next += n;
+        return n;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pipe_format
+ *  Description:  Format callback of bench_pipeline
+ * =====================================================================================
+ */
+static void pipe_format(void *ctx, ASW_PipeBatch *batch)
+{
+        (void)ctx;
+        PipeText *text = (PipeText*)batch->user;
+        size_t i;
+        text->len = 0u;
+        for (i = 0u; i < batch->n; ++i) {
+                format_record(text, batch->seq * batch->cap + i, &batch->results[i]);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pipe_write
+ *  Description:  Write callback of bench_pipeline
+ * =====================================================================================
+ */
+static void pipe_write(void *ctx, ASW_PipeBatch *batch)
+{
+        PipeText *text = (PipeText*)batch->user;
+        PipeBench *bench = (PipeBench*)ctx;
+        fwrite(text->text, 1u, text->len, bench->out);
+        if (bench->write_delay_ns > 0) {
+                struct timespec ts = {0, bench->write_delay_ns};
+                nanosleep(&ts, NULL);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  pipe_release
+ *  Description:  Release callback of bench_pipeline
+ * =====================================================================================
+ */
+static void pipe_release(void *ctx, ASW_PipeBatch *batch)
+{
+        (void)ctx;
+        PipeText *text = (PipeText*)batch->user;
+        if (text != NULL) free(text->text);
+        free(text);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_pipeline
+ *  Description:  End-to-end throughput (align, format, write to /dev/null) of
+ *                skewed_jobs: a serial loop versus asw_pipeline for several batch
+ *                sizes, with the time each stage spent working and waiting
+ * =====================================================================================
+ */
+static int bench_pipeline(size_t max_query_len, size_t n_jobs)
+{
+        static const size_t batch_sizes[] = {1, 16, 256};
+
+        ASW_Job *jobs = skewed_jobs(max_query_len, n_jobs);
+        FILE *out = fopen("/dev/null", "w");
+        if (jobs == NULL || out == NULL) {
+                fprintf(stderr, "cannot set up pipeline benchmark\n");
+                return 1;
+        }
+        printf("%8s %12s %8s %8s %8s %8s %8s %8s\n", "batch", "aligns/s",
+               "read s", "wait s", "align s", "wait s", "write s", "wait s");
+
+        /* serial baseline */
+        Alignment_ASW *al = asw_new(-10, 30, 50, 20);
+        if (al == NULL) {
+                fprintf(stderr, "cannot allocate workspace\n");
+                return 1;
+        }
+        PipeText text = {NULL, 0u, 0u};
+        double t0 = now_sec();
+        size_t i;
+        for (i = 0u; i < n_jobs; ++i) {
+                ASW_Result result;
+                asw_run_job(al, &jobs[i], &result);
+                text.len = 0u;
+                format_record(&text, i, &result);
+                fwrite(text.text, 1u, text.len, out);
+                asw_result_clear(&result, 1u);
+        }
+        double t1 = now_sec();
+        free(text.text);
+        asw_free(al);
+        printf("%8s %12.0f\n", "serial", (double)n_jobs / (t1 - t0));
+
+        unsigned int b;
+        for (b = 0u; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++b) {
+                PipeBench bench = {jobs, n_jobs, 0u, out, 0};
+                ASW_PipelineOptions opt;
+                asw_pipeline_options_init(&opt);
+                opt.batch_size = batch_sizes[b];
+                opt.read = pipe_read;
+                opt.format = pipe_format;
+                opt.write = pipe_write;
+                opt.release = pipe_release;
+                opt.ctx = &bench;
+                ASW_PipelineStats st;
+                if (asw_pipeline_run(&opt, &st) != 0) {
+                        fprintf(stderr, "cannot start pipeline\n");
+                        return 1;
+                }
+                printf("%8zu %12.0f %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", batch_sizes[b],
+                       (double)st.records / st.wall_sec, st.read_sec, st.read_wait_sec,
+                       st.align_sec, st.align_wait_sec, st.write_sec, st.write_wait_sec);
+        }
+        fclose(out);
+        free_jobs(jobs, n_jobs);
+        return 0;
+}
+
+/* Highest levels seen by watch_gauges */
+typedef struct {
+        ASW_PipelineGauges *gauges;
+        atomic_int stop;
+        ASW_PipelineLevels max;
+} GaugeWatch;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  watch_gauges
+ *  Description:  Sample pipeline gauges every 100 us until stopped
+ * =====================================================================================
+ */
+static void* watch_gauges(void *arg)
+{
+        GaugeWatch *watch = (GaugeWatch*)arg;
+        memset(&watch->max, 0, sizeof(ASW_PipelineLevels));
+        while (!atomic_load(&watch->stop)) {
+                ASW_PipelineLevels now;
+                asw_pipeline_gauges_read(watch->gauges, &now);
+                if (now.filled > watch->max.filled) watch->max.filled = now.filled;
+                if (now.aligned > watch->max.aligned) watch->max.aligned = now.aligned;
+                if (now.aligners_blocked > watch->max.aligners_blocked)
+                        watch->max.aligners_blocked = now.aligners_blocked;
+                struct timespec ts = {0, 100000};
+                nanosleep(&ts, NULL);
+        }
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_backpressure
+ *  Description:  asw_pipeline with a writer slower than the aligners, without and
+ *                with memory ceilings: throughput, peak accounted memory, time the
+ *                reader and aligners were held back and the highest queue levels
+ * =====================================================================================
+ */
+static int bench_backpressure(size_t max_query_len, size_t n_jobs)
+{
+        static const size_t limits_mib[] = {0, 8, 6, 5, 1};
+
+        ASW_Job *jobs = skewed_jobs(max_query_len, n_jobs);
+        FILE *out = fopen("/dev/null", "w");
+        ASW_PipelineGauges *gauges = asw_pipeline_gauges_new();
+        if (jobs == NULL || out == NULL || gauges == NULL) {
+                fprintf(stderr, "cannot set up backpressure benchmark\n");
+                return 1;
+        }
+        printf("%8s %10s %9s %8s %8s %7s %8s %8s\n", "limit MB", "aligns/s", "peak MB",
+               "read s", "align s", "filled", "aligned", "blocked");
+        unsigned int l;
+        for (l = 0u; l < sizeof(limits_mib) / sizeof(limits_mib[0]); ++l) {
+                PipeBench bench = {jobs, n_jobs, 0u, out, 20000000};
+                ASW_PipelineOptions opt;
+                asw_pipeline_options_init(&opt);
+                /* deep enough that the batches in flight, not the workspaces,
+                 * dominate without a ceiling */
+                opt.batch_size = 64u;
+                opt.depth = 64u;
+                opt.memory_limit = limits_mib[l] << 20u;
+                opt.gauges = gauges;
+                opt.read = pipe_read;
+                opt.format = pipe_format;
+                opt.write = pipe_write;
+                opt.release = pipe_release;
+                opt.ctx = &bench;
+
+                GaugeWatch watch;
+                watch.gauges = gauges;
+                atomic_init(&watch.stop, 0);
+                pthread_t watcher;
+                if (pthread_create(&watcher, NULL, watch_gauges, &watch) != 0) {
+                        fprintf(stderr, "cannot start gauge thread\n");
+                        return 1;
+                }
+                ASW_PipelineStats st;
+                int status = asw_pipeline_run(&opt, &st);
+                atomic_store(&watch.stop, 1);
+                pthread_join(watcher, NULL);
+                if (status != 0) {
+                        fprintf(stderr, "cannot start pipeline\n");
+                        return 1;
+                }
+                if (limits_mib[l] > 0u) printf("%8zu", limits_mib[l]);
+                else printf("%8s", "none");
+                printf(" %10.0f %9.1f %8.3f %8.3f %7zu %8zu %8u\n",
+                       (double)st.records / st.wall_sec, (double)st.peak_bytes / (1 << 20),
+                       st.read_memory_sec, st.align_memory_sec, watch.max.filled,
+                       watch.max.aligned, watch.max.aligners_blocked);
+        }
+        asw_pipeline_gauges_free(gauges);
+        fclose(out);
+        free_jobs(jobs, n_jobs);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_numa
+ *  Description:  Throughput of asw_batch at full load (one worker per allowed CPU)
+ *                with unbound workers, workers pinned to cores or bound to nodes,
+ *                and with the scoring model shared or replicated per node
+ * =====================================================================================
+ */
+static int bench_numa(size_t max_query_len, size_t n_jobs)
+{
+        static const struct {
+                const char *name;
+                int affinity;
+                int replicate_model;
+        } configs[] = {
+                {"none", ASW_AFFINITY_NONE, 0},
+                {"core", ASW_AFFINITY_CORE, 0},
+                {"core+replica", ASW_AFFINITY_CORE, 1},
+                {"node", ASW_AFFINITY_NODE, 0},
+                {"node+replica", ASW_AFFINITY_NODE, 1},
+        };
+
+        ASW_Job *jobs = skewed_jobs(max_query_len, n_jobs);
+        ASW_Result *results = (ASW_Result*)calloc(n_jobs, sizeof(ASW_Result));
+        ASW_Topology *topo = asw_topology_load();
+        if (jobs == NULL || results == NULL || topo == NULL) {
+                fprintf(stderr, "cannot allocate jobs\n");
+                return 1;
+        }
+        unsigned int node, n_cpus = 0u;
+        for (node = 0u; node < asw_topology_nodes(topo); ++node) {
+                n_cpus += asw_topology_cpus(topo, node);
+        }
+        printf("%u nodes, %u CPUs\n", asw_topology_nodes(topo), n_cpus);
+
+        ASW_BatchOptions opt;
+        asw_batch_options_init(&opt);
+        opt.nthreads = n_cpus > 0u ? n_cpus : 1u;
+        ASW_WorkerStats *stats = (ASW_WorkerStats*)malloc(sizeof(ASW_WorkerStats) * opt.nthreads);
+        if (stats == NULL) {
+                fprintf(stderr, "cannot allocate statistics\n");
+                return 1;
+        }
+        double base = 0.0;
+        printf("%14s %12s %8s %10s\n", "placement", "aligns/s", "speedup", "bound");
+        unsigned int c;
+        for (c = 0u; c < sizeof(configs) / sizeof(configs[0]); ++c) {
+                opt.affinity = configs[c].affinity;
+                opt.replicate_model = configs[c].replicate_model;
+                ASW_Batch *batch = asw_batch_new(&opt);
+                if (batch == NULL) {
+                        fprintf(stderr, "cannot start %u threads\n", opt.nthreads);
+                        return 1;
+                }
+                /* warm up the workspaces */
+                asw_batch_run(batch, jobs, results, n_jobs);
+                asw_result_clear(results, n_jobs);
+                double t0 = now_sec();
+                if (asw_batch_run(batch, jobs, results, n_jobs) != 0) {
+                        fprintf(stderr, "batch failed\n");
+                        return 1;
+                }
+                double t1 = now_sec();
+                asw_batch_stats(batch, stats);
+                asw_result_clear(results, n_jobs);
+                asw_batch_free(batch);
+
+                unsigned int w, bound = 0u;
+                for (w = 0u; w < opt.nthreads; ++w) {
+                        if (stats[w].node >= 0) ++bound;
+                }
+                double rate = (double)n_jobs / (t1 - t0);
+                if (base == 0.0) base = rate;
+                printf("%14s %12.0f %8.2f %6u/%-3u\n", configs[c].name, rate, rate / base,
+                       bound, opt.nthreads);
+        }
+
+        free(stats);
+        asw_topology_free(topo);
+        free_jobs(jobs, n_jobs);
+        free(results);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_prefetch
+ *  Description:  Back-to-back alignments of short jobs whose sequences are
+ *                scattered over an arena much larger than the caches, one job at
+ *                a time with asw_run_job versus asw_run_jobs, which prefetches the
+ *                next job's inputs during the traceback
+ * =====================================================================================
+ */
+static int bench_prefetch(size_t query_len, size_t n_jobs)
+{
+        const size_t arena_len = (size_t)256u << 20u,
+                     db_len = 2u * query_len + 32u,
+                     slot_len = (db_len + 2u * query_len + 63u) & ~(size_t)63u,
+                     n_slots = arena_len / slot_len;
+        if (query_len == 0u || n_slots == 0u) {
+                fprintf(stderr, "query length out of range\n");
+                return 1;
+        }
+
+        char *arena = (char*)malloc(arena_len);
+        ASW_Job *jobs = (ASW_Job*)malloc(sizeof(ASW_Job) * n_jobs);
+        ASW_Result *results = (ASW_Result*)calloc(n_jobs, sizeof(ASW_Result));
+        Alignment_ASW *al = asw_new(-10, 30, 50, 20);
+        if (arena == NULL || jobs == NULL || results == NULL || al == NULL) {
+                fprintf(stderr, "cannot allocate jobs\n");
+                return 1;
+        }
+        asw_set_phoffset(al, 33);
+        random_seq(arena, arena_len);
+        size_t i;
+        for (i = 0u; i < n_jobs; ++i) {
+                /* random slot: consecutive jobs are far apart in memory */
+                size_t slot = ((size_t)rand() * (RAND_MAX + 1u) + (size_t)rand()) % n_slots;
+                char *db = arena + slot * slot_len,
+                     *query = db + db_len;
+                uint8_t *qual = (uint8_t*)(query + query_len);
+                mutate_read(query, db + query_len / 2u, query_len);
+                memset(qual, 33 + 30, query_len);
+                jobs[i].db = db;
+                jobs[i].db_len = db_len;
+                jobs[i].query = query;
+                jobs[i].qual = qual;
+                jobs[i].query_len = query_len;
+                jobs[i].clip_head = 0u;
+                jobs[i].clip_tail = 0u;
+                jobs[i].flags = ASW_ALIGN_SEMI | ASW_TRACE_SOFTCLIP | ASW_TRACE_COMPACT;
+        }
+
+        printf("%10s %12s %12s\n", "round", "run_job/s", "run_jobs/s");
+        unsigned int round;
+        for (round = 1u; round <= 3u; ++round) {
+                double t0 = now_sec();
+                for (i = 0u; i < n_jobs; ++i) {
+                        asw_run_job(al, &jobs[i], &results[i]);
+                }
+                double t1 = now_sec();
+                asw_result_clear(results, n_jobs);
+                double t2 = now_sec();
+                asw_run_jobs(al, jobs, results, n_jobs);
+                double t3 = now_sec();
+                asw_result_clear(results, n_jobs);
+                printf("%10u %12.0f %12.0f\n", round,
+                       (double)n_jobs / (t1 - t0), (double)n_jobs / (t3 - t2));
+        }
+
+        asw_free(al);
+        free(results);
+        free(jobs);
+        free(arena);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  evict_caches
+ *  Description:  Touch a buffer larger than the last-level cache
+ * =====================================================================================
+ */
+static void evict_caches(char *buf, size_t len)
+{
+        size_t i;
+        for (i = 0u; i < len; i += 64u) {
+                buf[i] = (char)(buf[i] + 1);
+        }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_tracemany
+ *  Description:  Traceback of n long alignments (reference window three times the
+ *                query) on cold trace matrices, one after the other with asw_trace
+ *                versus interleaved with asw_trace_many, checking that the CIGARs
+ *                agree
+ * =====================================================================================
+ */
+static int bench_tracemany(size_t query_len, size_t n_als)
+{
+        const size_t db_len = 3u * query_len + 32u,
+                     evict_len = (size_t)64u << 20u;
+        const unsigned int reps = 5u;
+        Alignment_ASW **als = (Alignment_ASW**)calloc(n_als, sizeof(Alignment_ASW*));
+        cigar_t **cigars = (cigar_t**)calloc(n_als, sizeof(cigar_t*));
+        size_t *n_cigars = (size_t*)calloc(n_als, sizeof(size_t));
+        char *db = (char*)malloc(db_len),
+             *query = (char*)malloc(query_len),
+             *evict = (char*)calloc(evict_len, 1u);
+        uint8_t *qual = (uint8_t*)malloc(query_len);
+        if (als == NULL || cigars == NULL || n_cigars == NULL || db == NULL ||
+            query == NULL || evict == NULL || qual == NULL) {
+                fprintf(stderr, "cannot allocate alignments\n");
+                return 1;
+        }
+        memset(qual, 33 + 30, query_len);
+
+        size_t i;
+        for (i = 0u; i < n_als; ++i) {
+                random_seq(db, db_len);
+                mutate_read(query, db + query_len, query_len);
+                if ((als[i] = asw_new(-10, 30, 50, 20)) == NULL) {
+                        fprintf(stderr, "cannot allocate workspace\n");
+                        return 1;
+                }
+                asw_set_phoffset(als[i], 33);
+                /* the workspace keeps pointers to the sequences, but traceback
+                 * reads only the trace matrix */
+                asw_prepare(als[i], db, db_len, query, qual, query_len, 0u, 0u);
+                asw_align_init_semi(als[i]);
+                asw_align(als[i]);
+                asw_locate_minscore(als[i]);
+        }
+
+        double serial = 0.0, interleaved = 0.0;
+        unsigned int r;
+        for (r = 0u; r < reps; ++r) {
+                evict_caches(evict, evict_len);
+                double t0 = now_sec();
+                for (i = 0u; i < n_als; ++i) {
+                        asw_trace(als[i]);
+                }
+                serial += now_sec() - t0;
+                if (r == 0u) {
+                        for (i = 0u; i < n_als; ++i) {
+                                n_cigars[i] = als[i]->cigar_end - als[i]->cigar_begin;
+                                cigars[i] = (cigar_t*)malloc(sizeof(cigar_t) * n_cigars[i]);
+                                memcpy(cigars[i], als[i]->cigar_begin, sizeof(cigar_t) * n_cigars[i]);
+                        }
+                }
+
+                evict_caches(evict, evict_len);
+                t0 = now_sec();
+                asw_trace_many(als, n_als, NULL);
+                interleaved += now_sec() - t0;
+                for (i = 0u; i < n_als; ++i) {
+                        size_t n = als[i]->cigar_end - als[i]->cigar_begin;
+                        if (n != n_cigars[i] ||
+                            memcmp(cigars[i], als[i]->cigar_begin, sizeof(cigar_t) * n) != 0) {
+                                fprintf(stderr, "CIGAR of alignment %zu differs\n", i);
+                                return 1;
+                        }
+                }
+        }
+        printf("%8s %6s %12s %12s %8s\n", "query", "n", "serial us", "many us", "speedup");
+        printf("%8zu %6zu %12.1f %12.1f %8.2f\n", query_len, n_als,
+               1e6 * serial / reps, 1e6 * interleaved / reps, serial / interleaved);
+
+        for (i = 0u; i < n_als; ++i) {
+                asw_free(als[i]);
+                free(cigars[i]);
+        }
+        free(als);
+        free(cigars);
+        free(n_cigars);
+        free(db);
+        free(query);
+        free(qual);
+        free(evict);
+        return 0;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  write_fastq
+ *  Description:  Write random FASTQ records of read_len bases until the file holds
+ *                at least size bytes
+ * =====================================================================================
+ */
+static int write_fastq(const char *path, size_t read_len, size_t size)
+{
+        FILE *fp = fopen(path, "w");
+        char *seq = (char*)malloc(read_len + 1u),
+             *qual = (char*)malloc(read_len + 1u);
+        if (fp == NULL || seq == NULL || qual == NULL) return -1;
+        size_t written = 0u, n = 0u, i;
+        while (written < size) {
+                random_seq(seq, read_len);
+                for (i = 0u; i < read_len; ++i) {
+                        qual[i] = (char)(33 + rand() % 41);
+                }
+                seq[read_len] = qual[read_len] = '\0';
+                int k = fprintf(fp, "@read%zu length=%zu\n%s\n+\n%s\n", n++, read_len, seq, qual);
+                if (k < 0) break;
+                written += (size_t)k;
+        }
+        free(seq);
+        free(qual);
+        return fclose(fp) == 0 && written >= size ? 0 : -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  drop_cache
+ *  Description:  Ask the kernel to drop the cached pages of a file, so that the
+ *                next pass reads from the device
+ * =====================================================================================
+ */
+static void drop_cache(const char *path)
+{
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  stdio_pass
+ *  Description:  Parse a FASTQ file with buffered stdio, four getline calls per
+ *                record; returns the number of records and adds up their bases
+ * =====================================================================================
+ */
+static size_t stdio_pass(const char *path, size_t *bases)
+{
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) return 0u;
+        char *line[4] = {NULL, NULL, NULL, NULL};
+        size_t cap[4] = {0u, 0u, 0u, 0u}, n = 0u;
+        ssize_t len[4];
+        int k;
+        for (;;) {
+                for (k = 0; k < 4; ++k) {
+                        if ((len[k] = getline(&line[k], &cap[k], fp)) < 0) break;
+                }
+                if (k < 4) break;
+                *bases += (size_t)len[1] - 1u;
+                ++n;
+        }
+        for (k = 0; k < 4; ++k) {
+                free(line[k]);
+        }
+        fclose(fp);
+        return n;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  reader_pass
+ *  Description:  Parse a file with asw_reader; returns the number of records and
+ *                adds up their bases, or SIZE_MAX if the engine is not available
+ * =====================================================================================
+ */
+static size_t reader_pass(const char *path, int engine, size_t *bases)
+{
+        ASW_ReaderOptions opt;
+        asw_reader_options_init(&opt);
+        opt.engine = engine;
+        ASW_Reader *reader = asw_reader_open(path, &opt);
+        if (reader == NULL) return SIZE_MAX;
+        const ASW_RecordBlock *block;
+        size_t n = 0u, i;
+        while ((block = asw_reader_next(reader)) != NULL) {
+                for (i = 0u; i < block->n; ++i) {
+                        *bases += block->records[i].len;
+                }
+                n += block->n;
+                asw_reader_release(reader, block);
+        }
+        if (asw_reader_error(reader) != 0) n = SIZE_MAX;
+        asw_reader_close(reader);
+        return n;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bench_reader
+ *  Description:  Parsing throughput of a temporary FASTQ file with buffered stdio
+ *                versus asw_reader (pread threads and io_uring), from the page
+ *                cache and, as far as the kernel drops it, from the device
+ * =====================================================================================
+ */
+static int bench_reader(size_t read_len, size_t megabytes)
+{
+        static const struct {
+                const char *name;
+                int engine;             /* -1: stdio */
+        } engines[] = {
+                {"stdio", -1},
+                {"pread", ASW_READER_PREAD},
+                {"io_uring", ASW_READER_URING},
+        };
+        const unsigned int reps = 3u;
+        char path[] = "/tmp/bench454-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+                fprintf(stderr, "cannot create temporary file\n");
+                return 1;
+        }
+        close(fd);
+        size_t size = megabytes << 20u;
+        if (write_fastq(path, read_len, size) != 0) {
+                fprintf(stderr, "cannot write %s\n", path);
+                unlink(path);
+                return 1;
+        }
+
+        printf("%10s %6s %10s %12s\n", "engine", "cache", "MB/s", "records");
+        int cold;
+        unsigned int e, r;
+        for (cold = 0; cold < 2; ++cold) {
+                size_t expected = 0u;
+                for (e = 0u; e < sizeof(engines) / sizeof(engines[0]); ++e) {
+                        double best = 0.0;
+                        size_t n = 0u, bases = 0u;
+                        for (r = 0u; r < reps; ++r) {
+                                /* the first stdio pass warms the cache */
+                                if (cold) drop_cache(path);
+                                bases = 0u;
+                                double t0 = now_sec();
+                                n = engines[e].engine < 0 ? stdio_pass(path, &bases) :
+                                    reader_pass(path, engines[e].engine, &bases);
+                                double t = now_sec() - t0;
+                                if (n == SIZE_MAX) break;
+                                if (best == 0.0 || t < best) best = t;
+                        }
+                        if (n == SIZE_MAX) {
+                                printf("%10s %6s %10s\n", engines[e].name, cold ? "cold" : "hot",
+                                       "n/a");
+                                continue;
+                        }
+                        if (e == 0u) expected = n;
+                        if (n != expected) {
+                                fprintf(stderr, "%s parsed %zu records, stdio %zu\n",
+                                        engines[e].name, n, expected);
+                                unlink(path);
+                                return 1;
+                        }
+                        printf("%10s %6s %10.0f %12zu\n", engines[e].name, cold ? "cold" : "hot",
+                               (double)size / (1 << 20) / best, n);
+                }
+        }
+        unlink(path);
+        return 0;
+}
+
+/* Input of check_reader: file contents and the records a naive parse finds */
+typedef struct {
+        char *text;
+        size_t len, cap;
+        size_t n;               /* records */
+        size_t *name, *name_len, *seq, *qual, *seq_len;  /* offsets into seqs */
+        char *seqs;             /* names, sequences and qualities, back to back */
+        size_t seqs_len, seqs_cap;
+} CheckInput;
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  check_append
+ *  Description:  Append len bytes to a growing buffer; returns the offset of the
+ *                copy, or SIZE_MAX if out of memory
+ * =====================================================================================
+ */
+static size_t check_append(char **buf, size_t *len, size_t *cap, const char *src, size_t n)
+{
+        if (*len + n > *cap) {
+                size_t cap2 = *cap > 0u ? *cap : 4096u;
+                while (cap2 < *len + n) cap2 *= 2u;
+                char *tmp = (char*)realloc(*buf, cap2);
+                if (tmp == NULL) return SIZE_MAX;
+                *buf = tmp;
+                *cap = cap2;
+        }
+        memcpy(*buf + *len, src, n);
+        *len += n;
+        return *len - n;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  check_input
+ *  Description:  Generate n_records random records (FASTQ, or FASTA wrapped at 60
+ *                columns) with the given line ending, some of them longer than the
+ *                headroom of the reader, and parse the text naively, line by line.
+ *                Returns 0, or -1 if out of memory.
+ * =====================================================================================
+ */
+static int check_input(CheckInput *in, int fasta, const char *eol, size_t n_records)
+{
+        memset(in, 0, sizeof(CheckInput));
+        size_t eol_len = strlen(eol), k, i;
+        char header[64];
+        char *seq = NULL, *qual = NULL;
+        size_t max_len = 200u << 10u;
+        if ((seq = (char*)malloc(max_len)) == NULL || (qual = (char*)malloc(max_len)) == NULL)
+                goto error;
+
+        /* generate the file */
+        for (k = 0u; k < n_records; ++k) {
+                /* mostly short reads, every 50th one past the 64 KiB headroom */
+                size_t len = k % 50u == 49u ? (size_t)(70000 + rand() % 60000) :
+                                              (size_t)(1 + rand() % 400);
+                random_seq(seq, len);
+                for (i = 0u; i < len; ++i) {
+                        qual[i] = (char)(33 + rand() % 41);
+                }
+                int h = snprintf(header, sizeof(header), "%cread%zu length=%zu",
+                                 fasta ? '>' : '@', k, len);
+                if (check_append(&in->text, &in->len, &in->cap, header, (size_t)h) == SIZE_MAX ||
+                    check_append(&in->text, &in->len, &in->cap, eol, eol_len) == SIZE_MAX)
+                        goto error;
+                if (fasta) {
+                        for (i = 0u; i < len; i += 60u) {
+                                size_t w = len - i < 60u ? len - i : 60u;
+                                if (check_append(&in->text, &in->len, &in->cap, seq + i, w) == SIZE_MAX ||
+                                    check_append(&in->text, &in->len, &in->cap, eol, eol_len) == SIZE_MAX)
+                                        goto error;
+                        }
+                } else if (check_append(&in->text, &in->len, &in->cap, seq, len) == SIZE_MAX ||
+                           check_append(&in->text, &in->len, &in->cap, eol, eol_len) == SIZE_MAX ||
+                           check_append(&in->text, &in->len, &in->cap, "+", 1u) == SIZE_MAX ||
+                           check_append(&in->text, &in->len, &in->cap, eol, eol_len) == SIZE_MAX ||
+                           check_append(&in->text, &in->len, &in->cap, qual, len) == SIZE_MAX ||
+                           check_append(&in->text, &in->len, &in->cap, eol, eol_len) == SIZE_MAX) {
+                        goto error;
+                }
+        }
+
+        /* parse it back: lines without line endings */
+        in->name = (size_t*)malloc(sizeof(size_t) * n_records);
+        in->name_len = (size_t*)malloc(sizeof(size_t) * n_records);
+        in->seq = (size_t*)malloc(sizeof(size_t) * n_records);
+        in->qual = (size_t*)malloc(sizeof(size_t) * n_records);
+        in->seq_len = (size_t*)malloc(sizeof(size_t) * n_records);
+        if (in->name == NULL || in->name_len == NULL || in->seq == NULL ||
+            in->qual == NULL || in->seq_len == NULL)
+                goto error;
+        size_t pos = 0u, line = 0u;
+        while (pos < in->len) {
+                const char *nl = (const char*)memchr(in->text + pos, '\n', in->len - pos);
+                size_t end = nl != NULL ? (size_t)(nl - in->text) : in->len, stop = end;
+                if (stop > pos && in->text[stop - 1u] == '\r') --stop;
+                const char *l = in->text + pos;
+                size_t l_len = stop - pos;
+                if (l[0] == (fasta ? '>' : '@') && (fasta || line % 4u == 0u)) {
+                        size_t w = 1u;
+                        while (w < l_len && l[w] != ' ') ++w;
+                        in->name[in->n] = check_append(&in->seqs, &in->seqs_len,
+                                                       &in->seqs_cap, l + 1, w - 1u);
+                        in->name_len[in->n] = w - 1u;
+                        in->seq[in->n] = in->seqs_len;
+                        in->seq_len[in->n] = 0u;
+                        in->qual[in->n] = SIZE_MAX;
+                        ++in->n;
+                } else if (fasta || line % 4u == 1u) {
+                        check_append(&in->seqs, &in->seqs_len, &in->seqs_cap, l, l_len);
+                        in->seq_len[in->n - 1u] += l_len;
+                } else if (line % 4u == 3u) {
+                        in->qual[in->n - 1u] = check_append(&in->seqs, &in->seqs_len,
+                                                            &in->seqs_cap, l, l_len);
+                }
+                ++line;
+                pos = end + 1u;
+        }
+        free(seq);
+        free(qual);
+        return in->n == n_records ? 0 : -1;
+error:
+        free(seq);
+        free(qual);
+        return -1;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  check_free
+ *  Description:  Free a CheckInput
+ * =====================================================================================
+ */
+static void check_free(CheckInput *in)
+{
+        free(in->text);
+        free(in->name);
+        free(in->name_len);
+        free(in->seq);
+        free(in->qual);
+        free(in->seq_len);
+        free(in->seqs);
+}
+
+/* Writer end of the FIFO of check_reader */
+typedef struct {
+        const char *path;
+        const CheckInput *in;
+} CheckFifo;
+
+static void *check_fifo_writer(void *arg)
+{
+        const CheckFifo *f = (const CheckFifo*)arg;
+        FILE *fp = fopen(f->path, "w");
+        if (fp == NULL) return NULL;
+        fwrite(f->in->text, 1u, f->in->len, fp);
+        fclose(fp);
+        return NULL;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  check_pass
+ *  Description:  Read path with asw_reader in 4 KiB chunks and compare every record
+ *                with the naive parse. Returns 0 if all agree, 1 on a difference or
+ *                error, or -1 if the engine is not available.
+ * =====================================================================================
+ */
+static int check_pass(const char *path, int engine, const CheckInput *in)
+{
+        ASW_ReaderOptions opt;
+        asw_reader_options_init(&opt);
+        opt.engine = engine;
+        opt.chunk_size = 4096u;
+        opt.depth = 4u;
+        ASW_Reader *reader = asw_reader_open(path, &opt);
+        if (reader == NULL) return -1;
+        const ASW_RecordBlock *block;
+        size_t k = 0u, i;
+        int status = 0;
+        while (status == 0 && (block = asw_reader_next(reader)) != NULL) {
+                for (i = 0u; i < block->n && status == 0; ++i, ++k) {
+                        const ASW_Record *rec = &block->records[i];
+                        if (k >= in->n ||
+                            rec->name_len != in->name_len[k] ||
+                            memcmp(rec->name, in->seqs + in->name[k], rec->name_len) != 0 ||
+                            rec->len != in->seq_len[k] ||
+                            memcmp(rec->seq, in->seqs + in->seq[k], rec->len) != 0 ||
+                            (rec->qual == NULL) != (in->qual[k] == SIZE_MAX) ||
+                            (rec->qual != NULL &&
+                             memcmp(rec->qual, in->seqs + in->qual[k], rec->len) != 0))
+                        {
+                                fprintf(stderr, "record %zu differs\n", k);
+                                status = 1;
+                        }
+                }
+                asw_reader_release(reader, block);
+        }
+        if (status == 0 && asw_reader_error(reader) != 0) {
+                fprintf(stderr, "reader error %d\n", asw_reader_error(reader));
+                status = 1;
+        }
+        if (status == 0 && k != in->n) {
+                fprintf(stderr, "%zu records, expected %zu\n", k, in->n);
+                status = 1;
+        }
+        asw_reader_close(reader);
+        return status;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  check_reader
+ *  Description:  Self-check of asw_reader: FASTQ and multi-line FASTA with LF and
+ *                CRLF line endings, records longer than the headroom, read in
+ *                4 KiB chunks from a file by both engines and from a FIFO, against
+ *                a naive line-by-line parse. Returns nonzero on any difference.
+ * =====================================================================================
+ */
+static int check_reader(size_t n_records)
+{
+        static const struct {
+                const char *name;
+                int fasta;
+                const char *eol;
+        } inputs[] = {
+                {"fastq/lf", 0, "\n"},
+                {"fastq/crlf", 0, "\r\n"},
+                {"fasta/lf", 1, "\n"},
+                {"fasta/crlf", 1, "\r\n"},
+        };
+        static const struct {
+                const char *name;
+                int engine;
+                int fifo;
+        } modes[] = {
+                {"pread", ASW_READER_PREAD, 0},
+                {"io_uring", ASW_READER_URING, 0},
+                {"fifo", ASW_READER_AUTO, 1},
+        };
+        char path[] = "/tmp/bench454-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+                fprintf(stderr, "cannot create temporary file\n");
+                return 1;
+        }
+        close(fd);
+        /* a reader that stops early must not kill the FIFO writer */
+        signal(SIGPIPE, SIG_IGN);
+        char fifo[sizeof(path) + 5u];
+        snprintf(fifo, sizeof(fifo), "%s.fifo", path);
+
+        int failed = 0;
+        unsigned int t, m;
+        for (t = 0u; t < sizeof(inputs) / sizeof(inputs[0]); ++t) {
+                CheckInput in;
+                if (check_input(&in, inputs[t].fasta, inputs[t].eol, n_records) != 0) {
+                        fprintf(stderr, "cannot generate %s input\n", inputs[t].name);
+                        check_free(&in);
+                        failed = 1;
+                        break;
+                }
+                FILE *fp = fopen(path, "w");
+                if (fp == NULL || fwrite(in.text, 1u, in.len, fp) != in.len || fclose(fp) != 0) {
+                        fprintf(stderr, "cannot write %s\n", path);
+                        check_free(&in);
+                        failed = 1;
+                        break;
+                }
+                for (m = 0u; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+                        int status;
+                        if (modes[m].fifo) {
+                                pthread_t writer;
+                                CheckFifo f = {fifo, &in};
+                                if (mkfifo(fifo, 0600) != 0 ||
+                                    pthread_create(&writer, NULL, check_fifo_writer, &f) != 0) {
+                                        unlink(fifo);
+                                        status = 1;
+                                } else {
+                                        status = check_pass(fifo, modes[m].engine, &in);
+                                        pthread_join(writer, NULL);
+                                        unlink(fifo);
+                                }
+                        } else {
+                                status = check_pass(path, modes[m].engine, &in);
+                        }
+                        printf("%12s %10s %s\n", inputs[t].name, modes[m].name,
+                               status < 0 ? "n/a" : status == 0 ? "ok" : "FAILED");
+                        if (status > 0) failed = 1;
+                }
+                check_free(&in);
+        }
+        unlink(path);
+        return failed;
+}
+
+int main(int argc, char *argv[])
+{
+        if (argc < 2) {
+                fprintf(stderr, "usage: %s layout|fixed|trace|batch|bucket|stream|pipeline|backpressure|numa|prefetch|tracemany|reader|readercheck [query_len] [reps]\n", argv[0]);
+                return 2;
+        }
+        srand(20110405u);
+        if (strcmp(argv[1], "layout") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 400u;
+                unsigned int reps = argc > 3 ? (unsigned int)atoi(argv[3]) : 20u;
+                return bench_layout(query_len, reps);
+        }
+        if (strcmp(argv[1], "fixed") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 100u;
+                unsigned int reps = argc > 3 ? (unsigned int)atoi(argv[3]) : 200u;
+                return bench_fixed(query_len, reps);
+        }
+        if (strcmp(argv[1], "trace") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 100u;
+                unsigned int reps = argc > 3 ? (unsigned int)atoi(argv[3]) : 200000u;
+                return bench_trace(query_len, reps);
+        }
+        if (strcmp(argv[1], "batch") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 1000u;
+                size_t n_jobs = argc > 3 ? (size_t)atol(argv[3]) : 1000u;
+                return bench_batch(query_len, n_jobs);
+        }
+        if (strcmp(argv[1], "bucket") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 1000u;
+                size_t n_jobs = argc > 3 ? (size_t)atol(argv[3]) : 1000u;
+                return bench_bucket(query_len, n_jobs);
+        }
+        if (strcmp(argv[1], "stream") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 1000u;
+                size_t n_jobs = argc > 3 ? (size_t)atol(argv[3]) : 1000u;
+                return bench_stream(query_len, n_jobs);
+        }
+        if (strcmp(argv[1], "pipeline") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 1000u;
+                size_t n_jobs = argc > 3 ? (size_t)atol(argv[3]) : 1000u;
+                return bench_pipeline(query_len, n_jobs);
+        }
+        if (strcmp(argv[1], "backpressure") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 300u;
+                size_t n_jobs = argc > 3 ? (size_t)atol(argv[3]) : 2000u;
+                return bench_backpressure(query_len, n_jobs);
+        }
+        if (strcmp(argv[1], "numa") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 2000u;
+                size_t n_jobs = argc > 3 ? (size_t)atol(argv[3]) : 1000u;
+                return bench_numa(query_len, n_jobs);
+        }
+        if (strcmp(argv[1], "prefetch") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 100u;
+                size_t n_jobs = argc > 3 ? (size_t)atol(argv[3]) : 100000u;
+                return bench_prefetch(query_len, n_jobs);
+        }
+        if (strcmp(argv[1], "tracemany") == 0) {
+                size_t query_len = argc > 2 ? (size_t)atol(argv[2]) : 1000u;
+                size_t n_als = argc > 3 ? (size_t)atol(argv[3]) : 16u;
+                return bench_tracemany(query_len, n_als);
+        }
+        if (strcmp(argv[1], "reader") == 0) {
+                size_t read_len = argc > 2 ? (size_t)atol(argv[2]) : 150u;
+                size_t megabytes = argc > 3 ? (size_t)atol(argv[3]) : 256u;
+                return bench_reader(read_len, megabytes);
+        }
+        if (strcmp(argv[1], "readercheck") == 0) {
+                size_t n_records = argc > 2 ? (size_t)atol(argv[2]) : 2000u;
+                return check_reader(n_records);
+        }
+        fprintf(stderr, "unknown benchmark '%s'\n", argv[1]);
+        return 2;
+}
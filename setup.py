@@ -88,7 +88,10 @@ DEPENDENCY_LINKS = list(set(itertools.chain(
 
 setup(
     ext_modules=[
-        Extension("qxalign", sources=["qxalign.c", "align454.c"])
+        Extension("qxalign",
+                  sources=["qxalign.c", "align454.c", "asw_batch.c", "asw_affinity.c"],
+                  extra_compile_args=["-pthread"],
+                  extra_link_args=["-pthread"])
     ],
     name="qxalign",
     author="Eugene Scherba",
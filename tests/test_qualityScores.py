@@ -1,5 +1,8 @@
+import threading
+import time
+from array import array
 import unittest
-from qxalign import Qxalign
+from qxalign import Qxalign, BatchResult, estimate_bytes, pool_stats, set_pool_limit, FIXED_DB_MAX
 
 
 class TestQualityScores(unittest.TestCase):
@@ -25,6 +28,339 @@ class TestQualityScores(unittest.TestCase):
         q.prepare("", "", "")
         self.assertRaises(IndexError, q.align, [])
 
+    def test_traceOptions(self):
+        q = Qxalign()
+
+        q.prepare("GGGACGTACGTACGTGGG", "CACGTACGAACGTC")
+        q.align(semi=True)
+        q.trace()
+        self.assertEqual("1X 7= 1X 4= 1X", q.show_trace())
+        q.align(semi=True)
+        q.trace(softclip=True)
+        self.assertEqual("1S 7= 1X 4= 1S", q.show_trace())
+        q.align(semi=True)
+        q.trace(softclip=True, compact=True)
+        self.assertEqual("1S 12M 1S", q.show_trace())
+        self.assertEqual("1S12M1S", q.show_trace(sam=True))
+        self.assertEqual((b"ACGTACGTACGT", b"ACGTACGAACGT"), q.show_pair())
+
+        q.prepare("AAAACGT", "TGCA", b"!!!!")
+        q.align()
+        q.trace()
+        self.assertEqual((b"---A", b"TGCA"), q.show_pair())
+
+    def test_alignFull(self):
+        for q in (Qxalign(), Qxalign(fixed=True)):
+            self.assertEqual((60, 0, "3I1=", 1),
+                             q.align_full("AAAACGT", "TGCA", b"!!!!"))
+            score, offset, cigar, end = q.align_full(
+                "GGGACGTACGTACGTGGG", "CACGTACGAACGTC",
+                semi=True, softclip=True, compact=True)
+            self.assertEqual((3, "1S12M1S", 15), (offset, cigar, end))
+            q.align_full("GGGACGTACGTACGTGGG", "CACGTACGAACGTC", semi=True)
+            self.assertEqual("1X 7= 1X 4= 1X", q.show_trace())
+
+    def test_traceStats(self):
+        q = Qxalign()
+
+        q.prepare("GGGACGTACGTACGTGGG", "CACGTACGAACGTC")
+        q.align(semi=True)
+        q.trace(md=True)
+        stats = q.trace_stats()
+        self.assertEqual(11, stats["matches"])
+        self.assertEqual(3, stats["mismatches"])
+        self.assertEqual(3, stats["nm"])
+        self.assertEqual("0G7T4G0", stats["md"])
+
+        q.align(semi=True)
+        q.trace(softclip=True, compact=True, md=True)
+        stats = q.trace_stats()
+        self.assertEqual(1, stats["nm"])
+        self.assertEqual("7T4", stats["md"])
+
+        q.align(semi=True)
+        q.trace()
+        self.assertIsNone(q.trace_stats()["md"])
+
+    def test_fixedWorkspace(self):
+        q = Qxalign(fixed=True)
+
+        q.prepare("AAAACGT", "TGCA", b"!!!!")
+        self.assertEqual(60, q.align())
+        q.trace()
+        self.assertEqual("3I 1=", q.show_trace())
+
+        q.prepare_query(query_seq="CAAC")
+        self.assertEqual(40, q.align(semi=True))
+        q.trace()
+        self.assertEqual("1X 3=", q.show_trace())
+
+        self.assertRaises(ValueError, q.prepare, "A" * (FIXED_DB_MAX + 1), "TGCA")
+
+    def test_estimateBytes(self):
+        score_only = estimate_bytes(100, 40, trace=False)
+        with_trace = estimate_bytes(100, 40)
+        self.assertEqual(4 * (40 + 4), with_trace - score_only)
+        self.assertEqual(3 * 100 + 2 * 40 + 24,
+                         estimate_bytes(100, 40, md=True) - with_trace)
+        self.assertGreater(estimate_bytes(200, 40), with_trace)
+        self.assertGreater(estimate_bytes(100, 40, debug=True), with_trace)
+        self.assertRaises(ValueError, estimate_bytes, -1, 40)
+        self.assertEqual(0, estimate_bytes(FIXED_DB_MAX + 1, 40, fixed=True))
+
+    def test_workspacePool(self):
+        before = pool_stats()
+        for _ in range(10):
+            q = Qxalign()
+            q.prepare("AAAACGT", "TGCA", b"!!!!")
+            self.assertEqual(60, q.align())
+            q.trace()
+            del q
+        after = pool_stats()
+        self.assertEqual(before["borrows"] + 10, after["borrows"])
+        self.assertLessEqual(after["allocations"] - before["allocations"], 1)
+        self.assertEqual(before["in_use"], after["in_use"])
+
+        # result survives return of the workspace to the pool
+        q = Qxalign()
+        q.prepare("AAAACGT", "TGCA", b"!!!!")
+        q.align()
+        self.assertEqual(before["in_use"] + 1, pool_stats()["in_use"])
+        q.trace()
+        self.assertEqual(before["in_use"], pool_stats()["in_use"])
+        self.assertEqual("3I 1=", q.show_trace())
+
+        # tracing again aligns again with a workspace from the pool
+        q.prepare("AAAACGTACGTACGT", "ACGTACGA", b"IIIIIIII")
+        q.align(semi=True)
+        q.trace()
+        expected = q.show_trace()
+        q.trace(softclip=True)
+        self.assertEqual(before["in_use"], pool_stats()["in_use"])
+        q.trace()
+        self.assertEqual(expected, q.show_trace())
+        q.prepare("AAAACGT", "TGCA", b"!!!!")
+        self.assertRaises(RuntimeError, q.trace)
+
+        # a fixed workspace keeps its alignment
+        f = Qxalign(fixed=True)
+        f.prepare("AAAACGTACGTACGT", "ACGTACGA", b"IIIIIIII")
+        f.align(semi=True)
+        f.trace()
+        f.trace(softclip=True)
+        f.trace()
+        self.assertEqual(expected, f.show_trace())
+
+        limit = set_pool_limit(0)
+        self.assertEqual(0, pool_stats()["size"])
+        self.assertEqual(0, set_pool_limit(limit))
+
+    def test_threads(self):
+        db = "GGGACGTACGTACGTGGG" * 20
+        queries = ["CACGTACGAACGTC" * k for k in range(1, 9)]
+        expected = [Qxalign().align_full(db, query, semi=True) for query in queries]
+        results = [None] * len(queries)
+
+        def worker(i):
+            q = Qxalign()
+            for _ in range(20):
+                results[i] = q.align_full(db, queries[i], semi=True)
+
+        threads = [threading.Thread(target=worker, args=(i,))
+                   for i in range(len(queries))]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(expected, results)
+
+    def test_alignMany(self):
+        q = Qxalign()
+        db = "GGGACGTACGTACGTGGG"
+        queries = ["CACGTACGAACGTC", b"TGCA", "ACGTACGT", "GGGACG"]
+        quals = [None, b"!!!!", "IIIIIIII", None]
+        expected = [q.align_full(db, query, qual, semi=True, softclip=True)
+                    for query, qual in zip(queries, quals)]
+        for threads in (1, 3):
+            self.assertEqual(expected, q.align_many(db, queries, quals, threads=threads,
+                                                    semi=True, softclip=True))
+        unclipped = q.align_many(db, queries, quals, semi=True)
+        scores = q.align_many(db, queries, quals, trace=False, semi=True)
+        self.assertEqual([(score, None, None, end) for score, _, _, end in unclipped],
+                         scores)
+        self.assertEqual([], q.align_many(db, []))
+        self.assertRaises(IndexError, q.align_many, db, ["ACGT", ""])
+        self.assertRaises(IndexError, q.align_many, db, ["ACGT"], [b"!!"])
+        self.assertRaises(ValueError, q.align_many, db, ["ACGT"], [])
+        self.assertRaises(ValueError, q.align_many, db, ["ACGT"], threads=-1)
+        self.assertRaises(ValueError, q.align_many, db, ["ACGT"], threads=1 << 20)
+
+    def test_alignRagged(self):
+        q = Qxalign()
+        queries = [b"CACGTACGAACGTC", b"TGCA", b"ACGTACGT"]
+        quals = [b"5" * 14, b"!!!!", b"IIIIIIII"]
+        offsets = array("q", [0])
+        for query in queries:
+            offsets.append(offsets[-1] + len(query))
+        seqs, qual_buf = b"".join(queries), b"".join(quals)
+
+        db = "GGGACGTACGTACGTGGG"
+        self.assertEqual(q.align_many(db, queries, quals, semi=True),
+                         q.align_ragged(db, seqs, offsets, qual_buf, semi=True))
+        self.assertEqual(q.align_many(db, queries, semi=True),
+                         q.align_ragged(db, bytearray(seqs), array("i", offsets), semi=True))
+
+        # windows of a reference, shared by records
+        windows = [b"GGGACGTACGTACGTGGG", b"AAAACGT"]
+        db_offsets = array("q", [0, 18, 25])
+        mapping = array("q", [0, 1, 0])
+        expected = [q.align_full(windows[w], query, qual, semi=True)
+                    for query, qual, w in zip(queries, quals, mapping)]
+        self.assertEqual(expected, q.align_ragged(b"".join(windows), seqs, offsets, qual_buf,
+                                                  db_offsets=db_offsets, windows=mapping,
+                                                  semi=True))
+        self.assertEqual([], q.align_ragged(db, b"", array("q", [0])))
+
+        self.assertRaises(ValueError, q.align_ragged, db, seqs, array("q", [0, 20, 10]))
+        self.assertRaises(TypeError, q.align_ragged, db, seqs, array("d", [0.0, 4.0]))
+        self.assertRaises(ValueError, q.align_ragged, db, seqs, offsets, threads=-1)
+        self.assertRaises(IndexError, q.align_ragged, b"".join(windows), seqs, offsets,
+                          db_offsets=db_offsets, windows=array("q", [0, 2, 0]))
+        self.assertRaises(ValueError, q.align_ragged, b"".join(windows), seqs, offsets,
+                          db_offsets=db_offsets)
+
+    def test_cigarBuffer(self):
+        q = Qxalign()
+        q.prepare("AAAACGT", "TGCA", b"!!!!")
+        q.align()
+        q.trace()
+        view = q.cigar()
+        self.assertEqual(("I", 4, True), (view.format, view.itemsize, view.readonly))
+        # BAM packing: length << 4 | operation (I = 1, = = 7)
+        self.assertEqual([3 << 4 | 1, 1 << 4 | 7], view.tolist())
+        self.assertEqual(view.tolist(), memoryview(q).tolist())
+
+        copy = q.cigar_copy()
+        q.align()
+        self.assertRaises(BufferError, q.trace)
+        self.assertRaises(BufferError, q.align_full, "AAAACGT", "TGCA")
+        view.release()
+        q.trace(compact=True)
+        self.assertEqual([3 << 4 | 1, 1 << 4 | 0], q.cigar().tolist())
+        self.assertEqual([3 << 4 | 1, 1 << 4 | 7], copy.tolist())
+
+    def test_columnarResults(self):
+        q = Qxalign()
+        db = "GGGACGTACGTACGTGGG"
+        queries = ["CACGTACGAACGTC", "TGCA", "ACGTACGT"]
+        expected = q.align_many(db, queries, semi=True, compact=True)
+        res = q.align_many(db, queries, semi=True, compact=True, columnar=True)
+        self.assertIsInstance(res, BatchResult)
+        self.assertEqual(expected, list(res))
+        self.assertEqual(expected[-1], res[-1])
+        self.assertEqual(q.align_many(db, queries, semi=True, sam=False),
+                         list(q.align_many(db, queries, semi=True, sam=False,
+                                           columnar=True)))
+        self.assertEqual(("i", "q", "I"), (res.scores.format, res.offsets.format,
+                                           res.cigars.format))
+        self.assertEqual([score for score, _, _, _ in expected], res.scores.tolist())
+        self.assertEqual([offset for _, offset, _, _ in expected], res.offsets.tolist())
+        self.assertEqual([end for _, _, _, end in expected], res.ends.tolist())
+        self.assertEqual([0] * len(queries), res.status.tolist())
+        cigar_offsets = res.cigar_offsets.tolist()
+        self.assertEqual(len(queries) + 1, len(cigar_offsets))
+        self.assertEqual(len(res.cigars), cigar_offsets[-1])
+        # first alignment: 1M 12M 1M compacted to a single operation (M = 0)
+        self.assertEqual([14 << 4], res.cigars[cigar_offsets[0]:cigar_offsets[1]].tolist())
+
+        offsets = array("q", [0, 14, 18, 26])
+        ragged = q.align_ragged(db, "".join(queries), offsets, trace=False, semi=True,
+                                columnar=True)
+        self.assertEqual([-1] * 3, ragged.offsets.tolist())
+        self.assertEqual(0, len(ragged.cigars))
+        self.assertEqual(q.align_many(db, queries, trace=False, semi=True), list(ragged))
+
+    def test_newSequencesDropTrace(self):
+        q = Qxalign()
+        q.align_full("ACGT" * 100, "ACGT" * 90)
+        q.prepare("AC", "AC")
+        self.assertEqual((b"", b""), q.show_pair())
+        self.assertEqual("", q.show_trace())
+        self.assertEqual(0, q.trace_stats()["matches"])
+
+        q.align_full("ACGT" * 100, "ACGT" * 90)
+        q.prepare_db("AC")
+        self.assertEqual((b"", b""), q.show_pair())
+        q.align_full("ACGT" * 100, "ACGT" * 90, md=True)
+        q.prepare_query("AC")
+        self.assertIsNone(q.trace_stats()["md"])
+        q.align_full("ACGT" * 100, "ACGT" * 90)
+        self.assertRaises(IndexError, q.align_full, "AC", "")
+        self.assertEqual((b"", b""), q.show_pair())
+
+    def test_readWhileBusy(self):
+        q = Qxalign()
+        inputs = [("ACGT" * 300, "ACGT" * 280), ("AC", "AC")]
+        traces = set()
+        for db, query in inputs:
+            q.align_full(db, query)
+            traces.add(q.show_trace())
+        done = threading.Event()
+
+        def worker():
+            for i in range(40):
+                q.align_full(*inputs[i % 2])
+            done.set()
+
+        t = threading.Thread(target=worker)
+        t.start()
+        while not done.is_set():
+            # either refused or a complete result of one of the inputs
+            try:
+                self.assertIn(q.show_trace(), traces)
+                ref, query = q.show_pair()
+                self.assertEqual(len(ref), len(query))
+            except RuntimeError:
+                pass
+        t.join()
+
+    def test_cigarBufferWhileBusy(self):
+        db = "GGGACGTACGTACGTGGGTTACAGATTACA" * 50
+        query = db[30:1470]
+        # a mismatch every 7 bases: compacting changes most operations
+        query = "".join("T" if i % 7 == 0 and c != "T" else c
+                        for i, c in enumerate(query))
+        q = Qxalign()
+        q.prepare(db, query)
+        done = threading.Event()
+
+        def worker():
+            for i in range(60):
+                q.align(semi=True)
+                while True:
+                    try:
+                        q.trace(compact=bool(i % 2))
+                        break
+                    except BufferError:
+                        # the main thread holds a view
+                        time.sleep(0.0005)
+            done.set()
+
+        t = threading.Thread(target=worker)
+        t.start()
+        while not done.is_set():
+            try:
+                view = memoryview(q)
+            except BufferError:
+                time.sleep(0.0005)
+                continue
+            # an exported CIGAR does not change under the view
+            before = view.tobytes()
+            time.sleep(0.005)
+            self.assertEqual(before, view.tobytes())
+            view.release()
+            time.sleep(0.0005)
+        t.join()
 
 if __name__ == "__main__":
     unittest.run(verbose=True)